@@ -0,0 +1,159 @@
+#include "checkpoint.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <omp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static size_t page_size() {
+  return sysconf(_SC_PAGESIZE);
+}
+
+static size_t round_up_pages(size_t bytes) {
+  return (bytes + page_size() - 1) / page_size() * page_size();
+}
+
+bool load_checkpoint(const string& file_name, unique_ptr<Matrix<double>>& state, int& iterations, double& last_difference) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || size_t(st.st_size) < page_size()) {
+    ::close(fd);
+    return false;
+  }
+  void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  const CheckpointHeader* header = static_cast<const CheckpointHeader*>(mapping);
+  bool ok = !memcmp(header->magic, "HCKP", 4)
+    && header->version == checkpoint_version
+    && (header->active_slot == 0 || header->active_slot == 1);
+  if (ok) {
+    const size_t slot_size = round_up_pages(sizeof(double) * header->height * header->width_aligned);
+    state = make_unique<Matrix<double>>(header->height, header->width);
+    ok = size_t(st.st_size) >= page_size() + 2 * slot_size && state->width_aligned == header->width_aligned;
+    if (ok) {
+      const double* data = reinterpret_cast<const double*>(static_cast<const char*>(mapping) + page_size() + header->active_slot * slot_size);
+      copy(data, data + header->height * header->width_aligned, state->data);
+      iterations = header->iteration[header->active_slot];
+      last_difference = header->difference[header->active_slot];
+    }
+  }
+  munmap(mapping, st.st_size);
+  return ok;
+}
+
+Checkpointer::Checkpointer(const string& file_name, size_t height, size_t width, size_t width_aligned)
+  : slot_size(round_up_pages(sizeof(double) * height * width_aligned)), mapping_size(page_size() + 2 * slot_size) {
+  int fd = open(file_name.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    return;
+  }
+  if (ftruncate(fd, mapping_size) != 0) {
+    ::close(fd);
+    return;
+  }
+  void* mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    return;
+  }
+  header = static_cast<CheckpointHeader*>(mapping);
+  // Se conserva el último punto de control si el fichero ya era de un problema del mismo tamaño
+  if (memcmp(header->magic, "HCKP", 4) || header->version != checkpoint_version
+      || header->height != height || header->width != width || header->width_aligned != width_aligned) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, "HCKP", 4);
+    header->version = checkpoint_version;
+    header->height = height;
+    header->width = width;
+    header->width_aligned = width_aligned;
+    header->active_slot = -1;
+    msync(header, page_size(), MS_SYNC);
+  }
+  thread = std::thread(&Checkpointer::run, this);
+}
+
+Checkpointer::~Checkpointer() {
+  close();
+}
+
+double* Checkpointer::slot(int64_t s) const {
+  return reinterpret_cast<double*>(reinterpret_cast<char*>(header) + page_size() + s * slot_size);
+}
+
+void Checkpointer::save(const Matrix<double>& state, int iterations, double last_difference) {
+  if (header == nullptr) {
+    return;
+  }
+  int64_t s;
+  {
+    unique_lock<std::mutex> lock(mutex);
+    if (pending_slot >= 0) {
+      double start = omp_get_wtime();
+      changed.wait(lock, [this] { return pending_slot < 0; });
+      wait_time += omp_get_wtime() - start;
+    }
+    s = header->active_slot == 0 ? 1 : 0;
+  }
+  double start = omp_get_wtime();
+  copy(&state.data[0], &state.data[state.height * state.width_aligned], slot(s));
+  header->iteration[s] = iterations;
+  header->difference[s] = last_difference;
+  copy_time += omp_get_wtime() - start;
+  {
+    lock_guard<std::mutex> lock(mutex);
+    pending_slot = s;
+  }
+  changed.notify_all();
+}
+
+void Checkpointer::run() {
+  while (true) {
+    int64_t s;
+    {
+      unique_lock<std::mutex> lock(mutex);
+      changed.wait(lock, [this] { return finish || pending_slot >= 0; });
+      if (pending_slot < 0) {
+        return;
+      }
+      s = pending_slot;
+    }
+    double start = omp_get_wtime();
+    msync(slot(s), slot_size, MS_SYNC);
+    msync(header, page_size(), MS_SYNC);
+    {
+      lock_guard<std::mutex> lock(mutex);
+      header->active_slot = s;
+    }
+    msync(header, page_size(), MS_SYNC);
+    {
+      lock_guard<std::mutex> lock(mutex);
+      sync_time += omp_get_wtime() - start;
+      ++checkpoints;
+      pending_slot = -1;
+    }
+    changed.notify_all();
+  }
+}
+
+void Checkpointer::close() {
+  if (header != nullptr) {
+    {
+      lock_guard<std::mutex> lock(mutex);
+      finish = true;
+    }
+    changed.notify_all();
+    thread.join();
+    munmap(header, mapping_size);
+    header = nullptr;
+  }
+}
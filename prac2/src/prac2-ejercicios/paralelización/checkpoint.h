@@ -0,0 +1,84 @@
+#ifndef _checkpoint_h_
+#define _checkpoint_h_
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "matrix.h"
+
+/*
+ * Fichero de puntos de control: una página de cabecera seguida de dos
+ * copias («slots») del estado, cada una con «height» filas de
+ * «width_aligned» elementos. Se escribe siempre en el slot que no
+ * contiene el último punto de control completo y sólo cuando está en
+ * disco se cambia «active_slot», así que una interrupción en cualquier
+ * momento deja un punto de control válido.
+ */
+struct CheckpointHeader {
+  char magic[4];          // "HCKP"
+  uint32_t version;
+  uint64_t height;
+  uint64_t width;
+  uint64_t width_aligned;
+  int64_t active_slot;    // -1: todavía no hay ninguno
+  int64_t iteration[2];   // iteraciones hechas al guardar cada slot
+  double difference[2];   // «last_difference» de la última de ellas
+};
+
+const uint32_t checkpoint_version = 1;
+
+bool load_checkpoint(const std::string& file_name, std::unique_ptr<Matrix<double>>& state, int& iterations, double& last_difference);
+
+/*
+ * Guarda puntos de control en un fichero proyectado en memoria.
+ *
+ * «save» copia el estado al slot libre (lo único que hace el hilo que
+ * resuelve) y deja a un hilo en segundo plano el msync que lo lleva a
+ * disco y el cambio de slot activo. Si al llamar a «save» el anterior
+ * todavía no ha terminado, espera. Los tiempos de copia, de sincronización
+ * y de espera se acumulan por separado.
+ */
+class Checkpointer {
+public:
+  Checkpointer(const std::string& file_name, size_t height, size_t width, size_t width_aligned);
+  ~Checkpointer();
+
+  bool ok() const { return header != nullptr; }
+  void save(const Matrix<double>& state, int iterations, double last_difference);
+  // Espera a que termine el último punto de control y cierra el fichero
+  void close();
+
+  size_t checkpoints = 0;
+  double copy_time = 0;
+  double sync_time = 0;
+  double wait_time = 0;
+
+private:
+  void run();
+  double* slot(int64_t s) const;
+
+  CheckpointHeader* header = nullptr;
+  size_t slot_size;
+  size_t mapping_size;
+  int64_t pending_slot = -1;
+  bool finish = false;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::thread thread;
+};
+
+// Puntos de control que toma «solve» (los crea main.cpp)
+extern Checkpointer* checkpointer;
+extern size_t checkpoint_every;
+
+inline void take_checkpoint(const Matrix<double>& state, int iterations, double last_difference) {
+  if (checkpointer != nullptr && checkpoint_every > 0 && iterations % checkpoint_every == 0) {
+    checkpointer->save(state, iterations, last_difference);
+  }
+}
+
+#endif
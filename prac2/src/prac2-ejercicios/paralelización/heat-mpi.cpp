@@ -0,0 +1,308 @@
+#include <mpi.h>
+
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include "util.h"
+#include "matrix.h"
+
+using namespace std;
+
+/*
+ * Versión MPI de «solve»: la superficie se reparte en bloques entre
+ * los procesos de una malla 2D de «proc_rows» × «proc_cols». Cada
+ * proceso guarda su bloque con una fila/columna fantasma alrededor,
+ * que en cada iteración recibe de sus vecinos (o que contiene el borde
+ * fijo de la superficie si no tiene vecino por ese lado).
+ *
+ * El intercambio de fantasmas se solapa con el cálculo del interior
+ * del bloque, que no los necesita, y la suma global del cambio de cada
+ * iteración se hace con un MPI_Iallreduce que se solapa con el
+ * interior de la iteración siguiente: si resulta que ya se cumplía el
+ * criterio, esa iteración (escrita en la otra matriz) se descarta.
+ */
+
+struct Domain {
+  MPI_Comm comm;
+  int rank;
+  int dims[2];
+  int coords[2];
+  int up, down, left, right;
+  size_t rows, cols;             // tamaño de la superficie completa
+  size_t first_row, first_col;   // primera fila/columna del bloque en la superficie
+  size_t local_rows, local_cols; // tamaño del bloque sin fantasmas
+};
+
+// Reparte los «n» elementos interiores (sin los bordes 0 y n + 1) en «parts» trozos
+static void block_range(size_t n, int parts, int index, size_t& first, size_t& count) {
+  count = n / parts + (size_t(index) < n % parts);
+  first = 1 + index * (n / parts) + min(size_t(index), n % parts);
+}
+
+static void block_of(const Domain& d, const int coords[2], size_t& first_row, size_t& local_rows, size_t& first_col, size_t& local_cols) {
+  block_range(d.rows - 2, d.dims[0], coords[0], first_row, local_rows);
+  block_range(d.cols - 2, d.dims[1], coords[1], first_col, local_cols);
+}
+
+// Mismos valores iniciales que «init_problem» en main.cpp
+static double initial_value(const Domain& d, size_t i, size_t j, double temp_top, double temp_bottom, double temp_left, double temp_right, double temp_center) {
+  if (i == 0) {
+    return temp_top;
+  } else if (i == d.rows - 1) {
+    return temp_bottom;
+  } else if (j == 0) {
+    return temp_left;
+  } else if (j == d.cols - 1) {
+    return temp_right;
+  }
+  return temp_center;
+}
+
+static void init_block(const Domain& d, Matrix<double>& p, double temp_top, double temp_bottom, double temp_left, double temp_right, double temp_center) {
+  for (size_t i = 0; i < p.height; ++i) {
+    for (size_t j = 0; j < p.width; ++j) {
+      p[i][j] = initial_value(d, d.first_row - 1 + i, d.first_col - 1 + j, temp_top, temp_bottom, temp_left, temp_right, temp_center);
+    }
+  }
+}
+
+// Actualiza las filas [i0, i1) y columnas [j0, j1) del bloque y devuelve la suma de los cambios
+static double update(const Matrix<double>& state, Matrix<double>& next_state, size_t i0, size_t i1, size_t j0, size_t j1) {
+  double difference = 0;
+#pragma omp parallel for reduction (+:difference) if (i1 - i0 > 16)
+  for (size_t i = i0; i < i1; ++i) {
+    for (size_t j = j0; j < j1; ++j) {
+      next_state[i][j] = (state[i][j]
+                          + state[i + 1][j    ]
+                          + state[i - 1][j    ]
+                          + state[i    ][j + 1]
+                          + state[i    ][j - 1]) / 5;
+      difference = difference + abs(next_state[i][j] - state[i][j]);
+    }
+  }
+  return difference;
+}
+
+// Empieza a enviar los bordes del bloque a los vecinos y a recibir sus bordes en los fantasmas
+static void start_halo_exchange(const Domain& d, Matrix<double>& state, MPI_Datatype column, MPI_Request requests[8]) {
+  const int h = d.local_rows, w = d.local_cols;
+  MPI_Irecv(&state[0][1],     w, MPI_DOUBLE, d.up,    0, d.comm, &requests[0]);
+  MPI_Irecv(&state[h + 1][1], w, MPI_DOUBLE, d.down,  1, d.comm, &requests[1]);
+  MPI_Irecv(&state[1][0],     1, column,     d.left,  2, d.comm, &requests[2]);
+  MPI_Irecv(&state[1][w + 1], 1, column,     d.right, 3, d.comm, &requests[3]);
+  MPI_Isend(&state[1][1],     w, MPI_DOUBLE, d.up,    1, d.comm, &requests[4]);
+  MPI_Isend(&state[h][1],     w, MPI_DOUBLE, d.down,  0, d.comm, &requests[5]);
+  MPI_Isend(&state[1][1],     1, column,     d.left,  3, d.comm, &requests[6]);
+  MPI_Isend(&state[1][w],     1, column,     d.right, 2, d.comm, &requests[7]);
+}
+
+void solve_mpi(const Domain& d, Matrix<double>& state, double tolerance, int& iterations, double& last_difference) {
+  const size_t h = d.local_rows, w = d.local_cols;
+  const double size = d.rows * d.cols;
+  Matrix<double> next_state = state;
+  MPI_Datatype column;
+  MPI_Type_vector(h, 1, state.width_aligned, MPI_DOUBLE, &column);
+  MPI_Type_commit(&column);
+
+  MPI_Request halo[8];
+  MPI_Request reduction = MPI_REQUEST_NULL;
+  double local_difference = 0;
+  double difference = 0;
+  iterations = 0;
+  while (true) {
+    start_halo_exchange(d, state, column, halo);
+    double interior = update(state, next_state, 2, h > 2 ? h : 2, 2, w > 2 ? w : 2);
+    if (reduction != MPI_REQUEST_NULL) {
+      // Cambio total de la iteración anterior: si cumple el criterio, «state» ya es el resultado
+      MPI_Wait(&reduction, MPI_STATUS_IGNORE);
+      if (difference / size <= tolerance) {
+        MPI_Waitall(8, halo, MPI_STATUSES_IGNORE);
+        break;
+      }
+    }
+    MPI_Waitall(8, halo, MPI_STATUSES_IGNORE);
+    local_difference = interior + update(state, next_state, 1, 2, 1, w + 1);
+    if (h > 1) {
+      local_difference += update(state, next_state, h, h + 1, 1, w + 1);
+    }
+    if (h > 2) {
+      local_difference += update(state, next_state, 2, h, 1, 2);
+      if (w > 1) {
+        local_difference += update(state, next_state, 2, h, w, w + 1);
+      }
+    }
+    MPI_Iallreduce(&local_difference, &difference, 1, MPI_DOUBLE, MPI_SUM, d.comm, &reduction);
+    state.swap_data(next_state);
+    ++iterations;
+  }
+  last_difference = difference / size;
+  MPI_Type_free(&column);
+}
+
+// Reúne los bloques de todos los procesos en «result» (sólo en el proceso 0)
+static void gather_result(const Domain& d, const Matrix<double>& state, Matrix<double>& result) {
+  vector<double> buffer;
+  if (d.rank != 0) {
+    buffer.reserve(d.local_rows * d.local_cols);
+    for (size_t i = 1; i <= d.local_rows; ++i) {
+      buffer.insert(buffer.end(), &state[i][1], &state[i][d.local_cols + 1]);
+    }
+    MPI_Send(buffer.data(), buffer.size(), MPI_DOUBLE, 0, 0, d.comm);
+    return;
+  }
+  int size;
+  MPI_Comm_size(d.comm, &size);
+  for (int r = 0; r < size; ++r) {
+    int coords[2];
+    MPI_Cart_coords(d.comm, r, 2, coords);
+    size_t first_row, local_rows, first_col, local_cols;
+    block_of(d, coords, first_row, local_rows, first_col, local_cols);
+    if (r == 0) {
+      for (size_t i = 0; i < local_rows; ++i) {
+        copy(&state[i + 1][1], &state[i + 1][local_cols + 1], &result[first_row + i][first_col]);
+      }
+      continue;
+    }
+    buffer.resize(local_rows * local_cols);
+    MPI_Recv(buffer.data(), buffer.size(), MPI_DOUBLE, r, 0, d.comm, MPI_STATUS_IGNORE);
+    for (size_t i = 0; i < local_rows; ++i) {
+      copy(&buffer[i * local_cols], &buffer[(i + 1) * local_cols], &result[first_row + i][first_col]);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  MPI_Init(&argc, &argv);
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  size_t rows = 10;
+  size_t cols = 10;
+  double tolerance = 0.0005;
+  bool print_result = true;
+  bool print_iterations = true;
+  bool print_difference = true;
+  bool print_each_time = true;
+  size_t repeat_times = 1;
+  size_t warmup_times = 0;
+  bool print_average_time = true;
+  double temp_top = 70;
+  double temp_bottom = 10;
+  double temp_left = 90;
+  double temp_right = 20;
+  double temp_center = 0;
+  size_t proc_rows = 0; // 0: lo elige MPI_Dims_create
+  size_t proc_cols = 0;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!parse_size_arg(argv[i], "rows", rows)
+        && !parse_size_arg(argv[i], "cols", cols)
+        && !parse_bool_arg(argv[i], "print-result", print_result)
+        && !parse_bool_arg(argv[i], "print-iterations", print_iterations)
+        && !parse_bool_arg(argv[i], "print-difference", print_difference)
+        && !parse_double_arg(argv[i], "tolerance", tolerance)
+        && !parse_bool_arg(argv[i], "print-each-time", print_each_time)
+        && !parse_size_arg(argv[i], "repeat-times", repeat_times)
+        && !parse_size_arg(argv[i], "warmup-times", warmup_times)
+        && !parse_bool_arg(argv[i], "print-average-time", print_average_time)
+        && !parse_double_arg(argv[i], "temp-top", temp_top)
+        && !parse_double_arg(argv[i], "temp-bottom", temp_bottom)
+        && !parse_double_arg(argv[i], "temp-left", temp_left)
+        && !parse_double_arg(argv[i], "temp-right", temp_right)
+        && !parse_double_arg(argv[i], "temp-center", temp_center)
+        && !parse_size_arg(argv[i], "proc-rows", proc_rows)
+        && !parse_size_arg(argv[i], "proc-cols", proc_cols)) {
+      if (rank == 0) {
+        cerr << "Argumento incorrecto: " << argv[i] << endl;
+      }
+      MPI_Finalize();
+      return 1;
+    }
+  }
+
+  Domain d;
+  d.rows = rows;
+  d.cols = cols;
+  d.dims[0] = proc_rows;
+  d.dims[1] = proc_cols;
+  if ((proc_rows > 0 && size % proc_rows != 0) || (proc_cols > 0 && size % proc_cols != 0)
+      || (proc_rows > 0 && proc_cols > 0 && proc_rows * proc_cols != size_t(size))
+      || MPI_Dims_create(size, 2, d.dims) != MPI_SUCCESS) {
+    if (rank == 0) {
+      cerr << "No se pueden repartir " << size << " procesos en " << proc_rows << " × " << proc_cols << endl;
+    }
+    MPI_Finalize();
+    return 1;
+  }
+  if (rows < 2 + size_t(d.dims[0]) || cols < 2 + size_t(d.dims[1])) {
+    if (rank == 0) {
+      cerr << "Demasiados procesos (" << d.dims[0] << " × " << d.dims[1] << ") para una superficie de " << rows << " × " << cols << endl;
+    }
+    MPI_Finalize();
+    return 1;
+  }
+  int periods[2] = {0, 0};
+  MPI_Cart_create(MPI_COMM_WORLD, 2, d.dims, periods, 1, &d.comm);
+  MPI_Comm_rank(d.comm, &d.rank);
+  MPI_Cart_coords(d.comm, d.rank, 2, d.coords);
+  MPI_Cart_shift(d.comm, 0, 1, &d.up, &d.down);
+  MPI_Cart_shift(d.comm, 1, 1, &d.left, &d.right);
+  block_of(d, d.coords, d.first_row, d.local_rows, d.first_col, d.local_cols);
+
+  vector<double> times;
+  for (size_t i = 0; i < repeat_times; ++i) {
+    Matrix<double> state(d.local_rows + 2, d.local_cols + 2);
+    init_block(d, state, temp_top, temp_bottom, temp_left, temp_right, temp_center);
+    int iterations;
+    double difference;
+    MPI_Barrier(d.comm);
+    double start_time = MPI_Wtime();
+    solve_mpi(d, state, tolerance, iterations, difference);
+    double local_time = MPI_Wtime() - start_time;
+    double elapsed_time;
+    MPI_Reduce(&local_time, &elapsed_time, 1, MPI_DOUBLE, MPI_MAX, 0, d.comm);
+    if (i == 0 && print_result) {
+      Matrix<double> result(d.rank == 0 ? rows : 1, d.rank == 0 ? cols : 1);
+      if (d.rank == 0) {
+        Domain whole = d;
+        whole.first_row = whole.first_col = 1;
+        init_block(whole, result, temp_top, temp_bottom, temp_left, temp_right, temp_center);
+      }
+      gather_result(d, state, result);
+      if (d.rank == 0) {
+        cout << "Result:" << endl;
+        printf_matrix("%7.3f", result);
+        cout << endl;
+      }
+    }
+    if (d.rank != 0) {
+      continue;
+    }
+    if (i == 0) {
+      if (print_difference) {
+        cout << "Difference: " << setprecision(5) << difference << endl;
+      }
+      if (print_iterations) {
+        cout << "Iterations: " << iterations << endl;
+        cout << "Processes: " << d.dims[0] << " × " << d.dims[1] << endl;
+      }
+    }
+    if (i >= warmup_times) {
+      times.push_back(elapsed_time);
+    }
+    if (print_each_time) {
+      cout << "Time (s) (run " << i + 1 << "/" << repeat_times << "): " << fixed << setw(7) << setprecision(2) << elapsed_time << (i < warmup_times ? "  (warmup)" : "") << defaultfloat << endl;
+    }
+  }
+  if (d.rank == 0 && print_average_time) {
+    double average_time = vector_average(times);
+    double stddev_time = vector_stddev(times);
+    cout << "Average time (s): " << fixed << setw(7) << setprecision(2) << average_time << "±" << stddev_time << endl;
+  }
+
+  MPI_Comm_free(&d.comm);
+  MPI_Finalize();
+  return 0;
+}
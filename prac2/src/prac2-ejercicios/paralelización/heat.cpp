@@ -1,5 +1,8 @@
 #include "heat.h"
+#include "snapshot.h"
+#include "checkpoint.h"
 
+#include <cmath>
 #include <iostream>
 
 using namespace std;
@@ -17,10 +20,13 @@ extern bool verbose;
  * Devuelve el estado final en «state», el número de iteraciones
  * empleado en «iterations» y el mayor cambio de un elemento durante
  * la última itereción en «last_difference».
+ *
+ * Si «state» viene de un punto de control, «first_iteration» es el
+ * número de iteraciones que ya se habían hecho.
  */
-void solve(Matrix<double>& state, double tolerance, int& iterations, double& last_difference) {
+void solve(Matrix<double>& state, double tolerance, int& iterations, double& last_difference, int first_iteration) {
   Matrix<double> next_state = state;
-  iterations = 0;
+  iterations = first_iteration;
   double difference;
 // #pragma omp parallel
 // {
@@ -50,11 +56,157 @@ void solve(Matrix<double>& state, double tolerance, int& iterations, double& las
       printf_matrix("%7.3f", state);
       cout << "Difference: " << difference << endl;
     }
+    take_snapshot(state, iterations);
 // #pragma omp atomic
     ++iterations;
+    take_checkpoint(state, iterations, difference / (state.height * state.width));
 // }
   } while (difference / (state.height * state.width) > tolerance);
   last_difference = difference / (state.height * state.width);
 // }
 }
 
+/*
+ * Igual que «solve», pero sin crear hilos: pensado para resolver
+ * muchos problemas pequeños a la vez, uno por hilo.
+ */
+void solve_sequential(Matrix<double>& state, double tolerance, int& iterations, double& last_difference) {
+  Matrix<double> next_state = state;
+  iterations = 0;
+  double difference;
+  do {
+    difference = 0;
+    for (size_t i = 1; i < state.height - 1; ++i) {
+      for (size_t j = 1; j < state.width - 1; ++j) {
+        next_state[i][j] = (state[i][j]
+                            + state[i + 1][j    ]
+                            + state[i - 1][j    ]
+                            + state[i    ][j + 1]
+                            + state[i    ][j - 1]) / 5;
+        difference = difference + abs(next_state[i][j] - state[i][j]);
+      }
+    }
+    state.swap_data(next_state);
+    ++iterations;
+  } while (difference / (state.height * state.width) > tolerance);
+  last_difference = difference / (state.height * state.width);
+}
+
+/*
+ * Calcula en «next_state» una iteración de Jacobi a partir de
+ * «state». Si «with_difference» es cierto devuelve además la suma de
+ * los cambios absolutos de todos los elementos; si no, devuelve 0 y
+ * se ahorra la reducción.
+ */
+template<bool with_difference>
+static double sweep(const Matrix<double>& state, Matrix<double>& next_state) {
+  double difference = 0;
+#pragma omp parallel for reduction (+:difference)
+  for (size_t i = 1; i < state.height - 1; ++i) {
+    for (size_t j = 1; j < state.width - 1; ++j) {
+      next_state[i][j] = (state[i][j]
+                          + state[i + 1][j    ]
+                          + state[i - 1][j    ]
+                          + state[i    ][j + 1]
+                          + state[i    ][j - 1]) / 5;
+      if constexpr (with_difference) {
+        difference = difference + abs(next_state[i][j] - state[i][j]);
+      }
+    }
+  }
+  return difference;
+}
+
+/*
+ * Como «solve», pero sólo calcula la diferencia entre iteraciones
+ * cada cierto número de ellas, que se ajusta dinámicamente.
+ *
+ * La suma de los cambios absolutos no crece de una iteración a la
+ * siguiente (la matriz de Jacobi tiene columnas que suman como mucho
+ * 1), así que si el criterio se cumple al final de un bloque de
+ * iteraciones sin comprobar, se cumplió por primera vez dentro de ese
+ * bloque. En ese caso se vuelve al último estado guardado, se avanza
+ * sin comprobar hasta el inicio del bloque y se repite comprobando
+ * cada iteración, de modo que «iterations», «last_difference» y el
+ * estado final son idénticos a los de «solve».
+ *
+ * La longitud del siguiente bloque se estima suponiendo que la
+ * diferencia decrece geométricamente entre las dos últimas
+ * comprobaciones: se avanza la mitad de las iteraciones que faltarían
+ * según esa estimación, sin superar «max_check_interval». El estado
+ * sólo se guarda al inicio de un bloque si el criterio podría
+ * cumplirse dentro de él aunque la diferencia decreciese el doble de
+ * rápido de lo estimado; lejos de la convergencia los bloques están
+ * limitados por «max_check_interval» y se ahorra la copia. Con
+ * instantáneas, los bloques terminan en las iteraciones que se guardan,
+ * así que cada una se toma tras comprobarla y ninguna se repite.
+ */
+void solve_lazy(Matrix<double>& state, double tolerance, size_t max_check_interval, int& iterations, double& last_difference) {
+  Matrix<double> next_state = state;
+  Matrix<double> saved_state = state;
+  const double size = state.height * state.width;
+  const double target = tolerance * size;
+  iterations = 0;
+  size_t interval = 1;
+  bool save = false;
+  int saved_iteration = 0;
+  int previous_check = 0;
+  double previous_difference = 0;
+  double difference;
+  while (true) {
+    if (verbose) {
+      interval = 1;
+    }
+    if (snapshot_writer != nullptr && snapshot_every > 0) {
+      interval = min(interval, (snapshot_every - iterations % snapshot_every) % snapshot_every + 1);
+    }
+    if (interval > 1) {
+      if (save) {
+        std::copy(&state.data[0], &state.data[state.height * state.width_aligned], saved_state.data);
+        saved_iteration = iterations;
+      }
+      for (size_t k = 1; k < interval; ++k) {
+        sweep<false>(state, next_state);
+        state.swap_data(next_state);
+      }
+    }
+    difference = sweep<true>(state, next_state);
+    state.swap_data(next_state);
+    iterations += interval;
+
+    if (difference / size <= tolerance && interval > 1) {
+      // El criterio se cumplió en algún punto del bloque: se repite
+      // desde el último estado guardado, que se conserva por si hay
+      // que volver a él
+      iterations -= interval;
+      std::copy(&saved_state.data[0], &saved_state.data[state.height * state.width_aligned], state.data);
+      for (int k = saved_iteration; k < iterations; ++k) {
+        sweep<false>(state, next_state);
+        state.swap_data(next_state);
+      }
+      interval = 1;
+      continue;
+    }
+
+    if (verbose) {
+      cout << "Iteration " << iterations - 1 << ":" << endl;
+      printf_matrix("%7.3f", state);
+      cout << "Difference: " << difference << endl;
+    }
+    take_snapshot(state, iterations - 1);
+    if (difference / size <= tolerance) {
+      break;
+    }
+
+    interval = 1;
+    if (previous_check > 0 && difference < previous_difference) {
+      double rate = log(difference / previous_difference) / (iterations - previous_check);
+      double remaining = log(target / difference) / rate;
+      interval = clamp(size_t(remaining / 2), size_t(1), max(max_check_interval, size_t(1)));
+      save = 2 * interval >= remaining;
+    }
+    previous_check = iterations;
+    previous_difference = difference;
+  }
+  last_difference = difference / size;
+}
@@ -2,7 +2,15 @@
 #define _heat_h_
 
 #include "matrix.h"
+#include "matrix3d.h"
 
-void solve(Matrix<double>& state, double tolerance, int& iterations, double& last_difference);
+void solve(Matrix<double>& state, double tolerance, int& iterations, double& last_difference, int first_iteration = 0);
+void solve_sequential(Matrix<double>& state, double tolerance, int& iterations, double& last_difference);
+void solve_lazy(Matrix<double>& state, double tolerance, size_t max_check_interval, int& iterations, double& last_difference);
+void solve_active(Matrix<double>& state, double tolerance, size_t tile_size, double threshold, int& iterations, double& last_difference, double& skipped_fraction);
+void solve_mixed(Matrix<double>& state, double tolerance, double switch_factor, int& iterations, double& last_difference, int& float_iterations);
+void solve_material(Matrix<double>& state, const Matrix<double>& update, const Matrix<double>& east, const Matrix<double>& south,
+                    double tolerance, int& iterations, double& last_difference);
+void solve_3d(Matrix3D<double>& state, double tolerance, size_t block_size, int& iterations, double& last_difference);
 
 #endif
@@ -0,0 +1,71 @@
+#include "heat.h"
+
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+extern bool verbose;
+
+/*
+ * Simula la propagación de calor en un volumen representado por
+ * «state» con un estencil de 7 puntos, hasta que el cambio medio por
+ * elemento entre dos iteraciones es menor que «tolerance».
+ *
+ * El interior se recorre en bloques de «block_size» planos ×
+ * «block_size» filas completas, de forma que los planos vecinos que
+ * usa cada bloque sigan en caché mientras se procesa. Los bloques se
+ * reparten entre los hilos.
+ *
+ * Devuelve lo mismo que «solve».
+ */
+void solve_3d(Matrix3D<double>& state, double tolerance, size_t block_size, int& iterations, double& last_difference) {
+  Matrix3D<double> next_state = state;
+  const size_t blocks_z = (state.depth - 2 + block_size - 1) / block_size;
+  const size_t blocks_y = (state.height - 2 + block_size - 1) / block_size;
+  const double size = state.depth * state.height * state.width;
+  iterations = 0;
+  double difference;
+  do {
+    difference = 0;
+#pragma omp parallel for collapse(2) reduction (+:difference)
+    for (size_t bz = 0; bz < blocks_z; ++bz) {
+      for (size_t by = 0; by < blocks_y; ++by) {
+        const size_t k_begin = 1 + bz * block_size;
+        const size_t k_end = min(k_begin + block_size, state.depth - 1);
+        const size_t i_begin = 1 + by * block_size;
+        const size_t i_end = min(i_begin + block_size, state.height - 1);
+        for (size_t k = k_begin; k < k_end; ++k) {
+          for (size_t i = i_begin; i < i_end; ++i) {
+            const double* front = state(k - 1, i);
+            const double* back = state(k + 1, i);
+            const double* above = state(k, i - 1);
+            const double* below = state(k, i + 1);
+            const double* row = state(k, i);
+            double* next_row = next_state(k, i);
+            for (size_t j = 1; j < state.width - 1; ++j) {
+              next_row[j] = (row[j]
+                             + below[j    ]
+                             + above[j    ]
+                             + row[j + 1]
+                             + row[j - 1]
+                             + front[j]
+                             + back[j]) / 7;
+              difference = difference + abs(next_row[j] - row[j]);
+            }
+          }
+        }
+      }
+    }
+
+    state.swap_data(next_state);
+
+    if (verbose) {
+      cout << "Iteration " << iterations << ":" << endl;
+      printf_matrix("%7.3f", state);
+      cout << "Difference: " << difference << endl;
+    }
+    ++iterations;
+  } while (difference / size > tolerance);
+  last_difference = difference / size;
+}
@@ -0,0 +1,118 @@
+#include "heat.h"
+#include "snapshot.h"
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+extern bool verbose;
+
+/*
+ * Simula la propagación de calor como «solve», pero dividiendo el
+ * interior de la superficie en bloques de «tile_size» × «tile_size»
+ * elementos y dejando de actualizar los bloques que ya no cambian.
+ *
+ * Tras cada iteración se guarda el cambio medio por elemento de cada
+ * bloque. Un bloque se actualiza en la siguiente iteración sólo si su
+ * cambio o el de alguno de sus ocho vecinos es al menos
+ * «threshold»; si no, se considera convergido y no aporta nada a la
+ * diferencia. Un bloque inactivo se despierta en cuanto un vecino
+ * vuelve a superar el umbral.
+ *
+ * Al desactivar un bloque se copia su contenido a la otra matriz para
+ * que ambas coincidan y el intercambio de punteros siga siendo válido.
+ *
+ * Devuelve además en «skipped_fraction» la fracción de
+ * actualizaciones de elementos que se han evitado, 0 si la placa no
+ * tiene elementos interiores.
+ */
+void solve_active(Matrix<double>& state, double tolerance, size_t tile_size, double threshold, int& iterations, double& last_difference, double& skipped_fraction) {
+  Matrix<double> next_state = state;
+  const size_t inner_height = state.height - 2;
+  const size_t inner_width = state.width - 2;
+  const size_t tiles_y = (inner_height + tile_size - 1) / tile_size;
+  const size_t tiles_x = (inner_width + tile_size - 1) / tile_size;
+  const size_t tiles = tiles_y * tiles_x;
+  vector<double> change(tiles, 0);
+  vector<char> active(tiles, 1);
+  vector<char> next_active(tiles);
+  size_t updated = 0;
+  iterations = 0;
+  double difference;
+  do {
+    difference = 0;
+#pragma omp parallel for collapse(2) reduction (+:difference,updated)
+    for (size_t ty = 0; ty < tiles_y; ++ty) {
+      for (size_t tx = 0; tx < tiles_x; ++tx) {
+        const size_t t = ty * tiles_x + tx;
+        if (!active[t]) {
+          change[t] = 0;
+          continue;
+        }
+        const size_t i_begin = 1 + ty * tile_size;
+        const size_t i_end = min(i_begin + tile_size, state.height - 1);
+        const size_t j_begin = 1 + tx * tile_size;
+        const size_t j_end = min(j_begin + tile_size, state.width - 1);
+        double tile_difference = 0;
+        for (size_t i = i_begin; i < i_end; ++i) {
+          const double* above = state[i - 1];
+          const double* row = state[i];
+          const double* below = state[i + 1];
+          double* next_row = next_state[i];
+          for (size_t j = j_begin; j < j_end; ++j) {
+            next_row[j] = (row[j]
+                           + below[j    ]
+                           + above[j    ]
+                           + row[j + 1]
+                           + row[j - 1]) / 5;
+            tile_difference = tile_difference + abs(next_row[j] - row[j]);
+          }
+        }
+        const size_t cells = (i_end - i_begin) * (j_end - j_begin);
+        change[t] = tile_difference / cells;
+        difference = difference + tile_difference;
+        updated = updated + cells;
+      }
+    }
+
+    state.swap_data(next_state);
+
+#pragma omp parallel for collapse(2)
+    for (size_t ty = 0; ty < tiles_y; ++ty) {
+      for (size_t tx = 0; tx < tiles_x; ++tx) {
+        const size_t t = ty * tiles_x + tx;
+        bool wake = false;
+        for (size_t ny = (ty > 0 ? ty - 1 : 0); ny <= min(ty + 1, tiles_y - 1); ++ny) {
+          for (size_t nx = (tx > 0 ? tx - 1 : 0); nx <= min(tx + 1, tiles_x - 1); ++nx) {
+            wake = wake || change[ny * tiles_x + nx] >= threshold;
+          }
+        }
+        if (active[t] && !wake) {
+          const size_t i_begin = 1 + ty * tile_size;
+          const size_t i_end = min(i_begin + tile_size, state.height - 1);
+          const size_t j_begin = 1 + tx * tile_size;
+          const size_t j_end = min(j_begin + tile_size, state.width - 1);
+          for (size_t i = i_begin; i < i_end; ++i) {
+            copy(&state[i][j_begin], &state[i][j_end], &next_state[i][j_begin]);
+          }
+        }
+        next_active[t] = wake;
+      }
+    }
+    active.swap(next_active);
+
+    if (verbose) {
+      cout << "Iteration " << iterations << ":" << endl;
+      printf_matrix("%7.3f", state);
+      cout << "Difference: " << difference << endl;
+    }
+    take_snapshot(state, iterations);
+    ++iterations;
+  } while (difference / (state.height * state.width) > tolerance);
+  last_difference = difference / (state.height * state.width);
+  // Sin elementos interiores (2 filas o 2 columnas) no hay actualizaciones que evitar
+  const double updates = double(inner_height * inner_width) * iterations;
+  skipped_fraction = updates > 0 ? 1 - double(updated) / updates : 0;
+}
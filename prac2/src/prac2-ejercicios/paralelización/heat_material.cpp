@@ -0,0 +1,69 @@
+#include "heat.h"
+#include "snapshot.h"
+
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+extern bool verbose;
+
+/*
+ * Como «solve», pero con una superficie no uniforme: el calor que
+ * recibe cada elemento por cada cara es proporcional a la diferencia de
+ * temperatura con el vecino y a la conductividad de la cara («east» y
+ * «south», ver «material_conductances»):
+ *
+ *   next = state + update × Σ k_cara × (vecino − state) / 5
+ *
+ * Con conductividad 1 en todas las caras es el mismo paso que «solve»
+ * (la media de la plantilla de cinco puntos) y en el punto fijo cada
+ * elemento es la media de sus vecinos ponderada por las caras,
+ * Σ k_cara × vecino / Σ k_cara, así que la conductividad cambia la
+ * solución y no sólo lo que se tarda en llegar a ella. Por una cara de
+ * conductividad 0 no pasa calor (aislante) y los elementos con
+ * «update» 0 no cambian (elementos fijos). En vez de comprobar la
+ * máscara en cada elemento se mezclan siempre los dos valores, así que
+ * el bucle interior no tiene saltos y se vectoriza igual que el de
+ * «solve». Las matrices de la superficie tienen las mismas dimensiones
+ * y alineamiento que «state» y se recorren a la par.
+ */
+void solve_material(Matrix<double>& state, const Matrix<double>& update, const Matrix<double>& east, const Matrix<double>& south,
+                    double tolerance, int& iterations, double& last_difference) {
+  Matrix<double> next_state = state;
+  iterations = 0;
+  double difference;
+  do {
+    difference = 0;
+#pragma omp parallel for reduction (+:difference)
+    for (size_t i = 1; i < state.height - 1; ++i) {
+      const double* above = state[i - 1];
+      const double* row = state[i];
+      const double* below = state[i + 1];
+      const double* row_update = update[i];
+      const double* row_east = east[i];
+      const double* row_north = south[i - 1];
+      const double* row_south = south[i];
+      double* next_row = next_state[i];
+      for (size_t j = 1; j < state.width - 1; ++j) {
+        double flow = row_east[j    ] * (row[j + 1] - row[j])
+                    + row_east[j - 1] * (row[j - 1] - row[j])
+                    + row_south[j] * (below[j] - row[j])
+                    + row_north[j] * (above[j] - row[j]);
+        next_row[j] = row[j] + row_update[j] * flow / 5;
+        difference = difference + abs(next_row[j] - row[j]);
+      }
+    }
+
+    state.swap_data(next_state);
+
+    if (verbose) {
+      cout << "Iteration " << iterations << ":" << endl;
+      printf_matrix("%7.3f", state);
+      cout << "Difference: " << difference << endl;
+    }
+    take_snapshot(state, iterations);
+    ++iterations;
+  } while (difference / (state.height * state.width) > tolerance);
+  last_difference = difference / (state.height * state.width);
+}
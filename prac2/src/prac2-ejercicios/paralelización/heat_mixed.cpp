@@ -0,0 +1,106 @@
+#include "heat.h"
+#include "snapshot.h"
+
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+extern bool verbose;
+
+/*
+ * Una iteración de Jacobi de «state» a «next_state» con elementos de
+ * tipo T. Devuelve la suma de los cambios absolutos, acumulada en
+ * double por filas para no perder precisión con T = float.
+ */
+template<typename T>
+static double sweep(const Matrix<T>& state, Matrix<T>& next_state) {
+  double difference = 0;
+#pragma omp parallel for reduction (+:difference)
+  for (size_t i = 1; i < state.height - 1; ++i) {
+    const T* above = state[i - 1];
+    const T* row = state[i];
+    const T* below = state[i + 1];
+    T* next_row = next_state[i];
+    double row_difference = 0;
+    for (size_t j = 1; j < state.width - 1; ++j) {
+      next_row[j] = (row[j]
+                     + below[j    ]
+                     + above[j    ]
+                     + row[j + 1]
+                     + row[j - 1]) / 5;
+      row_difference = row_difference + abs(next_row[j] - row[j]);
+    }
+    difference = difference + row_difference;
+  }
+  return difference;
+}
+
+template<typename T, typename S>
+static void convert(const Matrix<S>& from, Matrix<T>& to) {
+#pragma omp parallel for
+  for (size_t i = 0; i < from.height; ++i) {
+    for (size_t j = 0; j < from.width; ++j) {
+      to[i][j] = from[i][j];
+    }
+  }
+}
+
+/*
+ * Como «solve», pero iterando en float (la mitad de bytes por
+ * elemento) mientras el cambio medio es mayor que «switch_factor» ×
+ * «tolerance», y terminando en double hasta cumplir el mismo criterio
+ * que «solve».
+ *
+ * «switch_factor» debe ser al menos 1. Si el cambio en float deja de
+ * bajar antes (llega a un punto fijo de float, con cambio 0 o no), se
+ * cambia también a double, y en double se hace siempre al menos una
+ * iteración: el criterio de parada es el de «solve» con el cambio de
+ * una iteración en double.
+ *
+ * Devuelve además en «float_iterations» cuántas de las iteraciones se
+ * hicieron en float.
+ */
+void solve_mixed(Matrix<double>& state, double tolerance, double switch_factor, int& iterations, double& last_difference, int& float_iterations) {
+  const double size = state.height * state.width;
+  iterations = 0;
+  double difference = 0;
+  {
+    Matrix<float> float_state(state.height, state.width);
+    convert(state, float_state);
+    Matrix<float> next_float_state = float_state;
+    double previous_difference = 0;
+    do {
+      previous_difference = difference;
+      difference = sweep(float_state, next_float_state);
+      float_state.swap_data(next_float_state);
+      if (verbose) {
+        cout << "Iteration " << iterations << " (float):" << endl;
+        printf_matrix("%7.3f", float_state);
+        cout << "Difference: " << difference << endl;
+      }
+      if (snapshot_writer != nullptr && snapshot_every > 0 && iterations % snapshot_every == 0) {
+        // Las instantáneas son de double: se pasa por «state», que no se usa en esta fase
+        convert(float_state, state);
+        take_snapshot(state, iterations);
+      }
+      ++iterations;
+    } while (difference / size > switch_factor * tolerance && (iterations == 1 || difference < previous_difference));
+    convert(float_state, state);
+  }
+  float_iterations = iterations;
+
+  Matrix<double> next_state = state;
+  do {
+    difference = sweep(state, next_state);
+    state.swap_data(next_state);
+    if (verbose) {
+      cout << "Iteration " << iterations << ":" << endl;
+      printf_matrix("%7.3f", state);
+      cout << "Difference: " << difference << endl;
+    }
+    take_snapshot(state, iterations);
+    ++iterations;
+  } while (difference / size > tolerance);
+  last_difference = difference / size;
+}
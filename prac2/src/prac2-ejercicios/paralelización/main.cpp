@@ -1,5 +1,8 @@
 #include <cstdlib>
 #include <cstring>
+#include <string>
+#include <fstream>
+#include <sstream>
 #include <iostream>
 #include <iomanip>
 #include <vector>
@@ -8,6 +11,9 @@
 #include "util.h"
 
 #include "heat.h"
+#include "snapshot.h"
+#include "checkpoint.h"
+#include "material.h"
 
 using namespace std;
 
@@ -27,11 +33,132 @@ void init_problem(Matrix<double>& p, double temp_top, double temp_bottom, double
   }
 }
 
+void init_problem_3d(Matrix3D<double>& p, double temp_top, double temp_bottom, double temp_left, double temp_right, double temp_front, double temp_back, double temp_center) {
+  for (size_t k = 0; k < p.depth; ++k) {
+    for (size_t i = 0; i < p.height; ++i) {
+      for (size_t j = 0; j < p.width; ++j) {
+        p(k, i)[j] = temp_center;
+      }
+      p(k, i)[0] = temp_left;
+      p(k, i)[p.width - 1] = temp_right;
+    }
+    for (size_t j = 0; j < p.width; ++j) {
+      p(k, 0)[j] = temp_top;
+      p(k, p.height - 1)[j] = temp_bottom;
+    }
+  }
+  for (size_t i = 0; i < p.height; ++i) {
+    for (size_t j = 0; j < p.width; ++j) {
+      p(0, i)[j] = temp_front;
+      p(p.depth - 1, i)[j] = temp_back;
+    }
+  }
+}
+
+/*
+ * Escribe el resultado de un problema, 2D o 3D: la matriz final, la
+ * última diferencia y las iteraciones, según las opciones --print-*.
+ */
+template<typename M>
+void print_solution(const M& state, double difference, int iterations, bool print_result, bool print_difference, bool print_iterations) {
+  if (print_result) {
+    cout << "Result:" << endl;
+    printf_matrix("%7.3f", state);
+    cout << endl;
+  }
+  if (print_difference) {
+    cout << "Difference: " << setprecision(5) << difference << endl;
+  }
+  if (print_iterations) {
+    cout << "Iterations: " << iterations << endl;
+  }
+}
+
+struct HeatProblem {
+  size_t rows;
+  size_t cols;
+  double tolerance;
+  double temp_top;
+  double temp_bottom;
+  double temp_left;
+  double temp_right;
+  double temp_center;
+};
+
+/*
+ * Lee un conjunto de problemas de «file_name»: una línea por problema
+ * con argumentos como los de la línea de órdenes (--rows, --cols,
+ * --tolerance y --temp-*). Los que no aparecen en una línea toman el
+ * valor de «defaults». Se ignoran las líneas vacías y lo que sigue a
+ * «#».
+ */
+bool read_ensemble(const string& file_name, const HeatProblem& defaults, vector<HeatProblem>& problems) {
+  ifstream in(file_name);
+  if (!in.good()) {
+    cerr << "No se puede abrir el fichero de problemas: " << file_name << endl;
+    return false;
+  }
+  string line;
+  while (getline(in, line)) {
+    istringstream words(line.substr(0, line.find('#')));
+    HeatProblem p = defaults;
+    bool empty = true;
+    string word;
+    while (words >> word) {
+      empty = false;
+      if (!parse_size_arg(word.c_str(), "rows", p.rows)
+          && !parse_size_arg(word.c_str(), "cols", p.cols)
+          && !parse_double_arg(word.c_str(), "tolerance", p.tolerance)
+          && !parse_double_arg(word.c_str(), "temp-top", p.temp_top)
+          && !parse_double_arg(word.c_str(), "temp-bottom", p.temp_bottom)
+          && !parse_double_arg(word.c_str(), "temp-left", p.temp_left)
+          && !parse_double_arg(word.c_str(), "temp-right", p.temp_right)
+          && !parse_double_arg(word.c_str(), "temp-center", p.temp_center)) {
+        cerr << "Argumento incorrecto en " << file_name << ": " << word << endl;
+        return false;
+      }
+    }
+    if (!empty) {
+      problems.push_back(p);
+    }
+  }
+  return true;
+}
+
+/*
+ * Resuelve todos los problemas de «problems» repartiéndolos entre los
+ * hilos (un problema por hilo cada vez) y escribe los resultados de
+ * cada uno según terminan, precedidos de su número.
+ */
+void solve_ensemble(const vector<HeatProblem>& problems, bool print_result, bool print_difference, bool print_iterations) {
+#pragma omp parallel for schedule(dynamic)
+  for (size_t n = 0; n < problems.size(); ++n) {
+    const HeatProblem& p = problems[n];
+    Matrix<double> state(p.rows, p.cols);
+    init_problem(state, p.temp_top, p.temp_bottom, p.temp_left, p.temp_right, p.temp_center);
+    int iterations;
+    double difference;
+    solve_sequential(state, p.tolerance, iterations, difference);
+    if (print_result || print_difference || print_iterations) {
+#pragma omp critical
+      {
+        cout << "Problem " << n << ":" << endl;
+        print_solution(state, difference, iterations, print_result, print_difference, print_iterations);
+      }
+    }
+  }
+}
+
 bool verbose = false;
+SnapshotWriter* snapshot_writer = nullptr;
+size_t snapshot_every = 0;
+Checkpointer* checkpointer = nullptr;
+size_t checkpoint_every = 0;
 
 int main(int argc, char** argv) {
   size_t rows = 10;
   size_t cols = 10;
+  size_t depth = 0; // 0: superficie 2D
   double tolerance = 0.0005;
   bool print_result = true;
   bool print_iterations = true;
@@ -44,11 +171,34 @@ int main(int argc, char** argv) {
   double temp_bottom = 10;
   double temp_left = 90;
   double temp_right = 20;
+  double temp_front = 50;
+  double temp_back = 30;
   double temp_center = 0;
+  string solver = "exact";
+  size_t check_interval = 64;
+  size_t tile_size = 32;
+  double active_threshold = 0.1; // relativo a «tolerance»
+  double mixed_switch = 2; // relativo a «tolerance»
+  bool compare_exact = false;
+  size_t block_size = 16;
+  string ensemble_file = "";
+  string snapshot_file = "";
+  bool snapshot_compress = false;
+  string checkpoint_file = "";
+  string restart_from = "";
+  string mask_file = "";
+  string conductivity_file = "";
+  double mask_temp = 0;
+  bool mask_temp_given = false; // si no, los elementos fijos empiezan a «temp_center»
   
   for (int i = 1; i < argc; ++i) {
+    if (parse_double_arg(argv[i], "mask-temp", mask_temp)) {
+      mask_temp_given = true;
+      continue;
+    }
     if (!parse_size_arg(argv[i], "rows", rows)
         && !parse_size_arg(argv[i], "cols", cols)
+        && !parse_size_arg(argv[i], "depth", depth)
         && !parse_bool_arg(argv[i], "verbose", verbose)
         && !parse_bool_arg(argv[i], "print-result", print_result)
         && !parse_bool_arg(argv[i], "print-iterations", print_iterations)
@@ -62,41 +212,260 @@ int main(int argc, char** argv) {
         && !parse_double_arg(argv[i], "temp-bottom", temp_bottom)
         && !parse_double_arg(argv[i], "temp-left", temp_left)
         && !parse_double_arg(argv[i], "temp-right", temp_right)
-        && !parse_double_arg(argv[i], "temp-center", temp_center)) {
+        && !parse_double_arg(argv[i], "temp-front", temp_front)
+        && !parse_double_arg(argv[i], "temp-back", temp_back)
+        && !parse_double_arg(argv[i], "temp-center", temp_center)
+        && !parse_size_arg(argv[i], "block-size", block_size)
+        && !parse_string_arg(argv[i], "ensemble-file", ensemble_file)
+        && !parse_string_arg(argv[i], "snapshot-file", snapshot_file)
+        && !parse_size_arg(argv[i], "snapshot-every", snapshot_every)
+        && !parse_bool_arg(argv[i], "snapshot-compress", snapshot_compress)
+        && !parse_string_arg(argv[i], "checkpoint-file", checkpoint_file)
+        && !parse_size_arg(argv[i], "checkpoint-every", checkpoint_every)
+        && !parse_string_arg(argv[i], "restart-from", restart_from)
+        && !parse_string_arg(argv[i], "mask-file", mask_file)
+        && !parse_string_arg(argv[i], "conductivity-file", conductivity_file)
+        && !parse_string_arg(argv[i], "solver", solver)
+        && !parse_size_arg(argv[i], "check-interval", check_interval)
+        && !parse_size_arg(argv[i], "tile-size", tile_size)
+        && !parse_double_arg(argv[i], "active-threshold", active_threshold)
+        && !parse_double_arg(argv[i], "mixed-switch", mixed_switch)
+        && !parse_bool_arg(argv[i], "compare-exact", compare_exact)) {
       cerr << "Argumento incorrecto: " << argv[i] << endl;
       return 1;
     }
   }
+  if (mask_file != "" || conductivity_file != "") {
+    if (solver != "exact" && solver != "material") {
+      cerr << "Las máscaras y conductividades sólo están disponibles con el solver material" << endl;
+      return 1;
+    }
+    solver = "material";
+  }
+  if (compare_exact && solver == "material") {
+    // «solve» resuelve la superficie uniforme, otro problema
+    cerr << "La comparación con el solver exact no está disponible con el solver material" << endl;
+    return 1;
+  }
+  if (solver != "exact" && solver != "lazy" && solver != "active" && solver != "mixed" && solver != "material") {
+    cerr << "Solver desconocido (debe ser exact, lazy, active, mixed o material): " << solver << endl;
+    return 1;
+  }
+  if (block_size == 0) {
+    cerr << "El valor de --block-size debe ser al menos 1" << endl;
+    return 1;
+  }
+  if (tile_size == 0) {
+    cerr << "El valor de --tile-size debe ser al menos 1" << endl;
+    return 1;
+  }
+  if (mixed_switch < 1) {
+    cerr << "El valor de --mixed-switch debe ser al menos 1: " << mixed_switch << endl;
+    return 1;
+  }
+    
+  if (ensemble_file != "") {
+    // Cada problema se resuelve con solve_sequential en 2D
+    if (solver != "exact" || depth > 0) {
+      cerr << "Los conjuntos de problemas sólo están disponibles con el solver exact en 2D" << endl;
+      return 1;
+    }
+    if (snapshot_file != "" || checkpoint_file != "" || restart_from != "" || compare_exact) {
+      cerr << "Los conjuntos de problemas no admiten instantáneas, puntos de control ni --compare-exact" << endl;
+      return 1;
+    }
+    vector<HeatProblem> problems;
+    if (!read_ensemble(ensemble_file, {rows, cols, tolerance, temp_top, temp_bottom, temp_left, temp_right, temp_center}, problems)) {
+      return 1;
+    }
+    vector<double> times;
+    for (size_t i = 0; i < repeat_times; ++i) {
+      double elapsed_time = measure_time(solve_ensemble, problems, i == 0 && print_result, i == 0 && print_difference, i == 0 && print_iterations);
+      if (i >= warmup_times) {
+        times.push_back(elapsed_time);
+      }
+      if (print_each_time) {
+        cout << "Time (s) (run " << i + 1 << "/" << repeat_times << "): " << fixed << setw(7) << setprecision(2) << elapsed_time << "  problems/s: " << setprecision(1) << problems.size() / elapsed_time << (i < warmup_times ? "  (warmup)" : "") << defaultfloat << endl;
+      }
+    }
+    if (print_average_time) {
+      double average_time = vector_average(times);
+      double stddev_time = vector_stddev(times);
+      cout << "Average time (s): " << fixed << setw(7) << setprecision(2) << average_time << "±" << stddev_time << endl;
+      cout << "Problems/s: " << setprecision(1) << problems.size() / average_time << endl;
+    }
+    return 0;
+  }
+
+  if (depth > 0 && solver != "exact") {
+    cerr << "El solver " << solver << " no admite problemas 3D" << endl;
+    return 1;
+  }
+  if (snapshot_file != "" && depth > 0) {
+    cerr << "Las instantáneas sólo están disponibles en 2D" << endl;
+    return 1;
+  }
+  if ((checkpoint_file != "" || restart_from != "") && (depth > 0 || solver != "exact")) {
+    cerr << "Los puntos de control sólo están disponibles con el solver exact en 2D" << endl;
+    return 1;
+  }
+  unique_ptr<Matrix<double>> restart_state;
+  int restart_iterations = 0;
+  double restart_difference = 0;
+  if (restart_from != "") {
+    if (!load_checkpoint(restart_from, restart_state, restart_iterations, restart_difference)) {
+      cerr << "No se puede leer el punto de control: " << restart_from << endl;
+      return 1;
+    }
+    rows = restart_state->height;
+    cols = restart_state->width;
+  }
+  unique_ptr<Matrix<double>> fixed_cells;
+  unique_ptr<Matrix<double>> update, conductance_east, conductance_south;
+  if (solver == "material") {
+    Matrix<double> coefficient(rows, cols);
+    fixed_cells = make_unique<Matrix<double>>(rows, cols);
+    update = make_unique<Matrix<double>>(rows, cols);
+    conductance_east = make_unique<Matrix<double>>(rows, cols);
+    conductance_south = make_unique<Matrix<double>>(rows, cols);
+    fill(&coefficient.data[0], &coefficient.data[rows * coefficient.width_aligned], 1.0);
+    fill(&fixed_cells->data[0], &fixed_cells->data[rows * fixed_cells->width_aligned], 0.0);
+    if ((mask_file != "" && !read_mask(mask_file, rows, cols, *fixed_cells))
+        || (conductivity_file != "" && !read_coefficients(conductivity_file, rows, cols, coefficient))) {
+      return 1;
+    }
+    material_conductances(coefficient, *fixed_cells, *update, *conductance_east, *conductance_south);
+  }
     
   vector<double> times;
   for (size_t i = 0; i < repeat_times; ++i) {
-    Matrix<double> state(rows, cols);
-    init_problem(state, temp_top, temp_bottom, temp_left, temp_right, temp_center);
-    if (i == 0 && verbose) {
-      cout << "Initial state:" << endl;
-      printf_matrix("%7.3f", state);
-    }
     int iterations;
     double difference;
-    double start_time = omp_get_wtime();
-    solve(state, tolerance, iterations, difference);
-    double end_time = omp_get_wtime();
-    double elapsed_time = end_time - start_time;
-    if (i < warmup_times) {
-      times.push_back(elapsed_time);
-    }
-    if (i == 0) {
-      if (print_result) {
-        cout << "Result:" << endl;
+    double elapsed_time;
+    if (depth > 0) {
+      Matrix3D<double> state(depth, rows, cols);
+      init_problem_3d(state, temp_top, temp_bottom, temp_left, temp_right, temp_front, temp_back, temp_center);
+      if (i == 0 && verbose) {
+        cout << "Initial state:" << endl;
         printf_matrix("%7.3f", state);
-        cout << endl;
       }
-      if (print_difference) {
-        cout << "Difference: " << setprecision(5) << difference << endl;
+      double start_time = omp_get_wtime();
+      solve_3d(state, tolerance, block_size, iterations, difference);
+      elapsed_time = omp_get_wtime() - start_time;
+      if (i == 0) {
+        print_solution(state, difference, iterations, print_result, print_difference, print_iterations);
       }
-      if (print_iterations) {
-        cout << "Iterations: " << iterations << endl;
+    } else {
+      Matrix<double> state(rows, cols);
+      if (restart_state) {
+        copy(&restart_state->data[0], &restart_state->data[rows * state.width_aligned], state.data);
+      } else {
+        init_problem(state, temp_top, temp_bottom, temp_left, temp_right, temp_center);
       }
+      if (fixed_cells && mask_temp_given) {
+        for (size_t r = 1; r < rows - 1; ++r) {
+          for (size_t c = 1; c < cols - 1; ++c) {
+            if ((*fixed_cells)[r][c] != 0) {
+              state[r][c] = mask_temp;
+            }
+          }
+        }
+      }
+      if (i == 0 && verbose) {
+        cout << "Initial state:" << endl;
+        printf_matrix("%7.3f", state);
+      }
+      double skipped_fraction = 0;
+      int float_iterations = 0;
+      unique_ptr<SnapshotWriter> writer;
+      if (i == 0 && snapshot_file != "") {
+        writer = make_unique<SnapshotWriter>(snapshot_file, snapshot_compress);
+        if (!writer->ok()) {
+          cerr << "No se puede crear el fichero de instantáneas: " << snapshot_file << endl;
+          return 1;
+        }
+        snapshot_writer = writer.get();
+      }
+      unique_ptr<Checkpointer> checkpoints;
+      if (i == 0 && checkpoint_file != "") {
+        checkpoints = make_unique<Checkpointer>(checkpoint_file, rows, cols, state.width_aligned);
+        if (!checkpoints->ok()) {
+          cerr << "No se puede crear el fichero de puntos de control: " << checkpoint_file << endl;
+          return 1;
+        }
+        checkpointer = checkpoints.get();
+      }
+      bool solved = true; // si no, el resultado es el del punto de control
+      double start_time = omp_get_wtime();
+      if (solver == "lazy") {
+        solve_lazy(state, tolerance, check_interval, iterations, difference);
+      } else if (solver == "active") {
+        solve_active(state, tolerance, tile_size, active_threshold * tolerance, iterations, difference, skipped_fraction);
+      } else if (solver == "mixed") {
+        solve_mixed(state, tolerance, mixed_switch, iterations, difference, float_iterations);
+      } else if (solver == "material") {
+        solve_material(state, *update, *conductance_east, *conductance_south, tolerance, iterations, difference);
+      } else if (restart_state && restart_difference <= tolerance) {
+        // El punto de control ya cumplía el criterio
+        iterations = restart_iterations;
+        difference = restart_difference;
+        solved = false;
+      } else {
+        solve(state, tolerance, iterations, difference, restart_iterations);
+      }
+      double end_time = omp_get_wtime();
+      elapsed_time = end_time - start_time;
+      if (writer) {
+        // La última iteración puede haberse guardado ya entre las periódicas
+        if (!solved || snapshot_every == 0 || (iterations - 1) % snapshot_every != 0) {
+          writer->write(state, iterations - 1);
+        }
+        snapshot_writer = nullptr;
+        if (!writer->close()) {
+          cerr << "Error al escribir el fichero de instantáneas: " << snapshot_file << endl;
+          return 1;
+        }
+      }
+      if (checkpoints) {
+        checkpoints->close();
+        checkpointer = nullptr;
+      }
+      if (i == 0) {
+        print_solution(state, difference, iterations, print_result, print_difference, print_iterations);
+        if (print_iterations) {
+          if (solver == "active") {
+            cout << "Skipped updates: " << fixed << setprecision(2) << 100 * skipped_fraction << "%" << defaultfloat << endl;
+          }
+          if (solver == "mixed") {
+            cout << "Float iterations: " << float_iterations << endl;
+          }
+          if (checkpoints) {
+            cout << "Checkpoints: " << checkpoints->checkpoints << ", copy time (s): " << fixed << setprecision(3) << checkpoints->copy_time << ", background sync time (s): " << checkpoints->sync_time << ", waiting time (s): " << checkpoints->wait_time << defaultfloat << endl;
+          }
+          if (writer) {
+            cout << "Snapshots: " << writer->snapshots << " (" << writer->bytes << " bytes), solver waiting time (s): " << fixed << setprecision(3) << writer->wait_time << defaultfloat << endl;
+          }
+        }
+        if (compare_exact && solver != "exact") {
+          Matrix<double> exact_state(rows, cols);
+          init_problem(exact_state, temp_top, temp_bottom, temp_left, temp_right, temp_center);
+          int exact_iterations;
+          double exact_difference;
+          double exact_time = measure_time([&] { solve(exact_state, tolerance, exact_iterations, exact_difference); });
+          double max_deviation = 0;
+          for (size_t r = 0; r < rows; ++r) {
+            for (size_t c = 0; c < cols; ++c) {
+              max_deviation = max(max_deviation, abs(state[r][c] - exact_state[r][c]));
+            }
+          }
+          cout << "Exact iterations: " << exact_iterations << endl;
+          cout << "Exact time (s): " << fixed << setprecision(2) << exact_time << defaultfloat << endl;
+          cout << "Max deviation from exact: " << setprecision(5) << max_deviation << endl;
+        }
+      }
+    }
+    if (i >= warmup_times) {
+      times.push_back(elapsed_time);
     }
     if (print_each_time) {
       cout << "Time (s) (run " << i + 1 << "/" << repeat_times << "): " << fixed << setw(7) << setprecision(2) << elapsed_time << (i < warmup_times ? "  (warmup)" : "") << endl;
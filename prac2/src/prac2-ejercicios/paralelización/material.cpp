@@ -0,0 +1,141 @@
+#include "material.h"
+
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+// Lee un número de la cabecera de un fichero Netpbm, saltando espacios y comentarios
+static bool read_header_number(istream& in, size_t& value) {
+  while (true) {
+    int c = in.peek();
+    if (c == '#') {
+      string comment;
+      getline(in, comment);
+    } else if (isspace(c)) {
+      in.get();
+    } else {
+      break;
+    }
+  }
+  return bool(in >> value);
+}
+
+/*
+ * Lee una imagen Netpbm de tipo «ascii_magic» (P1/P2) o «binary_magic»
+ * (P4/P5) y devuelve sus valores por filas en «values» junto con el
+ * máximo posible en «maxval» (1 para PBM).
+ */
+static bool read_netpbm(const string& file_name, const char* ascii_magic, const char* binary_magic, size_t height, size_t width, vector<unsigned>& values, size_t& maxval) {
+  ifstream in(file_name, ios::binary);
+  if (!in.good()) {
+    cerr << "No se puede abrir el fichero: " << file_name << endl;
+    return false;
+  }
+  string magic;
+  in >> magic;
+  const bool bitmap = ascii_magic[1] == '1';
+  if (magic != ascii_magic && magic != binary_magic) {
+    cerr << file_name << ": debe ser " << (bitmap ? "PBM" : "PGM") << " (" << ascii_magic << " o " << binary_magic << ")" << endl;
+    return false;
+  }
+  size_t file_width, file_height;
+  maxval = 1;
+  if (!read_header_number(in, file_width) || !read_header_number(in, file_height)
+      || (!bitmap && (!read_header_number(in, maxval) || maxval == 0 || maxval > 65535))) {
+    cerr << file_name << ": cabecera incorrecta" << endl;
+    return false;
+  }
+  if (file_width != width || file_height != height) {
+    cerr << file_name << ": la imagen es de " << file_height << " × " << file_width << " y la superficie de " << height << " × " << width << endl;
+    return false;
+  }
+  values.resize(height * width);
+  if (magic == ascii_magic) {
+    for (auto& v : values) {
+      if (bitmap) {
+        // En P1 los dígitos pueden ir sin separar
+        char c;
+        if (!(in >> c) || (c != '0' && c != '1')) {
+          in.setstate(ios::failbit);
+          break;
+        }
+        v = c - '0';
+      } else if (!(in >> v) || v > maxval) {
+        in.setstate(ios::failbit);
+        break;
+      }
+    }
+  } else {
+    in.get(); // un único espacio separa la cabecera de los datos
+    if (bitmap) {
+      vector<unsigned char> row((width + 7) / 8);
+      for (size_t i = 0; i < height && in.read(reinterpret_cast<char*>(row.data()), row.size()); ++i) {
+        for (size_t j = 0; j < width; ++j) {
+          values[i * width + j] = (row[j / 8] >> (7 - j % 8)) & 1;
+        }
+      }
+    } else {
+      const size_t bytes = maxval < 256 ? 1 : 2;
+      vector<unsigned char> data(height * width * bytes);
+      if (in.read(reinterpret_cast<char*>(data.data()), data.size())) {
+        for (size_t k = 0; k < values.size(); ++k) {
+          values[k] = bytes == 1 ? data[k] : data[2 * k] << 8 | data[2 * k + 1];
+          if (values[k] > maxval) {
+            in.setstate(ios::failbit);
+          }
+        }
+      }
+    }
+  }
+  if (!in) {
+    cerr << file_name << ": faltan datos o hay valores incorrectos" << endl;
+    return false;
+  }
+  return true;
+}
+
+bool read_mask(const string& file_name, size_t height, size_t width, Matrix<double>& fixed) {
+  vector<unsigned> values;
+  size_t maxval;
+  if (!read_netpbm(file_name, "P1", "P4", height, width, values, maxval)) {
+    return false;
+  }
+  for (size_t i = 0; i < height; ++i) {
+    for (size_t j = 0; j < width; ++j) {
+      fixed[i][j] = values[i * width + j];
+    }
+  }
+  return true;
+}
+
+bool read_coefficients(const string& file_name, size_t height, size_t width, Matrix<double>& coefficient) {
+  vector<unsigned> values;
+  size_t maxval;
+  if (!read_netpbm(file_name, "P2", "P5", height, width, values, maxval)) {
+    return false;
+  }
+  for (size_t i = 0; i < height; ++i) {
+    for (size_t j = 0; j < width; ++j) {
+      coefficient[i][j] = double(values[i * width + j]) / maxval;
+    }
+  }
+  return true;
+}
+
+// Media armónica de las conductividades de dos elementos vecinos
+static double face_conductance(double a, double b) {
+  return a + b > 0 ? 2 * a * b / (a + b) : 0;
+}
+
+void material_conductances(const Matrix<double>& coefficient, const Matrix<double>& fixed, Matrix<double>& update, Matrix<double>& east, Matrix<double>& south) {
+  for (size_t i = 0; i < update.height; ++i) {
+    for (size_t j = 0; j < update.width; ++j) {
+      update[i][j] = 1 - fixed[i][j];
+      east[i][j] = j + 1 < update.width ? face_conductance(coefficient[i][j], coefficient[i][j + 1]) : 0;
+      south[i][j] = i + 1 < update.height ? face_conductance(coefficient[i][j], coefficient[i + 1][j]) : 0;
+    }
+  }
+}
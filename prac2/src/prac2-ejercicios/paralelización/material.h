@@ -0,0 +1,36 @@
+#ifndef _material_h_
+#define _material_h_
+
+#include <string>
+
+#include "matrix.h"
+
+/*
+ * Propiedades de cada elemento de la superficie para «solve_material»,
+ * leídas de imágenes Netpbm del mismo tamaño que la superficie
+ * (anchura = columnas, altura = filas), en texto o en binario:
+ *
+ *  - máscara de elementos fijos: PBM (P1 o P4), con 1 (negro) en los
+ *    elementos que no cambian (agujeros o fuentes de calor).
+ *  - coeficiente de conductividad: PGM (P2 o P5), con el coeficiente
+ *    de cada elemento como gris / maxval, entre 0 (aislante) y 1 (la
+ *    superficie uniforme de «solve»).
+ *
+ * Los bordes de la superficie son siempre fijos, diga lo que diga la
+ * máscara.
+ */
+bool read_mask(const std::string& file_name, size_t height, size_t width, Matrix<double>& fixed);
+bool read_coefficients(const std::string& file_name, size_t height, size_t width, Matrix<double>& coefficient);
+
+/*
+ * Prepara los datos que usa el kernel a partir del coeficiente y la
+ * máscara:
+ *
+ *  - «update»: 1 − fijo, así que un elemento fijo no cambia.
+ *  - «east» y «south»: la conductividad de la cara entre cada elemento
+ *    y el de su derecha y el de debajo, la media armónica de las de los
+ *    dos, que es 0 si cualquiera de ellos es aislante.
+ */
+void material_conductances(const Matrix<double>& coefficient, const Matrix<double>& fixed, Matrix<double>& update, Matrix<double>& east, Matrix<double>& south);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef _matrix3d_h_
+#define _matrix3d_h_
+
+#include "matrix.h"
+
+template<typename T, size_t matrix_alignment = 64>
+struct Matrix3D {
+  size_t width;
+  size_t height;
+  size_t depth;
+  size_t width_aligned;
+  T *data;
+
+  Matrix3D(size_t d, size_t h, size_t w) : width(w), height(h), depth(d), width_aligned(round_up_aligned<T,matrix_alignment>(width)), data(static_cast<T*>(std::aligned_alloc(matrix_alignment, sizeof(T) * width_aligned * height * depth))) {
+    static_assert(matrix_alignment % sizeof(T) == 0);
+    assert(width_aligned % (matrix_alignment / sizeof(T)) == 0);
+    assert(width_aligned >= width);
+  }
+  Matrix3D(const Matrix3D& o) : width(o.width), height(o.height), depth(o.depth), width_aligned(round_up_aligned<T,matrix_alignment>(width)), data(static_cast<T*>(std::aligned_alloc(matrix_alignment, sizeof(T) * width_aligned * height * depth))) {
+    assert(o.width_aligned == width_aligned);
+    std::copy(&o.data[0], &o.data[depth * height * width_aligned], data);
+  }
+  Matrix3D& operator=(const Matrix3D&) = delete;
+
+  ~Matrix3D() { std::free(data); }
+
+  // Fila «row» del plano «plane»
+  inline const T* operator()(size_t plane, size_t row) const { return std::assume_aligned<matrix_alignment>(&data[(plane * height + row) * width_aligned]); }
+  inline T* operator()(size_t plane, size_t row) { return std::assume_aligned<matrix_alignment>(&data[(plane * height + row) * width_aligned]); }
+
+  void swap_data(Matrix3D<T>& o) {
+    assert(width == o.width);
+    assert(height == o.height);
+    assert(depth == o.depth);
+    assert(width_aligned == o.width_aligned);
+    T* t = o.data;
+    o.data = data;
+    data = t;
+  }
+};
+
+template<typename T, size_t a>
+void printf_matrix(const char* element_format, const Matrix3D<T,a>& m) {
+  for (size_t k = 0; k < m.depth; ++k) {
+    for (size_t i = 0; i < m.height; ++i) {
+      for (size_t j = 0; j < m.width; ++j) {
+        printf(element_format, m(k, i)[j]);
+        putchar(' ');
+      }
+      putchar('\n');
+    }
+    putchar('\n');
+  }
+}
+#endif
@@ -0,0 +1,67 @@
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "util.h"
+#include "snapshot.h"
+
+using namespace std;
+
+/*
+ * Convierte un fichero de instantáneas de heat a texto. Por defecto
+ * escribe la última instantánea igual que «--print-result» de heat,
+ * de forma que la salida se puede comparar con los .out de tests; con
+ * «--all» escribe todas, precedidas por su iteración como «--verbose».
+ */
+int main(int argc, char** argv) {
+  bool all = false;
+  string file_name = "";
+  for (int i = 1; i < argc; ++i) {
+    if (!parse_bool_arg(argv[i], "all", all)) {
+      if (argv[i][0] == '-' || file_name != "") {
+        cerr << "Argumento incorrecto: " << argv[i] << endl;
+        return 1;
+      }
+      file_name = argv[i];
+    }
+  }
+  if (file_name == "") {
+    cerr << "Uso: " << argv[0] << " [--all] fichero_de_instantáneas" << endl;
+    return 1;
+  }
+  FILE* in = fopen(file_name.c_str(), "rb");
+  if (in == nullptr) {
+    cerr << "No se puede abrir " << file_name << endl;
+    return 1;
+  }
+  unique_ptr<Matrix<double>> last;
+  SnapshotHeader header;
+  while (read_snapshot_header(in, header)) {
+    auto m = make_unique<Matrix<double>>(header.height, header.width);
+    if (!read_snapshot_data(in, header, *m)) {
+      cerr << "Instantánea incorrecta en " << file_name << endl;
+      return 1;
+    }
+    if (all) {
+      cout << "Iteration " << header.iteration << ":" << endl;
+      printf_matrix("%7.3f", *m);
+    }
+    last = std::move(m);
+  }
+  if (!feof(in) && fgetc(in) != EOF) {
+    cerr << "Cabecera incorrecta en " << file_name << endl;
+    return 1;
+  }
+  fclose(in);
+  if (!all) {
+    if (!last) {
+      cerr << "No hay instantáneas en " << file_name << endl;
+      return 1;
+    }
+    cout << "Result:" << endl;
+    printf_matrix("%7.3f", *last);
+    cout << endl;
+  }
+  return 0;
+}
@@ -0,0 +1,178 @@
+#include "snapshot.h"
+
+#include <cstring>
+#include <omp.h>
+
+using namespace std;
+
+/*
+ * Compresión sin pérdida pensada para campos suaves: cada elemento se
+ * combina con XOR con el de la fila anterior (la primera fila con 0),
+ * lo que deja a cero los bytes altos (signo, exponente y primeros
+ * bits de la mantisa) cuando los valores son parecidos. Por cada
+ * elemento se guarda un byte con el número de bytes significativos
+ * del XOR y después esos bytes, del menos al más significativo.
+ */
+void compress_rows(const double* data, size_t height, size_t width_aligned, vector<uint8_t>& out) {
+  out.clear();
+  out.reserve(height * width_aligned * (sizeof(double) + 1));
+  for (size_t i = 0; i < height; ++i) {
+    for (size_t j = 0; j < width_aligned; ++j) {
+      uint64_t bits, previous = 0;
+      memcpy(&bits, &data[i * width_aligned + j], sizeof(bits));
+      if (i > 0) {
+        memcpy(&previous, &data[(i - 1) * width_aligned + j], sizeof(previous));
+      }
+      uint64_t x = bits ^ previous;
+      uint8_t n = x == 0 ? 0 : 8 - __builtin_clzll(x) / 8;
+      out.push_back(n);
+      for (uint8_t b = 0; b < n; ++b) {
+        out.push_back(uint8_t(x >> (8 * b)));
+      }
+    }
+  }
+}
+
+bool decompress_rows(const uint8_t* in, size_t size, size_t height, size_t width_aligned, double* data) {
+  const uint8_t* end = in + size;
+  for (size_t i = 0; i < height; ++i) {
+    for (size_t j = 0; j < width_aligned; ++j) {
+      if (in == end || *in > 8 || end - in - 1 < *in) {
+        return false;
+      }
+      uint8_t n = *in++;
+      uint64_t x = 0;
+      for (uint8_t b = 0; b < n; ++b) {
+        x |= uint64_t(*in++) << (8 * b);
+      }
+      uint64_t previous = 0;
+      if (i > 0) {
+        memcpy(&previous, &data[(i - 1) * width_aligned + j], sizeof(previous));
+      }
+      uint64_t bits = x ^ previous;
+      memcpy(&data[i * width_aligned + j], &bits, sizeof(bits));
+    }
+  }
+  return in == end;
+}
+
+bool read_snapshot_header(FILE* in, SnapshotHeader& header) {
+  return fread(&header, sizeof(header), 1, in) == 1
+    && !memcmp(header.magic, "HEAT", 4)
+    && header.version == snapshot_version;
+}
+
+bool read_snapshot_data(FILE* in, const SnapshotHeader& header, Matrix<double>& m) {
+  if (m.height != header.height || m.width != header.width || m.width_aligned != header.width_aligned) {
+    return false;
+  }
+  if (!header.compressed) {
+    return header.payload_size == sizeof(double) * m.height * m.width_aligned
+      && fread(m.data, sizeof(double), m.height * m.width_aligned, in) == m.height * m.width_aligned;
+  }
+  vector<uint8_t> payload(header.payload_size);
+  return fread(payload.data(), 1, payload.size(), in) == payload.size()
+    && decompress_rows(payload.data(), payload.size(), m.height, m.width_aligned, m.data);
+}
+
+SnapshotWriter::SnapshotWriter(const string& file_name, bool compress) : out(fopen(file_name.c_str(), "wb")), compress(compress) {
+  free_buffers.push_back(&buffers[0]);
+  free_buffers.push_back(&buffers[1]);
+  if (out != nullptr) {
+    thread = std::thread(&SnapshotWriter::run, this);
+  }
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  close();
+}
+
+bool SnapshotWriter::close() {
+  if (out != nullptr) {
+    {
+      lock_guard<std::mutex> lock(mutex);
+      finish = true;
+    }
+    changed.notify_all();
+    thread.join();
+    failed = fclose(out) != 0 || failed;
+    out = nullptr;
+  }
+  return !failed;
+}
+
+void SnapshotWriter::write(const Matrix<double>& state, int iteration) {
+  if (out == nullptr) {
+    return;
+  }
+  Buffer* buffer;
+  {
+    unique_lock<std::mutex> lock(mutex);
+    if (free_buffers.empty()) {
+      double start = omp_get_wtime();
+      changed.wait(lock, [this] { return !free_buffers.empty(); });
+      wait_time += omp_get_wtime() - start;
+    }
+    buffer = free_buffers.front();
+    free_buffers.pop_front();
+  }
+  buffer->height = state.height;
+  buffer->width = state.width;
+  buffer->width_aligned = state.width_aligned;
+  buffer->iteration = iteration;
+  buffer->data.resize(state.height * state.width_aligned);
+  for (size_t i = 0; i < state.height; ++i) {
+    copy(&state[i][0], &state[i][state.width], &buffer->data[i * state.width_aligned]);
+    fill(&buffer->data[i * state.width_aligned + state.width], &buffer->data[(i + 1) * state.width_aligned], 0.0);
+  }
+  {
+    lock_guard<std::mutex> lock(mutex);
+    pending_buffers.push_back(buffer);
+  }
+  changed.notify_all();
+}
+
+void SnapshotWriter::run() {
+  vector<uint8_t> compressed;
+  while (true) {
+    Buffer* buffer;
+    {
+      unique_lock<std::mutex> lock(mutex);
+      changed.wait(lock, [this] { return finish || !pending_buffers.empty(); });
+      if (pending_buffers.empty()) {
+        return;
+      }
+      buffer = pending_buffers.front();
+      pending_buffers.pop_front();
+    }
+    SnapshotHeader header = {};
+    memcpy(header.magic, "HEAT", 4);
+    header.version = snapshot_version;
+    header.height = buffer->height;
+    header.width = buffer->width;
+    header.width_aligned = buffer->width_aligned;
+    header.iteration = buffer->iteration;
+    header.compressed = compress;
+    const void* payload = buffer->data.data();
+    header.payload_size = sizeof(double) * buffer->data.size();
+    if (compress) {
+      compress_rows(buffer->data.data(), buffer->height, buffer->width_aligned, compressed);
+      payload = compressed.data();
+      header.payload_size = compressed.size();
+    }
+    const bool written = !failed
+      && fwrite(&header, sizeof(header), 1, out) == 1
+      && fwrite(payload, 1, header.payload_size, out) == header.payload_size;
+    {
+      lock_guard<std::mutex> lock(mutex);
+      if (written) {
+        ++snapshots;
+        bytes += sizeof(header) + header.payload_size;
+      } else {
+        failed = true;
+      }
+      free_buffers.push_back(buffer);
+    }
+    changed.notify_all();
+  }
+}
@@ -0,0 +1,102 @@
+#ifndef _snapshot_h_
+#define _snapshot_h_
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "matrix.h"
+
+/*
+ * Formato binario de las instantáneas: un fichero es una secuencia de
+ * instantáneas, cada una con esta cabecera de 64 bytes seguida de
+ * «payload_size» bytes con las «height» filas de «width_aligned»
+ * elementos (el relleno a cero), tal cual están en memoria o
+ * comprimidas con «compress_rows».
+ */
+struct SnapshotHeader {
+  char magic[4];         // "HEAT"
+  uint32_t version;
+  uint64_t height;
+  uint64_t width;
+  uint64_t width_aligned;
+  int64_t iteration;
+  uint32_t compressed;
+  uint32_t reserved;
+  uint64_t payload_size;
+  uint64_t padding;
+};
+static_assert(sizeof(SnapshotHeader) == 64);
+
+const uint32_t snapshot_version = 1;
+
+void compress_rows(const double* data, size_t height, size_t width_aligned, std::vector<uint8_t>& out);
+bool decompress_rows(const uint8_t* in, size_t size, size_t height, size_t width_aligned, double* data);
+
+bool read_snapshot_header(FILE* in, SnapshotHeader& header);
+bool read_snapshot_data(FILE* in, const SnapshotHeader& header, Matrix<double>& m);
+
+/*
+ * Escribe instantáneas de una matriz en un fichero desde un hilo en
+ * segundo plano.
+ *
+ * «write» sólo copia la matriz a uno de los dos búferes y vuelve, así
+ * que el que resuelve el problema puede seguir mientras el hilo
+ * escritor comprime y guarda la copia anterior. Sólo espera si los
+ * dos búferes siguen pendientes de escribir; el tiempo total de
+ * espera se acumula en «wait_time».
+ */
+class SnapshotWriter {
+public:
+  SnapshotWriter(const std::string& file_name, bool compress);
+  ~SnapshotWriter();
+
+  bool ok() const { return out != nullptr; }
+  void write(const Matrix<double>& state, int iteration);
+  // Espera a que se escriban las instantáneas pendientes y cierra el
+  // fichero; devuelve false si alguna escritura ha fallado
+  bool close();
+
+  size_t snapshots = 0;
+  size_t bytes = 0;
+  double wait_time = 0;
+
+private:
+  struct Buffer {
+    std::vector<double> data;
+    size_t height;
+    size_t width;
+    size_t width_aligned;
+    int iteration;
+  };
+
+  void run();
+
+  FILE* out;
+  bool compress;
+  Buffer buffers[2];
+  std::deque<Buffer*> free_buffers;
+  std::deque<Buffer*> pending_buffers;
+  bool finish = false;
+  bool failed = false; // tras un error de escritura ya no se escribe nada más
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::thread thread;
+};
+
+// Instantáneas que toman los solvers durante la iteración (las crea main.cpp)
+extern SnapshotWriter* snapshot_writer;
+extern size_t snapshot_every;
+
+inline void take_snapshot(const Matrix<double>& state, int iteration) {
+  if (snapshot_writer != nullptr && snapshot_every > 0 && iteration % snapshot_every == 0) {
+    snapshot_writer->write(state, iteration);
+  }
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include <cmath>
+#include <memory>
 #include <omp.h>
 #include "util.h"
 
@@ -6,18 +7,76 @@
 
 using namespace std;
 
+Privatization privatization = Privatization::Auto;
+
+// A copy of the bins aligned and padded to whole cache lines, so that
+// copies used by different threads never share a line
+struct alignas(64) PaddedBins {
+  BinsType bins;
+};
+
 void BinParticles(const InputDataType& inputData, BinsType& outputBins) {
-  // Loop through all particle coordinates
-  for (int i = 0; i < inputData.numDataPoints; i++) { 
-    // Transforming from cylindrical to Cartesian coordinates:
-    const FTYPE x = inputData.particles[i].r*COS(inputData.particles[i].phi);
-    const FTYPE y = inputData.particles[i].r*SIN(inputData.particles[i].phi);
-
-    // Calculating the bin numbers for these coordinates:
-    const int iX = int((x - xMin)*binsPerUnitX);
-    const int iY = int((y - yMin)*binsPerUnitY);
-
-    // Incrementing the appropriate bin in the counter
-    ++outputBins[iX][iY];
+  const int nThreads = omp_get_max_threads();
+  const int maxCopies = max(size_t(1), maxPrivateBinsBytes / sizeof(PaddedBins));
+  Privatization mode = privatization;
+  if (mode == Privatization::Auto) {
+    mode = nThreads <= maxCopies ? Privatization::PerThread : Privatization::Sharded;
+  }
+  const int nCopies = mode == Privatization::PerThread ? nThreads : min(nThreads, maxCopies);
+  unique_ptr<PaddedBins[]> copies(new PaddedBins[nCopies]);
+
+#pragma omp parallel num_threads(nThreads)
+  {
+    const int t = omp_get_thread_num();
+    BinsType& bins = copies[t % nCopies].bins;
+    // Each copy is zeroed by the first thread that uses it (first touch).
+    // The team may have fewer than nThreads threads (OMP_DYNAMIC, a thread
+    // limit, nested parallelism), so its threads zero every copy between them
+    for (int c = t; c < nCopies; c += omp_get_num_threads()) {
+      for (int i = 0; i < nBinsX; i++) {
+        for (int j = 0; j < nBinsY; j++) {
+          copies[c].bins[i][j] = 0;
+        }
+      }
+    }
+#pragma omp barrier
+
+    // Loop through all particle coordinates
+    if (mode == Privatization::PerThread) {
+#pragma omp for schedule(static)
+      for (int i = 0; i < inputData.numDataPoints; i++) {
+        // Transforming from cylindrical to Cartesian coordinates:
+        const FTYPE x = inputData.particles[i].r*COS(inputData.particles[i].phi);
+        const FTYPE y = inputData.particles[i].r*SIN(inputData.particles[i].phi);
+
+        // Calculating the bin numbers for these coordinates:
+        const int iX = int((x - xMin)*binsPerUnitX);
+        const int iY = int((y - yMin)*binsPerUnitY);
+
+        // Incrementing the appropriate bin in the private counter
+        ++bins[iX][iY];
+      }
+    } else {
+#pragma omp for schedule(static)
+      for (int i = 0; i < inputData.numDataPoints; i++) {
+        const FTYPE x = inputData.particles[i].r*COS(inputData.particles[i].phi);
+        const FTYPE y = inputData.particles[i].r*SIN(inputData.particles[i].phi);
+        const int iX = int((x - xMin)*binsPerUnitX);
+        const int iY = int((y - yMin)*binsPerUnitY);
+#pragma omp atomic
+        ++bins[iX][iY];
+      }
+    }
+
+    // Parallel reduction: each thread adds up a range of bins over all copies
+    int* output = &outputBins[0][0];
+#pragma omp for schedule(static)
+    for (int b = 0; b < nBinsX * nBinsY; b++) {
+      int sum = 0;
+      for (int c = 0; c < nCopies; c++) {
+        sum += (&copies[c].bins[0][0])[b];
+      }
+      output[b] += sum;
+    }
   }
 }
@@ -1,6 +1,8 @@
 #ifndef _BINNING_H_
 #define _BINNING_H_
 
+#include <cstddef>
+
 #ifdef DOUBLE_PRECISION
 #define FTYPE double
 #define SIN sin
@@ -41,6 +43,17 @@ const FTYPE yMax = +maxMagnitudeR*1.000001;
 const FTYPE binsPerUnitX = (FTYPE)nBinsX/(xMax - xMin);
 const FTYPE binsPerUnitY = (FTYPE)nBinsY/(yMax - yMin);
 
+// How the threads of BinParticles combine their counts:
+//  - PerThread: each thread bins into its own private copy of BinsType,
+//    padded to whole cache lines, and the copies are added up at the end.
+//  - Sharded: threads share a few copies (shards), incremented with
+//    atomics; with a single shard this is a plain atomic histogram.
+//  - Auto: PerThread while all private copies fit in maxPrivateBinsBytes,
+//    Sharded with as many shards as fit otherwise.
+enum class Privatization { Auto, PerThread, Sharded };
+extern Privatization privatization;
+const size_t maxPrivateBinsBytes = 1 << 20;
+
 void BinParticles(const InputDataType& inputData, BinsType& outputBins);
 
 #endif
@@ -113,6 +113,44 @@ void reset_bins(BinsType& bins) {
   }
 }
 
+// Times BinParticles with each thread count of the comma-separated list
+// «threads_list» and prints the speedup over the first count and the
+// efficiency relative to it (1 if the time falls with the thread count)
+void report_scaling(const string& threads_list, const InputDataType& inputData, size_t repeat_times, size_t warmup_times) {
+  BinsType binnedData;
+  double base_time = 0;
+  int base_threads = 0;
+  size_t start = 0;
+  while (start < threads_list.size()) {
+    size_t end = threads_list.find(',', start);
+    if (end == string::npos) {
+      end = threads_list.size();
+    }
+    int nThreads = atoi(threads_list.substr(start, end - start).c_str());
+    start = end + 1;
+    if (nThreads <= 0) {
+      fprintf(stderr, "Incorrect thread count in --scaling-threads: %s\n", threads_list.c_str());
+      exit(1);
+    }
+    omp_set_num_threads(nThreads);
+    vector<double> times;
+    for (size_t i = 0; i < repeat_times; ++i) {
+      reset_bins(binnedData);
+      double elapsed_time = measure_time(BinParticles, inputData, binnedData);
+      if (i >= warmup_times) {
+        times.push_back(elapsed_time);
+      }
+    }
+    double average_time = vector_average(times);
+    if (base_time == 0) {
+      base_time = average_time;
+      base_threads = nThreads;
+    }
+    const double speedup = base_time / average_time;
+    printf("Threads %3d: %7.3f±%.3fs  GP/s: %5.4g  speedup: %5.2f  efficiency: %5.1f%%\n", nThreads, average_time, vector_stddev(times), double(inputData.numDataPoints) / average_time / 1000000000, speedup, 100 * speedup * base_threads / nThreads);
+  }
+}
+
 int main(const int argc, const char** argv) {
   string result_output_file = "";
   string result_check_file = "";
@@ -120,6 +158,8 @@ int main(const int argc, const char** argv) {
   size_t seed = 1;
   size_t repeat_times = 7; // total, including warmup
   size_t warmup_times = 2;
+  string privatization_name = "auto";
+  string scaling_threads = ""; // e.g. "1,2,4,8"
 
   for (int i = 1; i < argc; ++i) {
     if (!parse_size_arg(argv[i], "num-data-points", numDataPoints)
@@ -128,12 +168,25 @@ int main(const int argc, const char** argv) {
         && !parse_size_arg(argv[i], "seed", seed)
         && !parse_size_arg(argv[i], "repeat-times", repeat_times)
         && !parse_size_arg(argv[i], "warmup-times", warmup_times)
+        && !parse_string_arg(argv[i], "privatization", privatization_name)
+        && !parse_string_arg(argv[i], "scaling-threads", scaling_threads)
       ) {
       fprintf(stderr, "Incorrect argument: %s\n", argv[i]);
       return 1;
     }
   }
 
+  if (privatization_name == "auto") {
+    privatization = Privatization::Auto;
+  } else if (privatization_name == "per-thread") {
+    privatization = Privatization::PerThread;
+  } else if (privatization_name == "sharded") {
+    privatization = Privatization::Sharded;
+  } else {
+    fprintf(stderr, "Incorrect privatization (auto, per-thread or sharded): %s\n", privatization_name.c_str());
+    return 1;
+  }
+
   printf("Measuring time to bin %ld particles (%.3f GP) using %s\n", numDataPoints, double(numDataPoints) / 1000000000,
 #ifdef DOUBLE_PRECISION
          "double precision"
@@ -173,6 +226,10 @@ int main(const int argc, const char** argv) {
   double stddev_pps = vector_stddev_harmonic(pps);
   printf(ESC_BOLD "Average time (s): %7.2f±%.2f  GP/s: %5.4g±%.4g " ESC_RESET "   numDataPoints = %ld \n", average_time, stddev_time, average_pps / 1000000000, stddev_pps / 1000000000, numDataPoints);
 
+  if (scaling_threads != "") {
+    report_scaling(scaling_threads, inputData, repeat_times, warmup_times);
+  }
+
   free_input_data(inputData);
 
   return 0;
@@ -1,23 +1,127 @@
 #include <cmath>
+#include <memory>
+#include <vector>
 #include <omp.h>
 #include "util.h"
 
 #include "binning.h"
+#include "fast_sincos.h"
 
 using namespace std;
 
+Privatization privatization = Privatization::Auto;
+HistogramUpdate histogramUpdate = HistogramUpdate::Auto;
+
+// A copy of the bins aligned and padded to whole cache lines, so that
+// copies used by different threads never share a line
+struct alignas(64) PaddedBins {
+  BinsType bins;
+};
+
 void BinParticles(const InputDataType& inputData, BinsType& outputBins) {
-  // Loop through all particle coordinates
-  for (int i = 0; i < inputData.numDataPoints; i++) { 
-    // Transforming from cylindrical to Cartesian coordinates:
-    const FTYPE x = inputData.particles[i].r*COS(inputData.particles[i].phi);
-    const FTYPE y = inputData.particles[i].r*SIN(inputData.particles[i].phi);
-
-    // Calculating the bin numbers for these coordinates:
-    const int iX = int((x - xMin)*binsPerUnitX);
-    const int iY = int((y - yMin)*binsPerUnitY);
-
-    // Incrementing the appropriate bin in the counter
-    ++outputBins[iX][iY];
+  const int nThreads = omp_get_max_threads();
+  const int maxCopies = max(size_t(1), maxPrivateBinsBytes / sizeof(PaddedBins));
+  Privatization mode = privatization;
+  if (mode == Privatization::Auto) {
+    mode = nThreads <= maxCopies ? Privatization::PerThread : Privatization::Sharded;
+  }
+  const int nCopies = mode == Privatization::PerThread ? nThreads : min(nThreads, maxCopies);
+  unique_ptr<PaddedBins[]> copies(new PaddedBins[nCopies]);
+  const int nBins = nBinsX * nBinsY;
+  const bool useLanes = histogramUpdate == HistogramUpdate::Lanes
+    || (histogramUpdate == HistogramUpdate::Auto && sizeof(int) * nBins * histogramLanes <= maxLaneBinsBytes);
+
+#pragma omp parallel num_threads(nThreads)
+  {
+    const int t = omp_get_thread_num();
+    BinsType& bins = copies[t % nCopies].bins;
+    // Each copy is zeroed by the first thread that uses it (first touch).
+    // The team may have fewer than nThreads threads (OMP_DYNAMIC, a thread
+    // limit, nested parallelism), so its threads zero every copy between them
+    for (int c = t; c < nCopies; c += omp_get_num_threads()) {
+      for (int i = 0; i < nBinsX; i++) {
+        for (int j = 0; j < nBinsY; j++) {
+          copies[c].bins[i][j] = 0;
+        }
+      }
+    }
+#pragma omp barrier
+
+    // Loop through all particle coordinates in blocks: the bins of a whole
+    // block are computed first in a vectorised loop and then counted
+    int block_bins[binningBlockSize];
+    // Sub-histograms of the lanes, interleaved: bin b of lane l is laneBins[b*histogramLanes + l]
+    vector<int> laneBins(useLanes ? nBins * histogramLanes : 0, 0);
+#pragma omp for schedule(static)
+    for (int start = 0; start < inputData.numDataPoints; start += binningBlockSize) {
+      const int n = min(binningBlockSize, inputData.numDataPoints - start);
+      const Particle* particles = &inputData.particles[start];
+#pragma omp simd
+      for (int i = 0; i < n; i++) {
+        // Transforming from cylindrical to Cartesian coordinates:
+        FTYPE sinPhi, cosPhi;
+        fast_sincos(particles[i].phi, sinPhi, cosPhi);
+        const FTYPE x = particles[i].r*cosPhi;
+        const FTYPE y = particles[i].r*sinPhi;
+
+        // Calculating the bin numbers for these coordinates:
+        const int iX = int((x - xMin)*binsPerUnitX);
+        const int iY = int((y - yMin)*binsPerUnitY);
+        block_bins[i] = iX*nBinsY + iY;
+      }
+
+      // Incrementing the appropriate bins in the counter
+      int* counts = &bins[0][0];
+      if (useLanes) {
+        int* lanes = laneBins.data();
+        int i = 0;
+        for (; i + histogramLanes <= n; i += histogramLanes) {
+#pragma omp simd
+          for (int l = 0; l < histogramLanes; l++) {
+            ++lanes[block_bins[i + l]*histogramLanes + l];
+          }
+        }
+        for (; i < n; i++) {
+          ++lanes[block_bins[i]*histogramLanes + i % histogramLanes];
+        }
+      } else if (mode == Privatization::PerThread) {
+        for (int i = 0; i < n; i++) {
+          ++counts[block_bins[i]];
+        }
+      } else {
+        for (int i = 0; i < n; i++) {
+#pragma omp atomic
+          ++counts[block_bins[i]];
+        }
+      }
+    }
+
+    if (useLanes) {
+      int* counts = &bins[0][0];
+      for (int b = 0; b < nBins; b++) {
+        int sum = 0;
+        for (int l = 0; l < histogramLanes; l++) {
+          sum += laneBins[b*histogramLanes + l];
+        }
+        if (mode == Privatization::PerThread) {
+          counts[b] += sum;
+        } else {
+#pragma omp atomic
+          counts[b] += sum;
+        }
+      }
+#pragma omp barrier
+    }
+
+    // Parallel reduction: each thread adds up a range of bins over all copies
+    int* output = &outputBins[0][0];
+#pragma omp for schedule(static)
+    for (int b = 0; b < nBins; b++) {
+      int sum = 0;
+      for (int c = 0; c < nCopies; c++) {
+        sum += (&copies[c].bins[0][0])[b];
+      }
+      output[b] += sum;
+    }
   }
 }
@@ -1,6 +1,8 @@
 #ifndef _BINNING_H_
 #define _BINNING_H_
 
+#include <cstddef>
+
 #ifdef DOUBLE_PRECISION
 #define FTYPE double
 #define SIN sin
@@ -41,6 +43,32 @@ const FTYPE yMax = +maxMagnitudeR*1.000001;
 const FTYPE binsPerUnitX = (FTYPE)nBinsX/(xMax - xMin);
 const FTYPE binsPerUnitY = (FTYPE)nBinsY/(yMax - yMin);
 
+// How the threads of BinParticles combine their counts:
+//  - PerThread: each thread bins into its own private copy of BinsType,
+//    padded to whole cache lines, and the copies are added up at the end.
+//  - Sharded: threads share a few copies (shards), incremented with
+//    atomics; with a single shard this is a plain atomic histogram.
+//  - Auto: PerThread while all private copies fit in maxPrivateBinsBytes,
+//    Sharded with as many shards as fit otherwise.
+enum class Privatization { Auto, PerThread, Sharded };
+extern Privatization privatization;
+const size_t maxPrivateBinsBytes = 1 << 20;
+
+// Particles whose bins are computed together in one vectorised loop
+const int binningBlockSize = 1024;
+
+// How each thread counts the bins of a block:
+//  - Scalar: one increment per particle in its histogram.
+//  - Lanes: each of histogramLanes SIMD lanes counts in its own
+//    sub-histogram, so a vector of increments never conflicts (and can
+//    be a gather/scatter) and runs of particles in the same bin do not
+//    serialise on one counter; the sub-histograms are added up at the end.
+//  - Auto: Lanes while the sub-histograms fit in maxLaneBinsBytes.
+enum class HistogramUpdate { Auto, Scalar, Lanes };
+extern HistogramUpdate histogramUpdate;
+const int histogramLanes = 16;
+const size_t maxLaneBinsBytes = 64 << 10;
+
 void BinParticles(const InputDataType& inputData, BinsType& outputBins);
 
 #endif
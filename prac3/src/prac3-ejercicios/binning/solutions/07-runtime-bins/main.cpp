@@ -0,0 +1,304 @@
+#include <cassert>
+#include <random>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <omp.h>
+
+#include "util.h"
+#include "binning.h"
+
+using namespace std;
+
+// The particles are generated in the disc of the grid of «data», which
+// must be set before. With «skewed», 90% of the particles fall within
+// the first quadrant and 8% of the radius instead of uniformly in the disc
+void init_input_data(InputDataType& data, size_t seed, size_t numDataPoints, bool skewed = false) {
+  const FTYPE maxMagnitudeR = data.maxMagnitudeR;
+  data.numDataPoints = numDataPoints;
+  data.particles = (Particle*) aligned_alloc(64, sizeof(Particle) * numDataPoints);
+  mt19937 generator(seed); // 32 bit Mersenne Twister pseudo-random generator
+  uniform_real_distribution<FTYPE> distr(0.0, maxMagnitudeR);
+  uniform_real_distribution<FTYPE> distphi(0.0, 2.0*M_PI);
+  uniform_real_distribution<FTYPE> distskew(0.0, 1.0);
+  for (size_t i = 0; i < numDataPoints; ++i) {
+    data.particles[i].r = distr(generator);
+    data.particles[i].phi = distphi(generator);
+    if (skewed && distskew(generator) < FTYPE(0.9)) {
+      data.particles[i].r *= FTYPE(0.08);
+      data.particles[i].phi *= FTYPE(0.25);
+    }
+  }
+}
+
+void free_input_data(InputDataType& data) {
+  free(data.particles);
+  data.particles = nullptr;
+  data.numDataPoints = 0;
+}
+
+void write_result(const string& out_file, const BinsType& binnedData) {
+  ofstream out(out_file);
+  if (out.fail()) {
+    printf("Problem opening output result file.\n");
+    exit(1);
+  }
+  for (int i = 0; i < binnedData.nBinsX; ++i) {
+    for (int j = 0; j < binnedData.nBinsY; ++j) {
+      out << binnedData[i][j] << "\t";
+    }
+    out << endl;
+  }
+  if (out.fail()) {
+    printf("Problem writing result file.\n");
+    exit(1);
+  }
+  out.close();
+}
+
+// Loads a result file with any shape: one line per row of bins
+void load_result(const string& check_file, BinsType& binnedData) {
+  ifstream in(check_file);
+  if (!in.good()) {
+    printf("Problem opening check result file.\n");
+    exit(1);
+  }
+  vector<int> counts;
+  int nBinsX = 0;
+  int nBinsY = 0;
+  string line;
+  while (getline(in, line)) {
+    istringstream row(line);
+    int count;
+    int n = 0;
+    while (row >> count) {
+      counts.push_back(count);
+      ++n;
+    }
+    if (n == 0) {
+      continue;
+    }
+    if ((nBinsY != 0 && n != nBinsY) || !row.eof()) {
+      printf("Problem reading result file.\n");
+      exit(1);
+    }
+    nBinsY = n;
+    ++nBinsX;
+  }
+  if (nBinsX == 0) {
+    printf("Problem reading result file.\n");
+    exit(1);
+  }
+  binnedData.nBinsX = nBinsX;
+  binnedData.nBinsY = nBinsY;
+  binnedData.counts = move(counts);
+}
+
+void check_result(const string& check_file, const BinsType& binnedData) {
+  BinsType check_data;
+  load_result(check_file, check_data);
+  const int nBinsX = binnedData.nBinsX;
+  const int nBinsY = binnedData.nBinsY;
+  if (check_data.nBinsX != nBinsX || check_data.nBinsY != nBinsY) {
+    printf(ESC_RED "The result has %d×%d bins but %s has %d×%d." ESC_RESET "\n", nBinsX, nBinsY, check_file.c_str(), check_data.nBinsX, check_data.nBinsY);
+    return;
+  }
+  int maxDiff = 0;
+  int nBinsDiff = 0;
+  int nPartsCheck = 0;
+  int nParts = 0;
+  for (int i = 0; i < nBinsX; i++) {
+    for (int j = 0; j < nBinsY; j++) {
+      assert(binnedData[i][j] >= 0);
+      assert(check_data[i][j] >= 0);
+      nParts = nParts + binnedData[i][j];
+      nPartsCheck = nPartsCheck + check_data[i][j];
+      int diff = abs(binnedData[i][j] - check_data[i][j]);
+      if (diff > 0) {
+        maxDiff = max(maxDiff, diff);
+        ++nBinsDiff;
+      }
+    }
+  }
+  if (nBinsDiff > 0) {
+    int maxDiffThr = double(nParts) / (nBinsX * nBinsY) / 100000;
+    printf("Number of different bins: %d,  maximum bin difference: %d (threshold %d),  particle count: %d,  reference particle count: %d\n", nBinsDiff, maxDiff, maxDiffThr, nParts, nPartsCheck);
+    if (nParts != nPartsCheck) {
+      printf(ESC_RED "The number of input and output particles does not match with %s." ESC_RESET "\n", check_file.c_str());
+    }
+    if (maxDiff > maxDiffThr) {
+      printf(ESC_RED "The number of missclassified particles in some bins is too high with respect to %s." ESC_RESET "\n", check_file.c_str());
+    } else {
+      printf(ESC_GREEN "The result is similar enough to %s." ESC_RESET "\n", check_file.c_str());
+    }
+  } else {
+    assert(nPartsCheck == nParts && maxDiff == 0);
+    printf(ESC_GREEN "The result is exactly as in %s." ESC_RESET "\n", check_file.c_str());
+  }
+}
+
+void reset_bins(BinsType& bins) {
+  for (int i = 0; i < bins.nBinsX; i++) {
+    for (int j = 0; j < bins.nBinsY; j++) {
+      bins[i][j] = 0;
+    }
+  }
+}
+
+// Times BinParticles with each thread count of the comma-separated list
+// «threads_list» and prints the speedup over the first count and the
+// efficiency relative to it (1 if the time falls with the thread count)
+void report_scaling(const string& threads_list, const InputDataType& inputData, size_t repeat_times, size_t warmup_times) {
+  BinsType binnedData;
+  binnedData.resize(inputData.nBinsX, inputData.nBinsY);
+  double base_time = 0;
+  int base_threads = 0;
+  size_t start = 0;
+  while (start < threads_list.size()) {
+    size_t end = threads_list.find(',', start);
+    if (end == string::npos) {
+      end = threads_list.size();
+    }
+    int nThreads = atoi(threads_list.substr(start, end - start).c_str());
+    start = end + 1;
+    if (nThreads <= 0) {
+      fprintf(stderr, "Incorrect thread count in --scaling-threads: %s\n", threads_list.c_str());
+      exit(1);
+    }
+    omp_set_num_threads(nThreads);
+    vector<double> times;
+    for (size_t i = 0; i < repeat_times; ++i) {
+      reset_bins(binnedData);
+      double elapsed_time = measure_time(BinParticles, inputData, binnedData);
+      if (i >= warmup_times) {
+        times.push_back(elapsed_time);
+      }
+    }
+    double average_time = vector_average(times);
+    if (base_time == 0) {
+      base_time = average_time;
+      base_threads = nThreads;
+    }
+    const double speedup = base_time / average_time;
+    printf("Threads %3d: %7.3f±%.3fs  GP/s: %5.4g  speedup: %5.2f  efficiency: %5.1f%%\n", nThreads, average_time, vector_stddev(times), double(inputData.numDataPoints) / average_time / 1000000000, speedup, 100 * speedup * base_threads / nThreads);
+  }
+}
+
+int main(const int argc, const char** argv) {
+  string result_output_file = "";
+  string result_check_file = "";
+  size_t numDataPoints = 134217728; // 1<<27; // Problem size of the data sample
+  size_t seed = 1;
+  size_t repeat_times = 7; // total, including warmup
+  size_t warmup_times = 2;
+  string privatization_name = "auto";
+  string scaling_threads = ""; // e.g. "1,2,4,8"
+  string histogram_update_name = "auto";
+  string distribution = "uniform";
+  size_t nBinsX = defaultBinsX;
+  size_t nBinsY = defaultBinsY;
+  double maxMagnitudeR = defaultMaxMagnitudeR;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!parse_size_arg(argv[i], "num-data-points", numDataPoints)
+        && !parse_string_arg(argv[i], "write-result-file", result_output_file)
+        && !parse_string_arg(argv[i], "check-result-file", result_check_file)
+        && !parse_size_arg(argv[i], "seed", seed)
+        && !parse_size_arg(argv[i], "repeat-times", repeat_times)
+        && !parse_size_arg(argv[i], "warmup-times", warmup_times)
+        && !parse_string_arg(argv[i], "privatization", privatization_name)
+        && !parse_string_arg(argv[i], "scaling-threads", scaling_threads)
+        && !parse_string_arg(argv[i], "histogram-update", histogram_update_name)
+        && !parse_string_arg(argv[i], "distribution", distribution)
+        && !parse_size_arg(argv[i], "bins-x", nBinsX)
+        && !parse_size_arg(argv[i], "bins-y", nBinsY)
+        && !parse_double_arg(argv[i], "max-r", maxMagnitudeR)
+      ) {
+      fprintf(stderr, "Incorrect argument: %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  if (privatization_name == "auto") {
+    privatization = Privatization::Auto;
+  } else if (privatization_name == "per-thread") {
+    privatization = Privatization::PerThread;
+  } else if (privatization_name == "sharded") {
+    privatization = Privatization::Sharded;
+  } else {
+    fprintf(stderr, "Incorrect privatization (auto, per-thread or sharded): %s\n", privatization_name.c_str());
+    return 1;
+  }
+
+  if (histogram_update_name == "auto") {
+    histogramUpdate = HistogramUpdate::Auto;
+  } else if (histogram_update_name == "scalar") {
+    histogramUpdate = HistogramUpdate::Scalar;
+  } else if (histogram_update_name == "lanes") {
+    histogramUpdate = HistogramUpdate::Lanes;
+  } else {
+    fprintf(stderr, "Incorrect histogram update (auto, scalar or lanes): %s\n", histogram_update_name.c_str());
+    return 1;
+  }
+  if (nBinsX == 0 || nBinsY == 0 || nBinsX * nBinsY > (1 << 28) || maxMagnitudeR <= 0) {
+    fprintf(stderr, "Incorrect bin grid: %zu×%zu bins, maximum radius %g\n", nBinsX, nBinsY, maxMagnitudeR);
+    return 1;
+  }
+  if (distribution != "uniform" && distribution != "skewed") {
+    fprintf(stderr, "Incorrect distribution (uniform or skewed): %s\n", distribution.c_str());
+    return 1;
+  }
+
+  printf("Measuring time to bin %ld particles (%.3f GP) in %zu×%zu bins using %s\n", numDataPoints, double(numDataPoints) / 1000000000, nBinsX, nBinsY,
+#ifdef DOUBLE_PRECISION
+         "double precision"
+#else
+	 "single precision"
+#endif
+);
+
+  vector<double> times;
+  vector<double> pps;
+
+  InputDataType inputData;
+  set_bin_grid(inputData, nBinsX, nBinsY, maxMagnitudeR);
+  init_input_data(inputData, seed, numDataPoints, distribution == "skewed");
+  BinsType binnedData;
+  binnedData.resize(nBinsX, nBinsY);
+  
+  for (size_t i = 0; i < repeat_times; ++i) {
+    reset_bins(binnedData);
+    double elapsed_time = measure_time(BinParticles, inputData, binnedData);
+    if (i == 0) {
+      if (result_output_file != "") {
+        write_result(result_output_file, binnedData);
+      }
+      if (result_check_file != "") {
+        check_result(result_check_file, binnedData);
+      }
+    }
+    if (i >= warmup_times) {
+      times.push_back(elapsed_time);
+      pps.push_back(double(numDataPoints) / elapsed_time);
+    }
+    printf("    Run %2ld/%2ld: %7.2fs ⇒ %5.4g GP/s  %s\n", i + 1, repeat_times, elapsed_time, double(numDataPoints) / elapsed_time / 1000000000, i < warmup_times ? "(warmup)" : "");
+  }
+  
+  double average_time = vector_average(times);
+  double stddev_time = vector_stddev(times);
+  double average_pps = vector_average_harmonic(pps);
+  double stddev_pps = vector_stddev_harmonic(pps);
+  printf(ESC_BOLD "Average time (s): %7.2f±%.2f  GP/s: %5.4g±%.4g " ESC_RESET "   numDataPoints = %ld \n", average_time, stddev_time, average_pps / 1000000000, stddev_pps / 1000000000, numDataPoints);
+
+  if (scaling_threads != "") {
+    report_scaling(scaling_threads, inputData, repeat_times, warmup_times);
+  }
+
+  free_input_data(inputData);
+
+  return 0;
+}
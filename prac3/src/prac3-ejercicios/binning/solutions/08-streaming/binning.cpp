@@ -0,0 +1,148 @@
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include <omp.h>
+#include "util.h"
+
+#include "binning.h"
+#include "fast_sincos.h"
+
+using namespace std;
+
+Privatization privatization = Privatization::Auto;
+HistogramUpdate histogramUpdate = HistogramUpdate::Auto;
+
+// Kernel for grids of NX × NY bins, or of the size of the input grid
+// if they are 0. With the sizes known at compile time, the bin index
+// and the loops over the bins use constants.
+template<int NX, int NY>
+static void BinParticlesGrid(const InputDataType& inputData, BinsType& outputBins) {
+  const int nBinsX = NX > 0 ? NX : inputData.nBinsX;
+  const int nBinsY = NY > 0 ? NY : inputData.nBinsY;
+  const int nBins = nBinsX * nBinsY;
+  const FTYPE xMin = inputData.xMin;
+  const FTYPE yMin = inputData.yMin;
+  const FTYPE binsPerUnitX = inputData.binsPerUnitX;
+  const FTYPE binsPerUnitY = inputData.binsPerUnitY;
+
+  // Copies of the bins aligned and padded to whole cache lines, so that
+  // copies used by different threads never share a line
+  const size_t copyStride = (size_t(nBins) + 15) / 16 * 16;
+  const int nThreads = omp_get_max_threads();
+  const int maxCopies = max(size_t(1), maxPrivateBinsBytes / (sizeof(int) * copyStride));
+  Privatization mode = privatization;
+  if (mode == Privatization::Auto) {
+    mode = nThreads <= maxCopies ? Privatization::PerThread : Privatization::Sharded;
+  }
+  const int nCopies = mode == Privatization::PerThread ? nThreads : min(nThreads, maxCopies);
+  unique_ptr<int[], decltype(&free)> copies((int*) aligned_alloc(64, sizeof(int) * copyStride * nCopies), &free);
+  const bool useLanes = histogramUpdate == HistogramUpdate::Lanes
+    || (histogramUpdate == HistogramUpdate::Auto && sizeof(int) * nBins * histogramLanes <= maxLaneBinsBytes);
+
+#pragma omp parallel num_threads(nThreads)
+  {
+    const int t = omp_get_thread_num();
+    int* counts = &copies[(t % nCopies) * copyStride];
+    // Each copy is zeroed by the first thread that uses it (first touch).
+    // The team may have fewer than nThreads threads (OMP_DYNAMIC, a thread
+    // limit, nested parallelism), so its threads zero every copy between them
+    for (int c = t; c < nCopies; c += omp_get_num_threads()) {
+      for (int b = 0; b < nBins; b++) {
+        copies[c * copyStride + b] = 0;
+      }
+    }
+#pragma omp barrier
+
+    // Loop through all particle coordinates in blocks: the bins of a whole
+    // block are computed first in a vectorised loop and then counted
+    int block_bins[binningBlockSize];
+    // Sub-histograms of the lanes, interleaved: bin b of lane l is laneBins[b*histogramLanes + l]
+    vector<int> laneBins(useLanes ? nBins * histogramLanes : 0, 0);
+#pragma omp for schedule(static)
+    for (int start = 0; start < inputData.numDataPoints; start += binningBlockSize) {
+      const int n = min(binningBlockSize, inputData.numDataPoints - start);
+      const Particle* particles = &inputData.particles[start];
+#pragma omp simd
+      for (int i = 0; i < n; i++) {
+        // Transforming from cylindrical to Cartesian coordinates:
+        FTYPE sinPhi, cosPhi;
+        fast_sincos(particles[i].phi, sinPhi, cosPhi);
+        const FTYPE x = particles[i].r*cosPhi;
+        const FTYPE y = particles[i].r*sinPhi;
+
+        // Calculating the bin numbers for these coordinates:
+        const int iX = int((x - xMin)*binsPerUnitX);
+        const int iY = int((y - yMin)*binsPerUnitY);
+        block_bins[i] = iX*nBinsY + iY;
+      }
+
+      // Incrementing the appropriate bins in the counter
+      if (useLanes) {
+        int* lanes = laneBins.data();
+        int i = 0;
+        for (; i + histogramLanes <= n; i += histogramLanes) {
+#pragma omp simd
+          for (int l = 0; l < histogramLanes; l++) {
+            ++lanes[block_bins[i + l]*histogramLanes + l];
+          }
+        }
+        for (; i < n; i++) {
+          ++lanes[block_bins[i]*histogramLanes + i % histogramLanes];
+        }
+      } else if (mode == Privatization::PerThread) {
+        for (int i = 0; i < n; i++) {
+          ++counts[block_bins[i]];
+        }
+      } else {
+        for (int i = 0; i < n; i++) {
+#pragma omp atomic
+          ++counts[block_bins[i]];
+        }
+      }
+    }
+
+    if (useLanes) {
+      for (int b = 0; b < nBins; b++) {
+        int sum = 0;
+        for (int l = 0; l < histogramLanes; l++) {
+          sum += laneBins[b*histogramLanes + l];
+        }
+        if (mode == Privatization::PerThread) {
+          counts[b] += sum;
+        } else {
+#pragma omp atomic
+          counts[b] += sum;
+        }
+      }
+#pragma omp barrier
+    }
+
+    // Parallel reduction: each thread adds up a range of bins over all copies
+    int* output = &outputBins[0][0];
+#pragma omp for schedule(static)
+    for (int b = 0; b < nBins; b++) {
+      int sum = 0;
+      for (int c = 0; c < nCopies; c++) {
+        sum += copies[c * copyStride + b];
+      }
+      output[b] += sum;
+    }
+  }
+}
+
+void BinParticles(const InputDataType& inputData, BinsType& outputBins) {
+  const int nBinsX = inputData.nBinsX;
+  const int nBinsY = inputData.nBinsY;
+  if (nBinsX == 10 && nBinsY == 10) {
+    BinParticlesGrid<10, 10>(inputData, outputBins);
+  } else if (nBinsX == 64 && nBinsY == 64) {
+    BinParticlesGrid<64, 64>(inputData, outputBins);
+  } else if (nBinsX == 256 && nBinsY == 256) {
+    BinParticlesGrid<256, 256>(inputData, outputBins);
+  } else if (nBinsX == 1024 && nBinsY == 1024) {
+    BinParticlesGrid<1024, 1024>(inputData, outputBins);
+  } else {
+    BinParticlesGrid<0, 0>(inputData, outputBins);
+  }
+}
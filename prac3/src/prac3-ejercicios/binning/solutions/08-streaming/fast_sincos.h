@@ -0,0 +1,57 @@
+#ifndef _FAST_SINCOS_H_
+#define _FAST_SINCOS_H_
+
+#include "binning.h"
+
+// Sine and cosine of phi in [0, 2*pi] computed together with polynomials
+// (Cephes coefficients), without calls to libm and without branches, so
+// that a loop calling it under "#pragma omp simd" is fully vectorised.
+//
+// Range reduction: q = nearest multiple of pi/2 to phi, r = phi - q*pi/2
+// with pi/2 split in several parts (Cody-Waite) so that r in [-pi/4, pi/4]
+// stays accurate, then the quadrant q selects and negates the results.
+
+#ifdef DOUBLE_PRECISION
+const double PIO2_1 = 1.57079632673412561417e+00;  // first 33 bits of pi/2
+const double PIO2_2 = 6.07710050650619224932e-11;  // pi/2 - PIO2_1
+const double PIO2_3 = 0.0;
+
+inline double sin_poly(double r, double z) {
+  return r + r*z*((((((1.58962301576546568060e-10*z - 2.50507477628578072866e-8)*z + 2.75573136213857245213e-6)*z
+                     - 1.98412698295895385996e-4)*z + 8.33333333332211858878e-3)*z - 1.66666666666666307295e-1));
+}
+
+inline double cos_poly(double z) {
+  return 1.0 - 0.5*z + z*z*(((((-1.13585365213876817300e-11*z + 2.08757008419747316778e-9)*z - 2.75573141792967388112e-7)*z
+                              + 2.48015872888517045348e-5)*z - 1.38888888888730564116e-3)*z + 4.16666666666665929218e-2);
+}
+#else
+const float PIO2_1 = 1.5703125f;
+const float PIO2_2 = 4.837512969970703125e-4f;
+const float PIO2_3 = 7.54978995489188216e-8f;
+
+inline float sin_poly(float r, float z) {
+  return r + r*z*((-1.9515295891e-4f*z + 8.3321608736e-3f)*z - 1.6666654611e-1f);
+}
+
+inline float cos_poly(float z) {
+  return 1.0f - 0.5f*z + z*z*((2.443315711809948e-5f*z - 1.388731625493765e-3f)*z + 4.166664568298827e-2f);
+}
+#endif
+
+inline void fast_sincos(FTYPE phi, FTYPE& s, FTYPE& c) {
+  const int q = int(phi*FTYPE(2/M_PI) + FTYPE(0.5));
+  const FTYPE fq = FTYPE(q);
+  const FTYPE r = ((phi - fq*PIO2_1) - fq*PIO2_2) - fq*PIO2_3;
+  const FTYPE z = r*r;
+  const FTYPE sr = sin_poly(r, z);
+  const FTYPE cr = cos_poly(z);
+  // Quadrants 1 and 3 swap sine and cosine; the sign of the sine is
+  // negative in quadrants 2 and 3 and the one of the cosine in 1 and 2
+  const FTYPE sv = (q & 1) ? cr : sr;
+  const FTYPE cv = (q & 1) ? sr : cr;
+  s = (q & 2) ? -sv : sv;
+  c = ((q + 1) & 2) ? -cv : cv;
+}
+
+#endif
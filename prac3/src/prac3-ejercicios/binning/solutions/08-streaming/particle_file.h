@@ -0,0 +1,45 @@
+#ifndef _PARTICLE_FILE_H_
+#define _PARTICLE_FILE_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "binning.h"
+
+// Binary particle file: this 64-byte header followed by numDataPoints
+// Particle records {r, phi} of ftypeSize bytes each, as in memory
+struct ParticleFileHeader {
+  char magic[4];          // "PART"
+  uint32_t version;
+  uint32_t ftypeSize;     // sizeof(FTYPE) of the writer: 4 or 8
+  uint32_t reserved;
+  uint64_t numDataPoints;
+  double maxMagnitudeR;   // the radial coordinate does not exceed this value
+  uint64_t seed;          // of the generator, for reference
+  uint8_t padding[24];
+};
+static_assert(sizeof(ParticleFileHeader) == 64);
+
+const uint32_t particleFileVersion = 1;
+
+bool write_particle_file(const std::string& file_name, const InputDataType& data, size_t seed);
+bool read_particle_file_header(const std::string& file_name, ParticleFileHeader& header);
+
+struct StreamStats {
+  size_t bytes = 0;        // particle bytes read
+  double seconds = 0;      // wall time of the whole stream
+  double waitTime = 0;     // time «process» waited for the reader
+};
+
+// Reads the particles of a file in chunks of «chunkParticles» and calls
+// «process» on each chunk in order. A reader thread fills one of two
+// chunk buffers while «process» works on the other, and asks the
+// kernel to read ahead the chunk after the one being read, so memory
+// use is bounded by two chunks whatever the file size. With
+// «dropCache» the file's pages are evicted from the page cache first,
+// so that the data really comes from the disk.
+bool stream_particles(const std::string& file_name, size_t chunkParticles, bool dropCache,
+                      const std::function<void(const Particle*, size_t)>& process, StreamStats& stats);
+
+#endif
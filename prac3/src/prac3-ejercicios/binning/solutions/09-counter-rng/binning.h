@@ -0,0 +1,105 @@
+#ifndef _BINNING_H_
+#define _BINNING_H_
+
+#include <cstddef>
+#include <vector>
+
+#ifdef DOUBLE_PRECISION
+#define FTYPE double
+#define SIN sin
+#define COS cos
+#else
+#define FTYPE float
+#define SIN sinf
+#define COS cosf
+#endif
+
+struct Particle { 
+  FTYPE r;
+  FTYPE phi;
+};
+
+// Input data arrives as an array of cylindrical coordinates
+// of particles: r and phi. Size of the array is numDataPoints.
+// It also carries the bin grid, set with set_bin_grid: nBinsX × nBinsY
+// bins covering [xMin, xMax) × [yMin, yMax)
+struct InputDataType {
+  int numDataPoints;
+  Particle* particles;
+  int nBinsX;
+  int nBinsY;
+  // We assume that the radial coordinate does not exceed this value
+  FTYPE maxMagnitudeR;
+  // Boundaries of bins:
+  FTYPE xMin, xMax, yMin, yMax;
+  // Reciprocal of widths of bins:
+  FTYPE binsPerUnitX, binsPerUnitY;
+};
+
+// Default grid, the one of the previous steps
+const int defaultBinsX = 10;
+const int defaultBinsY = 10;
+const FTYPE defaultMaxMagnitudeR = 5.0;
+
+// Sets a grid of nBinsX × nBinsY bins covering the disc of radius maxMagnitudeR
+inline void set_bin_grid(InputDataType& data, int nBinsX, int nBinsY, FTYPE maxMagnitudeR) {
+  data.nBinsX = nBinsX;
+  data.nBinsY = nBinsY;
+  data.maxMagnitudeR = maxMagnitudeR;
+  data.xMin = -maxMagnitudeR*FTYPE(1.000001);
+  data.xMax = +maxMagnitudeR*FTYPE(1.000001);
+  data.yMin = -maxMagnitudeR*FTYPE(1.000001);
+  data.yMax = +maxMagnitudeR*FTYPE(1.000001);
+  data.binsPerUnitX = (FTYPE)nBinsX/(data.xMax - data.xMin);
+  data.binsPerUnitY = (FTYPE)nBinsY/(data.yMax - data.yMin);
+}
+
+// The output type is a matrix of bins with the shape of the input grid,
+// stored by rows (bins[iX][iY])
+struct BinsType {
+  int nBinsX = 0;
+  int nBinsY = 0;
+  std::vector<int> counts;
+
+  void resize(int x, int y) {
+    nBinsX = x;
+    nBinsY = y;
+    counts.assign(size_t(x) * y, 0);
+  }
+  int* operator[](int iX) { return &counts[size_t(iX) * nBinsY]; }
+  const int* operator[](int iX) const { return &counts[size_t(iX) * nBinsY]; }
+};
+
+// How the threads of BinParticles combine their counts:
+//  - PerThread: each thread bins into its own private copy of BinsType,
+//    padded to whole cache lines, and the copies are added up at the end.
+//  - Sharded: threads share a few copies (shards), incremented with
+//    atomics; with a single shard this is a plain atomic histogram.
+//  - Auto: PerThread while all private copies fit in maxPrivateBinsBytes,
+//    Sharded with as many shards as fit otherwise.
+enum class Privatization { Auto, PerThread, Sharded };
+extern Privatization privatization;
+const size_t maxPrivateBinsBytes = 1 << 20;
+
+// Particles whose bins are computed together in one vectorised loop
+const int binningBlockSize = 1024;
+
+// How each thread counts the bins of a block:
+//  - Scalar: one increment per particle in its histogram.
+//  - Lanes: each of histogramLanes SIMD lanes counts in its own
+//    sub-histogram, so a vector of increments never conflicts (and can
+//    be a gather/scatter) and runs of particles in the same bin do not
+//    serialise on one counter; the sub-histograms are added up at the end.
+//  - Auto: Lanes while the sub-histograms fit in maxLaneBinsBytes.
+enum class HistogramUpdate { Auto, Scalar, Lanes };
+extern HistogramUpdate histogramUpdate;
+const int histogramLanes = 16;
+const size_t maxLaneBinsBytes = 64 << 10;
+
+// Bins the particles of inputData into outputBins, which must already
+// have the shape of the input grid. 10×10, 64×64, 256×256 and 1024×1024
+// grids use kernels specialised at compile time for their size; the
+// rest a generic kernel with the sizes read at run time.
+void BinParticles(const InputDataType& inputData, BinsType& outputBins);
+
+#endif
@@ -0,0 +1,147 @@
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <omp.h>
+
+#include "particle_file.h"
+
+using namespace std;
+
+bool write_particle_file(const string& file_name, const InputDataType& data, size_t seed) {
+  FILE* out = fopen(file_name.c_str(), "wb");
+  if (out == nullptr) {
+    return false;
+  }
+  ParticleFileHeader header = {};
+  memcpy(header.magic, "PART", 4);
+  header.version = particleFileVersion;
+  header.ftypeSize = sizeof(FTYPE);
+  header.numDataPoints = data.numDataPoints;
+  header.maxMagnitudeR = data.maxMagnitudeR;
+  header.seed = seed;
+  bool ok = fwrite(&header, sizeof(header), 1, out) == 1
+    && fwrite(data.particles, sizeof(Particle), data.numDataPoints, out) == size_t(data.numDataPoints);
+  return fclose(out) == 0 && ok;
+}
+
+static bool read_header(int fd, ParticleFileHeader& header) {
+  return pread(fd, &header, sizeof(header), 0) == sizeof(header)
+    && !memcmp(header.magic, "PART", 4)
+    && header.version == particleFileVersion
+    && header.ftypeSize == sizeof(FTYPE);
+}
+
+bool read_particle_file_header(const string& file_name, ParticleFileHeader& header) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = read_header(fd, header);
+  close(fd);
+  return ok;
+}
+
+// Reads exactly «size» bytes at «offset», retrying short reads
+static bool pread_all(int fd, char* data, size_t size, off_t offset) {
+  while (size > 0) {
+    ssize_t n = pread(fd, data, size, offset);
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+bool stream_particles(const string& file_name, size_t chunkParticles, bool dropCache,
+                      const function<void(const Particle*, size_t)>& process, StreamStats& stats) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  ParticleFileHeader header;
+  if (fd < 0 || !read_header(fd, header)) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+  const size_t chunkBytes = sizeof(Particle) * chunkParticles;
+  const size_t numChunks = (header.numDataPoints + chunkParticles - 1) / chunkParticles;
+  if (dropCache) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  struct Chunk {
+    unique_ptr<Particle[], decltype(&free)> particles{nullptr, &free};
+    size_t count = 0;
+    bool full = false;
+  } chunks[2];
+  for (auto& c : chunks) {
+    c.particles.reset((Particle*) aligned_alloc(64, (chunkBytes + 63) / 64 * 64));
+  }
+  mutex m;
+  condition_variable changed;
+  bool failed = false;
+
+  const double start = omp_get_wtime();
+  thread reader([&] {
+    for (size_t c = 0; c < numChunks; ++c) {
+      Chunk& chunk = chunks[c % 2];
+      {
+        unique_lock<mutex> lock(m);
+        changed.wait(lock, [&] { return !chunk.full || failed; });
+        if (failed) {
+          return;
+        }
+      }
+      const off_t offset = sizeof(header) + c * chunkBytes;
+      const size_t count = min(chunkParticles, size_t(header.numDataPoints - c * chunkParticles));
+      // Readahead of the next chunk while this one is read
+      posix_fadvise(fd, offset + chunkBytes, chunkBytes, POSIX_FADV_WILLNEED);
+      bool ok = pread_all(fd, (char*) chunk.particles.get(), sizeof(Particle) * count, offset);
+      {
+        lock_guard<mutex> lock(m);
+        chunk.count = count;
+        chunk.full = true;
+        failed = !ok;
+      }
+      changed.notify_all();
+      if (!ok) {
+        return;
+      }
+    }
+  });
+
+  for (size_t c = 0; c < numChunks; ++c) {
+    Chunk& chunk = chunks[c % 2];
+    {
+      unique_lock<mutex> lock(m);
+      if (!chunk.full && !failed) {
+        const double waitStart = omp_get_wtime();
+        changed.wait(lock, [&] { return chunk.full || failed; });
+        stats.waitTime += omp_get_wtime() - waitStart;
+      }
+      if (failed) {
+        break;
+      }
+    }
+    process(chunk.particles.get(), chunk.count);
+    stats.bytes += sizeof(Particle) * chunk.count;
+    {
+      lock_guard<mutex> lock(m);
+      chunk.full = false;
+    }
+    changed.notify_all();
+  }
+  reader.join();
+  stats.seconds += omp_get_wtime() - start;
+  close(fd);
+  return !failed;
+}
@@ -0,0 +1,51 @@
+#ifndef _PHILOX_H_
+#define _PHILOX_H_
+
+#include <cstdint>
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel random
+// numbers: as easy as 1, 2, 3", SC'11). Its output is a function of a
+// 128-bit counter and a 64-bit key only, with no state carried from one
+// number to the next, so particle i can be generated from counter i by
+// any thread or SIMD lane and the sequence does not depend on how the
+// particles are split among them.
+
+struct Philox4x32 {
+  uint32_t v[4];
+};
+
+inline void philox_mulhilo(uint32_t a, uint32_t b, uint32_t& hi, uint32_t& lo) {
+  const uint64_t product = uint64_t(a) * b;
+  hi = uint32_t(product >> 32);
+  lo = uint32_t(product);
+}
+
+inline Philox4x32 philox4x32(Philox4x32 counter, uint64_t key) {
+  uint32_t k0 = uint32_t(key);
+  uint32_t k1 = uint32_t(key >> 32);
+  uint32_t c0 = counter.v[0], c1 = counter.v[1], c2 = counter.v[2], c3 = counter.v[3];
+  for (int round = 0; round < 10; ++round) {
+    uint32_t hi0, lo0, hi1, lo1;
+    philox_mulhilo(0xD2511F53u, c0, hi0, lo0);
+    philox_mulhilo(0xCD9E8D57u, c2, hi1, lo1);
+    c0 = hi1 ^ c1 ^ k0;
+    c1 = lo1;
+    c2 = hi0 ^ c3 ^ k1;
+    c3 = lo0;
+    k0 += 0x9E3779B9u; // Weyl sequence of the key
+    k1 += 0xBB67AE85u;
+  }
+  return {{c0, c1, c2, c3}};
+}
+
+// Uniform numbers in [0, 1) from the top 24 bits of one word (float)
+// or the top 53 bits of two words (double)
+inline float philox_uniform_float(uint32_t w) {
+  return float(w >> 8) * (1.0f / 16777216.0f);
+}
+
+inline double philox_uniform_double(uint32_t hi, uint32_t lo) {
+  return double(((uint64_t(hi) << 32) | lo) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+#endif
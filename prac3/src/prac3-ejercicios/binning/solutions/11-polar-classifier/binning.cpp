@@ -0,0 +1,405 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include <omp.h>
+#include "util.h"
+
+#include "binning.h"
+#include "fast_sincos.h"
+
+using namespace std;
+
+Privatization privatization = Privatization::Auto;
+HistogramUpdate histogramUpdate = HistogramUpdate::Auto;
+Classifier classifier = Classifier::Trig;
+int polarBandsPerBin = 32;
+
+// Table of Classifier::Polar for one grid. To find the interval of phi
+// without a search, [0, 2π) is split in «cells» equal angular cells, a
+// few per interval so that most cells have at most one interval start.
+// Cell c of band b is cells[b*(nCells + 1) + c]: the bin at its start
+// angle and the start angle of the next interval if it starts within the
+// cell, or a huge angle. The bin of phi is then the bin of its cell, or
+// of the next cell if phi is past that limit: one load for the cell and
+// one for the bin. Each band has one more cell with the bin at 2π. Cells
+// where several intervals start, and the intervals whose sector spans
+// several bins, have bin -1: their particles are classified with Trig.
+struct PolarCell {
+  FTYPE limit;
+  int bin;
+};
+
+struct PolarTable {
+  int nBinsX = 0, nBinsY = 0;
+  FTYPE xMin = 0, yMin = 0, binsPerUnitX = 0, binsPerUnitY = 0;
+  int bandsPerBin = 0;
+  int nBands = 0;
+  int nCells = 0;
+  FTYPE bandsPerUnit = 0;
+  FTYPE cellsPerRadian = 0;
+  vector<PolarCell> cells;
+  PolarTableStats stats = {};
+};
+
+static PolarTable polarTable;
+const int polarCellsPerInterval = 8;
+// Distance to the grid lines, relative to the radius of the grid, below
+// which the particles are classified with Trig: a few units in the last
+// place of single precision coordinates
+const double polarGuardDistance = 4e-6;
+const FTYPE polarPadding = 1e30; // not infinity, which -ffast-math assumes away
+
+static const PolarTable& get_polar_table(const InputDataType& inputData) {
+  PolarTable& t = polarTable;
+  if (t.nBinsX == inputData.nBinsX && t.nBinsY == inputData.nBinsY && t.xMin == inputData.xMin && t.yMin == inputData.yMin
+      && t.binsPerUnitX == inputData.binsPerUnitX && t.binsPerUnitY == inputData.binsPerUnitY && t.bandsPerBin == polarBandsPerBin) {
+    return t;
+  }
+  t.nBinsX = inputData.nBinsX;
+  t.nBinsY = inputData.nBinsY;
+  t.xMin = inputData.xMin;
+  t.yMin = inputData.yMin;
+  t.binsPerUnitX = inputData.binsPerUnitX;
+  t.binsPerUnitY = inputData.binsPerUnitY;
+  t.bandsPerBin = polarBandsPerBin;
+
+  // The bins are computed in double, away from the edges the same as
+  // Trig. A point is away from the edges when the bin does not change if
+  // it is displaced by the guard distance in x and y: closer to the grid
+  // lines rounding decides the bin, and Trig has to be used.
+  const double xMin = t.xMin, yMin = t.yMin, unitsX = 1 / double(t.binsPerUnitX), unitsY = 1 / double(t.binsPerUnitY);
+  const double guard = polarGuardDistance * -xMin;
+  auto bin_at = [&](double rho, double theta) {
+    int bin = -2;
+    for (double dx : {-guard, guard}) {
+      for (double dy : {-guard, guard}) {
+        const int iX = int(floor((rho*cos(theta) + dx - xMin)*t.binsPerUnitX));
+        const int iY = int(floor((rho*sin(theta) + dy - yMin)*t.binsPerUnitY));
+        const int b = iX >= 0 && iX < t.nBinsX && iY >= 0 && iY < t.nBinsY ? iX*t.nBinsY + iY : -1;
+        bin = bin == -2 || bin == b ? b : -1;
+      }
+    }
+    return bin;
+  };
+  // Angles in [0, 2π) at which the circle of radius rho crosses the
+  // lines at the guard distance of a grid line
+  auto crossings = [&](double rho, vector<double>& angles) {
+    for (int k = 0; k <= t.nBinsX; k++) {
+      for (double d : {-guard, guard}) {
+        const double x = xMin + k*unitsX + d;
+        if (fabs(x) < rho) {
+          const double a = acos(x / rho);
+          angles.push_back(a);
+          angles.push_back(2*M_PI - a);
+        }
+      }
+    }
+    for (int k = 0; k <= t.nBinsY; k++) {
+      for (double d : {-guard, guard}) {
+        const double y = yMin + k*unitsY + d;
+        if (fabs(y) < rho) {
+          const double a = asin(y / rho);
+          angles.push_back(a < 0 ? a + 2*M_PI : a);
+          angles.push_back(M_PI - a);
+        }
+      }
+    }
+  };
+
+  // As many bands as asked for while the table, with the most intervals
+  // a band can have, fits in maxPolarTableBytes
+  const double maxR = -xMin;
+  const int maxIntervals = 8*(t.nBinsX + t.nBinsY + 2) + 1;
+  const double binWidth = min(unitsX, unitsY);
+  t.nBands = max(1, int(min(ceil(maxR / binWidth * t.bandsPerBin),
+                            double(maxPolarTableBytes / ((polarCellsPerInterval * maxIntervals + 1) * sizeof(PolarCell))))));
+  t.bandsPerUnit = FTYPE(t.nBands / maxR);
+  const double bandWidth = maxR / t.nBands;
+
+  vector<vector<pair<double, int>>> bands(t.nBands);
+  double ambiguousArea = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:ambiguousArea)
+  for (int b = 0; b < t.nBands; b++) {
+    const double r0 = b*bandWidth, r1 = (b + 1)*bandWidth;
+    vector<double> angles = {0.0};
+    crossings(r0, angles);
+    crossings(r1, angles);
+    sort(angles.begin(), angles.end());
+    angles.erase(unique(angles.begin(), angles.end()), angles.end());
+    angles.push_back(2*M_PI);
+    auto& intervals = bands[b];
+    for (size_t j = 0; j + 1 < angles.size(); j++) {
+      const double mid = (angles[j] + angles[j + 1]) / 2;
+      const int bin0 = bin_at(r0, mid);
+      // The radial segments between the two arcs are inside the (convex) bin
+      const int bin = bin0 == bin_at(r1, mid) ? bin0 : -1;
+      if (bin < 0) {
+        ambiguousArea += (angles[j + 1] - angles[j]) / 2 * (r1*r1 - r0*r0);
+      }
+      if (intervals.empty() || intervals.back().second != bin) {
+        intervals.push_back({angles[j], bin});
+      }
+    }
+  }
+
+  size_t nIntervals = 1;
+  for (const auto& intervals : bands) {
+    nIntervals = max(nIntervals, intervals.size());
+  }
+
+  // The cell of an angle is computed as in the lookup, so a limit in an
+  // earlier cell than phi is never greater than phi
+  t.nCells = polarCellsPerInterval * nIntervals;
+  t.cellsPerRadian = FTYPE(t.nCells / (2*M_PI));
+  auto cell_of = [&](FTYPE angle) { return min(int(angle*t.cellsPerRadian), t.nCells - 1); };
+  t.cells.assign(size_t(t.nBands) * (t.nCells + 1), {polarPadding, -1});
+  double overflowArea = 0;
+  for (int b = 0; b < t.nBands; b++) {
+    const auto& intervals = bands[b];
+    const int n = intervals.size();
+    PolarCell* cells = &t.cells[size_t(b) * (t.nCells + 1)];
+    int j = 0; // interval at the start of the cell
+    for (int c = 0; c < t.nCells; c++) {
+      while (j + 1 < n && cell_of(FTYPE(intervals[j + 1].first)) < c) {
+        ++j;
+      }
+      int inCell = 0;
+      while (j + inCell + 1 < n && cell_of(FTYPE(intervals[j + inCell + 1].first)) == c) {
+        ++inCell;
+      }
+      if (inCell > 1) {
+        const double r0 = b*bandWidth, r1 = (b + 1)*bandWidth;
+        overflowArea += M_PI / t.nCells * (r1*r1 - r0*r0);
+      } else {
+        cells[c] = {inCell == 1 ? FTYPE(intervals[j + 1].first) : polarPadding, intervals[j].second};
+      }
+    }
+    cells[t.nCells].bin = intervals[n - 1].second;
+  }
+
+  t.stats = {t.nBands, int(nIntervals), t.nCells, sizeof(PolarCell) * t.cells.size(),
+             ambiguousArea / (M_PI*maxR*maxR), overflowArea / (M_PI*maxR*maxR)};
+  return t;
+}
+
+PolarTableStats polar_table_stats(const InputDataType& inputData) {
+  return get_polar_table(inputData).stats;
+}
+
+// Computes in block_bins[i] the bin of the n particles from «start»
+// with «classify», in a vectorised loop that reads the coordinates as
+// laid out in Layout. With AoSoA, «start» is a multiple of
+// particleBlockSize and whole blocks are classified, so block_bins
+// needs room for n rounded up to a multiple of particleBlockSize.
+template<ParticleLayout Layout, typename Classify>
+static inline void ClassifyBlock(const InputDataType& inputData, int start, int n, int* block_bins, Classify classify) {
+  if constexpr (Layout == ParticleLayout::AoS) {
+    const Particle* particles = &inputData.particles[start];
+#pragma omp simd
+    for (int i = 0; i < n; i++) {
+      block_bins[i] = classify(particles[i].r, particles[i].phi);
+    }
+  } else if constexpr (Layout == ParticleLayout::SoA) {
+    const FTYPE* r = &inputData.r[start];
+    const FTYPE* phi = &inputData.phi[start];
+#pragma omp simd
+    for (int i = 0; i < n; i++) {
+      block_bins[i] = classify(r[i], phi[i]);
+    }
+  } else {
+    const ParticleBlock* blocks = &inputData.blocks[start / particleBlockSize];
+    for (int b = 0; b * particleBlockSize < n; b++) {
+      int* bins = &block_bins[b * particleBlockSize];
+#pragma omp simd
+      for (int l = 0; l < particleBlockSize; l++) {
+        bins[l] = classify(blocks[b].r[l], blocks[b].phi[l]);
+      }
+    }
+  }
+}
+
+// Kernel for grids of NX × NY bins, or of the size of the input grid
+// if they are 0, and particles in Layout. With the sizes known at
+// compile time, the bin index and the loops over the bins use constants.
+template<int NX, int NY, ParticleLayout Layout>
+static void BinParticlesGrid(const InputDataType& inputData, BinsType& outputBins) {
+  const int nBinsX = NX > 0 ? NX : inputData.nBinsX;
+  const int nBinsY = NY > 0 ? NY : inputData.nBinsY;
+  const int nBins = nBinsX * nBinsY;
+  const FTYPE xMin = inputData.xMin;
+  const FTYPE yMin = inputData.yMin;
+  const FTYPE binsPerUnitX = inputData.binsPerUnitX;
+  const FTYPE binsPerUnitY = inputData.binsPerUnitY;
+
+  // Copies of the bins aligned and padded to whole cache lines, so that
+  // copies used by different threads never share a line
+  const size_t copyStride = (size_t(nBins) + 15) / 16 * 16;
+  const int nThreads = omp_get_max_threads();
+  const int maxCopies = max(size_t(1), maxPrivateBinsBytes / (sizeof(int) * copyStride));
+  Privatization mode = privatization;
+  if (mode == Privatization::Auto) {
+    mode = nThreads <= maxCopies ? Privatization::PerThread : Privatization::Sharded;
+  }
+  const int nCopies = mode == Privatization::PerThread ? nThreads : min(nThreads, maxCopies);
+  unique_ptr<int[], decltype(&free)> copies((int*) aligned_alloc(64, sizeof(int) * copyStride * nCopies), &free);
+  auto trig = [=](FTYPE r, FTYPE phi) {
+    // Transforming from cylindrical to Cartesian coordinates:
+    FTYPE sinPhi, cosPhi;
+    fast_sincos(phi, sinPhi, cosPhi);
+    const FTYPE x = r*cosPhi;
+    const FTYPE y = r*sinPhi;
+
+    // Calculating the bin numbers for these coordinates:
+    const int iX = int((x - xMin)*binsPerUnitX);
+    const int iY = int((y - yMin)*binsPerUnitY);
+    return iX*nBinsY + iY;
+  };
+  const PolarTable* polar = classifier == Classifier::Polar ? &get_polar_table(inputData) : nullptr;
+  // With the bins too small for the table, all of it is Trig
+  if (polar != nullptr && polar->stats.ambiguousArea + polar->stats.overflowArea > 0.999) {
+    polar = nullptr;
+  }
+  const PolarCell* polarCells = polar != nullptr ? polar->cells.data() : nullptr;
+  const int nBands = polar != nullptr ? polar->nBands : 0;
+  const int nCells = polar != nullptr ? polar->nCells : 0;
+  const FTYPE bandsPerUnit = polar != nullptr ? polar->bandsPerUnit : 0;
+  const FTYPE cellsPerRadian = polar != nullptr ? polar->cellsPerRadian : 0;
+
+  const bool useLanes = histogramUpdate == HistogramUpdate::Lanes
+    || (histogramUpdate == HistogramUpdate::Auto && sizeof(int) * nBins * histogramLanes <= maxLaneBinsBytes);
+
+#pragma omp parallel num_threads(nThreads)
+  {
+    const int t = omp_get_thread_num();
+    int* counts = &copies[(t % nCopies) * copyStride];
+    // Each copy is zeroed by the first thread that uses it (first touch).
+    // The team may have fewer than nThreads threads (OMP_DYNAMIC, a thread
+    // limit, nested parallelism), so its threads zero every copy between them
+    for (int c = t; c < nCopies; c += omp_get_num_threads()) {
+      for (int b = 0; b < nBins; b++) {
+        copies[c * copyStride + b] = 0;
+      }
+    }
+#pragma omp barrier
+
+    // Loop through all particle coordinates in blocks: the bins of a whole
+    // block are computed first in a vectorised loop and then counted
+    int block_bins[binningBlockSize];
+    int near_lines[binningBlockSize];
+    // Sub-histograms of the lanes, interleaved: bin b of lane l is laneBins[b*histogramLanes + l]
+    vector<int> laneBins(useLanes ? nBins * histogramLanes : 0, 0);
+#pragma omp for schedule(static)
+    for (int start = 0; start < inputData.numDataPoints; start += binningBlockSize) {
+      const int n = min(binningBlockSize, inputData.numDataPoints - start);
+      if (polar != nullptr) {
+        ClassifyBlock<Layout>(inputData, start, n, block_bins, [=](FTYPE r, FTYPE phi) {
+          const int band = min(max(int(r*bandsPerUnit), 0), nBands - 1);
+          const int cell = band*(nCells + 1) + min(max(int(phi*cellsPerRadian), 0), nCells - 1);
+          const int bin = polarCells[cell + (polarCells[cell].limit <= phi ? 1 : 0)].bin;
+          // The table covers phi in [0, 2π) and r up to the radius of the grid:
+          // outside them the clamped cell is not that of the particle, use Trig
+          return phi >= 0 && phi < FTYPE(2*M_PI) && r >= 0 && r*bandsPerUnit < nBands ? bin : -1;
+        });
+        // Particles near grid lines: their indices are gathered without
+        // branches and then classified with Trig in a vectorised loop
+        int nearLines = 0;
+        for (int i = 0; i < n; i++) {
+          near_lines[nearLines] = i;
+          nearLines += block_bins[i] < 0 ? 1 : 0;
+        }
+#pragma omp simd
+        for (int k = 0; k < nearLines; k++) {
+          FTYPE r, phi;
+          load_particle<Layout>(inputData, start + near_lines[k], r, phi);
+          block_bins[near_lines[k]] = trig(r, phi);
+        }
+      } else {
+        ClassifyBlock<Layout>(inputData, start, n, block_bins, trig);
+      }
+
+      // Incrementing the appropriate bins in the counter
+      if (useLanes) {
+        int* lanes = laneBins.data();
+        int i = 0;
+        for (; i + histogramLanes <= n; i += histogramLanes) {
+#pragma omp simd
+          for (int l = 0; l < histogramLanes; l++) {
+            ++lanes[block_bins[i + l]*histogramLanes + l];
+          }
+        }
+        for (; i < n; i++) {
+          ++lanes[block_bins[i]*histogramLanes + i % histogramLanes];
+        }
+      } else if (mode == Privatization::PerThread) {
+        for (int i = 0; i < n; i++) {
+          ++counts[block_bins[i]];
+        }
+      } else {
+        for (int i = 0; i < n; i++) {
+#pragma omp atomic
+          ++counts[block_bins[i]];
+        }
+      }
+    }
+
+    if (useLanes) {
+      for (int b = 0; b < nBins; b++) {
+        int sum = 0;
+        for (int l = 0; l < histogramLanes; l++) {
+          sum += laneBins[b*histogramLanes + l];
+        }
+        if (mode == Privatization::PerThread) {
+          counts[b] += sum;
+        } else {
+#pragma omp atomic
+          counts[b] += sum;
+        }
+      }
+#pragma omp barrier
+    }
+
+    // Parallel reduction: each thread adds up a range of bins over all copies
+    int* output = &outputBins[0][0];
+#pragma omp for schedule(static)
+    for (int b = 0; b < nBins; b++) {
+      int sum = 0;
+      for (int c = 0; c < nCopies; c++) {
+        sum += copies[c * copyStride + b];
+      }
+      output[b] += sum;
+    }
+  }
+}
+
+template<ParticleLayout Layout>
+static void BinParticlesLayout(const InputDataType& inputData, BinsType& outputBins) {
+  const int nBinsX = inputData.nBinsX;
+  const int nBinsY = inputData.nBinsY;
+  if (nBinsX == 10 && nBinsY == 10) {
+    BinParticlesGrid<10, 10, Layout>(inputData, outputBins);
+  } else if (nBinsX == 64 && nBinsY == 64) {
+    BinParticlesGrid<64, 64, Layout>(inputData, outputBins);
+  } else if (nBinsX == 256 && nBinsY == 256) {
+    BinParticlesGrid<256, 256, Layout>(inputData, outputBins);
+  } else if (nBinsX == 1024 && nBinsY == 1024) {
+    BinParticlesGrid<1024, 1024, Layout>(inputData, outputBins);
+  } else {
+    BinParticlesGrid<0, 0, Layout>(inputData, outputBins);
+  }
+}
+
+void BinParticles(const InputDataType& inputData, BinsType& outputBins) {
+  switch (inputData.layout) {
+  case ParticleLayout::AoS:
+    BinParticlesLayout<ParticleLayout::AoS>(inputData, outputBins);
+    break;
+  case ParticleLayout::SoA:
+    BinParticlesLayout<ParticleLayout::SoA>(inputData, outputBins);
+    break;
+  case ParticleLayout::AoSoA:
+    BinParticlesLayout<ParticleLayout::AoSoA>(inputData, outputBins);
+    break;
+  }
+}
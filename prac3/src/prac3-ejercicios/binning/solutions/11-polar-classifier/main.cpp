@@ -0,0 +1,568 @@
+#include <cassert>
+#include <random>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <omp.h>
+
+#include "util.h"
+#include "binning.h"
+#include "particle_file.h"
+#include "philox.h"
+
+using namespace std;
+
+// How init_input_data generates the particles:
+//  - MT19937: sequentially, from a single Mersenne Twister (the particles
+//    of 00-reference and binning-reference-results).
+//  - Philox: in parallel and vectorised, each particle from its own
+//    counter of a Philox4x32-10 keyed with the seed (two particles per
+//    counter in single precision); the particles depend on the seed
+//    only, not on the number of threads.
+enum class Generator { MT19937, Philox };
+
+// Philox generation of init_input_data, with the skew and the layout
+// decided at compile time so that the loop has no branches
+template<bool Skewed, ParticleLayout Layout>
+static void init_particles_philox(const InputDataType& data, size_t seed) {
+  const FTYPE maxMagnitudeR = data.maxMagnitudeR;
+#ifdef DOUBLE_PRECISION
+  // Each counter gives one particle: two words for r and two for phi
+  const size_t particlesPerCounter = 1;
+#else
+  // Each counter gives two particles: one word for each r and phi
+  const size_t particlesPerCounter = 2;
+#endif
+  const size_t numCounters = (data.numDataPoints + particlesPerCounter - 1) / particlesPerCounter;
+#pragma omp parallel for simd schedule(static)
+  for (size_t c = 0; c < numCounters; ++c) {
+    const uint32_t c0 = uint32_t(c), c1 = uint32_t(uint64_t(c) >> 32);
+    const Philox4x32 w = philox4x32({{c0, c1, 0, 0}}, seed);
+    uint32_t wskew0 = 0, wskew1 = 0;
+    if constexpr (Skewed) {
+      // The skew takes the words of counter c + 2^64
+      const Philox4x32 ws = philox4x32({{c0, c1, 1, 0}}, seed);
+      wskew0 = ws.v[0];
+      wskew1 = ws.v[1];
+    }
+    auto place = [=](size_t i, FTYPE ur, FTYPE uphi, uint32_t wskew) {
+      const bool skew = Skewed && philox_uniform_float(wskew) < 0.9f;
+      store_particle<Layout>(data, i, ur * maxMagnitudeR * (skew ? FTYPE(0.08) : FTYPE(1)),
+                             uphi * FTYPE(2.0*M_PI) * (skew ? FTYPE(0.25) : FTYPE(1)));
+    };
+#ifdef DOUBLE_PRECISION
+    place(c, philox_uniform_double(w.v[0], w.v[1]), philox_uniform_double(w.v[2], w.v[3]), wskew0);
+#else
+    place(2*c, philox_uniform_float(w.v[0]), philox_uniform_float(w.v[1]), wskew0);
+    place(2*c + 1, philox_uniform_float(w.v[2]), philox_uniform_float(w.v[3]), wskew1);
+#endif
+  }
+}
+
+template<bool Skewed>
+static void init_particles_philox_layout(const InputDataType& data, size_t seed) {
+  switch (data.layout) {
+  case ParticleLayout::AoS:
+    init_particles_philox<Skewed, ParticleLayout::AoS>(data, seed);
+    break;
+  case ParticleLayout::SoA:
+    init_particles_philox<Skewed, ParticleLayout::SoA>(data, seed);
+    break;
+  case ParticleLayout::AoSoA:
+    init_particles_philox<Skewed, ParticleLayout::AoSoA>(data, seed);
+    break;
+  }
+}
+
+static void store_particle_any(const InputDataType& data, size_t i, FTYPE r, FTYPE phi) {
+  switch (data.layout) {
+  case ParticleLayout::AoS:
+    store_particle<ParticleLayout::AoS>(data, i, r, phi);
+    break;
+  case ParticleLayout::SoA:
+    store_particle<ParticleLayout::SoA>(data, i, r, phi);
+    break;
+  case ParticleLayout::AoSoA:
+    store_particle<ParticleLayout::AoSoA>(data, i, r, phi);
+    break;
+  }
+}
+
+// The particles are generated in the disc of the grid of «data», which
+// must be set before, and stored in «layout». With «skewed», 90% of the
+// particles fall within the first quadrant and 8% of the radius instead
+// of uniformly in the disc
+void init_input_data(InputDataType& data, size_t seed, size_t numDataPoints, bool skewed = false, Generator generator = Generator::MT19937,
+                     ParticleLayout layout = ParticleLayout::AoS) {
+  const FTYPE maxMagnitudeR = data.maxMagnitudeR;
+  // Whole cache lines, which leave room for the second particle of the
+  // last Philox counter
+  const size_t bytes = particle_bytes(layout, numDataPoints);
+  set_particle_arrays(data, layout, numDataPoints, aligned_alloc(64, bytes));
+  if (generator == Generator::Philox) {
+    if (skewed) {
+      init_particles_philox_layout<true>(data, seed);
+    } else {
+      init_particles_philox_layout<false>(data, seed);
+    }
+  } else {
+    mt19937 generator_mt(seed); // 32 bit Mersenne Twister pseudo-random generator
+    uniform_real_distribution<FTYPE> distr(0.0, maxMagnitudeR);
+    uniform_real_distribution<FTYPE> distphi(0.0, 2.0*M_PI);
+    uniform_real_distribution<FTYPE> distskew(0.0, 1.0);
+    for (size_t i = 0; i < numDataPoints; ++i) {
+      FTYPE r = distr(generator_mt);
+      FTYPE phi = distphi(generator_mt);
+      if (skewed && distskew(generator_mt) < FTYPE(0.9)) {
+        r *= FTYPE(0.08);
+        phi *= FTYPE(0.25);
+      }
+      store_particle_any(data, i, r, phi);
+    }
+  }
+  if (layout == ParticleLayout::AoSoA) {
+    // Padding of the last block
+    for (size_t i = numDataPoints; i % particleBlockSize != 0; ++i) {
+      store_particle<ParticleLayout::AoSoA>(data, i, 0, 0);
+    }
+  }
+}
+
+const char* layout_names[] = { "aos", "soa", "aosoa" };
+
+void free_input_data(InputDataType& data) {
+  free(particle_buffer(data));
+  set_particle_arrays(data, data.layout, 0, nullptr);
+}
+
+void write_result(const string& out_file, const BinsType& binnedData) {
+  ofstream out(out_file);
+  if (out.fail()) {
+    printf("Problem opening output result file.\n");
+    exit(1);
+  }
+  for (int i = 0; i < binnedData.nBinsX; ++i) {
+    for (int j = 0; j < binnedData.nBinsY; ++j) {
+      out << binnedData[i][j] << "\t";
+    }
+    out << endl;
+  }
+  if (out.fail()) {
+    printf("Problem writing result file.\n");
+    exit(1);
+  }
+  out.close();
+}
+
+// Loads a result file with any shape: one line per row of bins
+void load_result(const string& check_file, BinsType& binnedData) {
+  ifstream in(check_file);
+  if (!in.good()) {
+    printf("Problem opening check result file.\n");
+    exit(1);
+  }
+  vector<int> counts;
+  int nBinsX = 0;
+  int nBinsY = 0;
+  string line;
+  while (getline(in, line)) {
+    istringstream row(line);
+    int count;
+    int n = 0;
+    while (row >> count) {
+      counts.push_back(count);
+      ++n;
+    }
+    if (n == 0) {
+      continue;
+    }
+    if ((nBinsY != 0 && n != nBinsY) || !row.eof()) {
+      printf("Problem reading result file.\n");
+      exit(1);
+    }
+    nBinsY = n;
+    ++nBinsX;
+  }
+  if (nBinsX == 0) {
+    printf("Problem reading result file.\n");
+    exit(1);
+  }
+  binnedData.nBinsX = nBinsX;
+  binnedData.nBinsY = nBinsY;
+  binnedData.counts = move(counts);
+}
+
+void check_result(const string& check_file, const BinsType& binnedData) {
+  BinsType check_data;
+  load_result(check_file, check_data);
+  const int nBinsX = binnedData.nBinsX;
+  const int nBinsY = binnedData.nBinsY;
+  if (check_data.nBinsX != nBinsX || check_data.nBinsY != nBinsY) {
+    printf(ESC_RED "The result has %d×%d bins but %s has %d×%d." ESC_RESET "\n", nBinsX, nBinsY, check_file.c_str(), check_data.nBinsX, check_data.nBinsY);
+    return;
+  }
+  int maxDiff = 0;
+  int nBinsDiff = 0;
+  int nPartsCheck = 0;
+  int nParts = 0;
+  for (int i = 0; i < nBinsX; i++) {
+    for (int j = 0; j < nBinsY; j++) {
+      assert(binnedData[i][j] >= 0);
+      assert(check_data[i][j] >= 0);
+      nParts = nParts + binnedData[i][j];
+      nPartsCheck = nPartsCheck + check_data[i][j];
+      int diff = abs(binnedData[i][j] - check_data[i][j]);
+      if (diff > 0) {
+        maxDiff = max(maxDiff, diff);
+        ++nBinsDiff;
+      }
+    }
+  }
+  if (nBinsDiff > 0) {
+    int maxDiffThr = double(nParts) / (nBinsX * nBinsY) / 100000;
+    printf("Number of different bins: %d,  maximum bin difference: %d (threshold %d),  particle count: %d,  reference particle count: %d\n", nBinsDiff, maxDiff, maxDiffThr, nParts, nPartsCheck);
+    if (nParts != nPartsCheck) {
+      printf(ESC_RED "The number of input and output particles does not match with %s." ESC_RESET "\n", check_file.c_str());
+    }
+    if (maxDiff > maxDiffThr) {
+      printf(ESC_RED "The number of missclassified particles in some bins is too high with respect to %s." ESC_RESET "\n", check_file.c_str());
+    } else {
+      printf(ESC_GREEN "The result is similar enough to %s." ESC_RESET "\n", check_file.c_str());
+    }
+  } else {
+    assert(nPartsCheck == nParts && maxDiff == 0);
+    printf(ESC_GREEN "The result is exactly as in %s." ESC_RESET "\n", check_file.c_str());
+  }
+}
+
+void reset_bins(BinsType& bins) {
+  for (int i = 0; i < bins.nBinsX; i++) {
+    for (int j = 0; j < bins.nBinsY; j++) {
+      bins[i][j] = 0;
+    }
+  }
+}
+
+// Times BinParticles with each thread count of the comma-separated list
+// «threads_list» and prints the speedup over the first count and the
+// efficiency relative to it (1 if the time falls with the thread count)
+void report_scaling(const string& threads_list, const InputDataType& inputData, size_t repeat_times, size_t warmup_times) {
+  BinsType binnedData;
+  binnedData.resize(inputData.nBinsX, inputData.nBinsY);
+  double base_time = 0;
+  int base_threads = 0;
+  size_t start = 0;
+  while (start < threads_list.size()) {
+    size_t end = threads_list.find(',', start);
+    if (end == string::npos) {
+      end = threads_list.size();
+    }
+    int nThreads = atoi(threads_list.substr(start, end - start).c_str());
+    start = end + 1;
+    if (nThreads <= 0) {
+      fprintf(stderr, "Incorrect thread count in --scaling-threads: %s\n", threads_list.c_str());
+      exit(1);
+    }
+    omp_set_num_threads(nThreads);
+    vector<double> times;
+    for (size_t i = 0; i < repeat_times; ++i) {
+      reset_bins(binnedData);
+      double elapsed_time = measure_time(BinParticles, inputData, binnedData);
+      if (i >= warmup_times) {
+        times.push_back(elapsed_time);
+      }
+    }
+    double average_time = vector_average(times);
+    if (base_time == 0) {
+      base_time = average_time;
+      base_threads = nThreads;
+    }
+    const double speedup = base_time / average_time;
+    printf("Threads %3d: %7.3f±%.3fs  GP/s: %5.4g  speedup: %5.2f  efficiency: %5.1f%%\n", nThreads, average_time, vector_stddev(times), double(inputData.numDataPoints) / average_time / 1000000000, speedup, 100 * speedup * base_threads / nThreads);
+  }
+}
+
+// With Classifier::Polar, builds the table of the grid of «grid» before
+// the binning is timed and prints its size and build time
+void prepare_classifier(const InputDataType& grid) {
+  if (classifier == Classifier::Polar) {
+    double build_time = omp_get_wtime();
+    PolarTableStats stats = polar_table_stats(grid);
+    build_time = omp_get_wtime() - build_time;
+    printf("Polar table: %d bands × %d intervals, %d cells (%.1f MB) built in %.3fs, %.2f%% + %.2f%% of the disc classified with trig\n", stats.nBands, stats.nIntervals,
+           stats.nCells, double(stats.bytes) / 1000000, build_time, 100 * stats.ambiguousArea, 100 * stats.overflowArea);
+  }
+}
+
+// Bins the particles of «particles_file» chunk by chunk while
+// stream_particles reads them, so only two chunks are ever in memory.
+// The file is first read once without binning to know the raw read
+// speed, against which the GB/s of each run are reported.
+int stream_binning(const string& particles_file, size_t chunkParticles, bool dropCache, size_t nBinsX, size_t nBinsY,
+                   size_t repeat_times, size_t warmup_times, const string& result_output_file, const string& result_check_file) {
+  ParticleFileHeader header;
+  if (!read_particle_file_header(particles_file, header)) {
+    fprintf(stderr, "Problem reading particle file header (or particles not in %s): %s\n",
+#ifdef DOUBLE_PRECISION
+            "double precision",
+#else
+            "single precision",
+#endif
+            particles_file.c_str());
+    return 1;
+  }
+  const size_t numDataPoints = header.numDataPoints;
+  printf("Measuring time to bin %ld particles (%.3f GP, %.3f GB) of %s (%s) in %zu×%zu bins in chunks of %zu particles (%.1f MB)\n", numDataPoints, double(numDataPoints) / 1000000000,
+         double(numDataPoints * sizeof(Particle)) / 1000000000, particles_file.c_str(), layout_names[size_t(header.layout)], nBinsX, nBinsY, chunkParticles, double(chunkParticles * sizeof(Particle)) / 1000000);
+
+  InputDataType grid;
+  set_bin_grid(grid, nBinsX, nBinsY, header.maxMagnitudeR);
+
+  StreamStats raw;
+  if (!stream_particles(particles_file, chunkParticles, dropCache, grid, [](const InputDataType&) {}, raw)) {
+    fprintf(stderr, "Problem reading particle file: %s\n", particles_file.c_str());
+    return 1;
+  }
+  const double raw_gbps = raw.bytes / raw.seconds / 1000000000;
+  printf("    Raw read: %7.2fs ⇒ %5.4g GB/s%s\n", raw.seconds, raw_gbps, dropCache ? "" : "  (from the page cache if it fits)");
+
+  prepare_classifier(grid);
+  BinsType binnedData;
+  binnedData.resize(nBinsX, nBinsY);
+
+  vector<double> times;
+  vector<double> pps;
+  vector<double> gbps;
+  for (size_t i = 0; i < repeat_times; ++i) {
+    reset_bins(binnedData);
+    StreamStats stats;
+    bool ok = stream_particles(particles_file, chunkParticles, dropCache, grid, [&](const InputDataType& chunk) {
+      BinParticles(chunk, binnedData);
+    }, stats);
+    if (!ok) {
+      fprintf(stderr, "Problem reading particle file: %s\n", particles_file.c_str());
+      return 1;
+    }
+    const double elapsed_time = stats.seconds;
+    if (i == 0) {
+      if (result_output_file != "") {
+        write_result(result_output_file, binnedData);
+      }
+      if (result_check_file != "") {
+        check_result(result_check_file, binnedData);
+      }
+    }
+    if (i >= warmup_times) {
+      times.push_back(elapsed_time);
+      pps.push_back(double(numDataPoints) / elapsed_time);
+      gbps.push_back(stats.bytes / elapsed_time / 1000000000);
+    }
+    printf("    Run %2ld/%2ld: %7.2fs ⇒ %5.4g GP/s  %5.4g GB/s (%3.0f%% of raw read)  waiting for the reader: %5.2fs  %s\n", i + 1, repeat_times, elapsed_time,
+           double(numDataPoints) / elapsed_time / 1000000000, stats.bytes / elapsed_time / 1000000000, 100 * raw.seconds / elapsed_time, stats.waitTime,
+           i < warmup_times ? "(warmup)" : "");
+  }
+
+  double average_time = vector_average(times);
+  double stddev_time = vector_stddev(times);
+  double average_pps = vector_average_harmonic(pps);
+  double stddev_pps = vector_stddev_harmonic(pps);
+  double average_gbps = vector_average_harmonic(gbps);
+  printf(ESC_BOLD "Average time (s): %7.2f±%.2f  GP/s: %5.4g±%.4g  GB/s: %5.4g (raw read %5.4g) " ESC_RESET "   numDataPoints = %ld \n", average_time, stddev_time,
+         average_pps / 1000000000, stddev_pps / 1000000000, average_gbps, raw_gbps, numDataPoints);
+  return 0;
+}
+
+int main(const int argc, const char** argv) {
+  string result_output_file = "";
+  string result_check_file = "";
+  size_t numDataPoints = 134217728; // 1<<27; // Problem size of the data sample
+  size_t seed = 1;
+  size_t repeat_times = 7; // total, including warmup
+  size_t warmup_times = 2;
+  string privatization_name = "auto";
+  string scaling_threads = ""; // e.g. "1,2,4,8"
+  string histogram_update_name = "auto";
+  string classifier_name = "trig";
+  size_t polar_bands_per_bin = polarBandsPerBin;
+  string distribution = "uniform";
+  string generator_name = "mt19937";
+  string layout_name = "aos";
+  size_t nBinsX = defaultBinsX;
+  size_t nBinsY = defaultBinsY;
+  double maxMagnitudeR = defaultMaxMagnitudeR;
+  string particles_file = "";       // binary particle file to bin in streaming
+  string write_particles_file = ""; // generates the particles into this file
+  size_t chunk_size = 1 << 22;      // particles per chunk when streaming
+  bool drop_cache = true;           // read the particle file from disk, not from the page cache
+
+  for (int i = 1; i < argc; ++i) {
+    if (!parse_size_arg(argv[i], "num-data-points", numDataPoints)
+        && !parse_string_arg(argv[i], "write-result-file", result_output_file)
+        && !parse_string_arg(argv[i], "check-result-file", result_check_file)
+        && !parse_size_arg(argv[i], "seed", seed)
+        && !parse_size_arg(argv[i], "repeat-times", repeat_times)
+        && !parse_size_arg(argv[i], "warmup-times", warmup_times)
+        && !parse_string_arg(argv[i], "privatization", privatization_name)
+        && !parse_string_arg(argv[i], "scaling-threads", scaling_threads)
+        && !parse_string_arg(argv[i], "histogram-update", histogram_update_name)
+        && !parse_string_arg(argv[i], "classifier", classifier_name)
+        && !parse_size_arg(argv[i], "polar-bands-per-bin", polar_bands_per_bin)
+        && !parse_string_arg(argv[i], "distribution", distribution)
+        && !parse_string_arg(argv[i], "generator", generator_name)
+        && !parse_string_arg(argv[i], "layout", layout_name)
+        && !parse_size_arg(argv[i], "bins-x", nBinsX)
+        && !parse_size_arg(argv[i], "bins-y", nBinsY)
+        && !parse_double_arg(argv[i], "max-r", maxMagnitudeR)
+        && !parse_string_arg(argv[i], "particles-file", particles_file)
+        && !parse_string_arg(argv[i], "write-particles-file", write_particles_file)
+        && !parse_size_arg(argv[i], "chunk-size", chunk_size)
+        && !parse_bool_arg(argv[i], "drop-cache", drop_cache)
+      ) {
+      fprintf(stderr, "Incorrect argument: %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  if (privatization_name == "auto") {
+    privatization = Privatization::Auto;
+  } else if (privatization_name == "per-thread") {
+    privatization = Privatization::PerThread;
+  } else if (privatization_name == "sharded") {
+    privatization = Privatization::Sharded;
+  } else {
+    fprintf(stderr, "Incorrect privatization (auto, per-thread or sharded): %s\n", privatization_name.c_str());
+    return 1;
+  }
+
+  if (histogram_update_name == "auto") {
+    histogramUpdate = HistogramUpdate::Auto;
+  } else if (histogram_update_name == "scalar") {
+    histogramUpdate = HistogramUpdate::Scalar;
+  } else if (histogram_update_name == "lanes") {
+    histogramUpdate = HistogramUpdate::Lanes;
+  } else {
+    fprintf(stderr, "Incorrect histogram update (auto, scalar or lanes): %s\n", histogram_update_name.c_str());
+    return 1;
+  }
+
+  if (classifier_name == "trig") {
+    classifier = Classifier::Trig;
+  } else if (classifier_name == "polar") {
+    classifier = Classifier::Polar;
+  } else {
+    fprintf(stderr, "Incorrect classifier (trig or polar): %s\n", classifier_name.c_str());
+    return 1;
+  }
+  if (polar_bands_per_bin == 0 || polar_bands_per_bin > 4096) {
+    fprintf(stderr, "Incorrect polar bands per bin: %zu\n", polar_bands_per_bin);
+    return 1;
+  }
+  polarBandsPerBin = polar_bands_per_bin;
+  if (nBinsX == 0 || nBinsY == 0 || nBinsX * nBinsY > (1 << 28) || maxMagnitudeR <= 0) {
+    fprintf(stderr, "Incorrect bin grid: %zu×%zu bins, maximum radius %g\n", nBinsX, nBinsY, maxMagnitudeR);
+    return 1;
+  }
+  if (distribution != "uniform" && distribution != "skewed") {
+    fprintf(stderr, "Incorrect distribution (uniform or skewed): %s\n", distribution.c_str());
+    return 1;
+  }
+  Generator generator;
+  if (generator_name == "mt19937") {
+    generator = Generator::MT19937;
+  } else if (generator_name == "philox") {
+    generator = Generator::Philox;
+  } else {
+    fprintf(stderr, "Incorrect generator (mt19937 or philox): %s\n", generator_name.c_str());
+    return 1;
+  }
+  size_t layout_index = 0;
+  while (layout_index < size(layout_names) && layout_name != layout_names[layout_index]) {
+    ++layout_index;
+  }
+  if (layout_index == size(layout_names)) {
+    fprintf(stderr, "Incorrect layout (aos, soa or aosoa): %s\n", layout_name.c_str());
+    return 1;
+  }
+  const ParticleLayout layout = ParticleLayout(layout_index);
+
+  if (chunk_size == 0 || chunk_size > (1u << 30)) {
+    fprintf(stderr, "Incorrect chunk size: %zu\n", chunk_size);
+    return 1;
+  }
+
+  if (particles_file != "") {
+    return stream_binning(particles_file, chunk_size, drop_cache, nBinsX, nBinsY, repeat_times, warmup_times, result_output_file, result_check_file);
+  }
+
+  if (write_particles_file != "") {
+    InputDataType inputData;
+    set_bin_grid(inputData, nBinsX, nBinsY, maxMagnitudeR);
+    init_input_data(inputData, seed, numDataPoints, distribution == "skewed", generator, layout);
+    if (!write_particle_file(write_particles_file, inputData, seed)) {
+      fprintf(stderr, "Problem writing particle file: %s\n", write_particles_file.c_str());
+      return 1;
+    }
+    printf("Written %ld particles (%.3f GB, %s) to %s\n", numDataPoints, double(numDataPoints * sizeof(Particle)) / 1000000000, layout_name.c_str(), write_particles_file.c_str());
+    free_input_data(inputData);
+    return 0;
+  }
+
+  printf("Measuring time to bin %ld particles (%.3f GP, %s) in %zu×%zu bins using %s\n", numDataPoints, double(numDataPoints) / 1000000000, layout_name.c_str(), nBinsX, nBinsY,
+#ifdef DOUBLE_PRECISION
+         "double precision"
+#else
+	 "single precision"
+#endif
+);
+
+  vector<double> times;
+  vector<double> pps;
+
+  InputDataType inputData;
+  set_bin_grid(inputData, nBinsX, nBinsY, maxMagnitudeR);
+  // Timed apart from the binning: with mt19937 it takes longer than several runs
+  double generation_time = omp_get_wtime();
+  init_input_data(inputData, seed, numDataPoints, distribution == "skewed", generator, layout);
+  generation_time = omp_get_wtime() - generation_time;
+  printf("Generated the particles with %s in %.2fs ⇒ %5.4g GP/s using %d threads\n", generator_name.c_str(), generation_time,
+         double(numDataPoints) / generation_time / 1000000000, generator == Generator::Philox ? omp_get_max_threads() : 1);
+  prepare_classifier(inputData);
+  BinsType binnedData;
+  binnedData.resize(nBinsX, nBinsY);
+  
+  for (size_t i = 0; i < repeat_times; ++i) {
+    reset_bins(binnedData);
+    double elapsed_time = measure_time(BinParticles, inputData, binnedData);
+    if (i == 0) {
+      if (result_output_file != "") {
+        write_result(result_output_file, binnedData);
+      }
+      if (result_check_file != "") {
+        check_result(result_check_file, binnedData);
+      }
+    }
+    if (i >= warmup_times) {
+      times.push_back(elapsed_time);
+      pps.push_back(double(numDataPoints) / elapsed_time);
+    }
+    printf("    Run %2ld/%2ld: %7.2fs ⇒ %5.4g GP/s  %s\n", i + 1, repeat_times, elapsed_time, double(numDataPoints) / elapsed_time / 1000000000, i < warmup_times ? "(warmup)" : "");
+  }
+  
+  double average_time = vector_average(times);
+  double stddev_time = vector_stddev(times);
+  double average_pps = vector_average_harmonic(pps);
+  double stddev_pps = vector_stddev_harmonic(pps);
+  printf(ESC_BOLD "Average time (s): %7.2f±%.2f  GP/s: %5.4g±%.4g " ESC_RESET "   numDataPoints = %ld \n", average_time, stddev_time, average_pps / 1000000000, stddev_pps / 1000000000, numDataPoints);
+
+  if (scaling_threads != "") {
+    report_scaling(scaling_threads, inputData, repeat_times, warmup_times);
+  }
+
+  free_input_data(inputData);
+
+  return 0;
+}
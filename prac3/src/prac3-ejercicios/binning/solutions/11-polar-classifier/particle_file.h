@@ -0,0 +1,49 @@
+#ifndef _PARTICLE_FILE_H_
+#define _PARTICLE_FILE_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "binning.h"
+
+// Binary particle file: this 64-byte header followed by the coordinates
+// of numDataPoints particles, of ftypeSize bytes each, in «layout» as in
+// memory: Particle records {r, phi} (AoS); all r and then all phi (SoA);
+// or ParticleBlock records, the last one padded with zeros (AoSoA)
+struct ParticleFileHeader {
+  char magic[4];          // "PART"
+  uint32_t version;
+  uint32_t ftypeSize;     // sizeof(FTYPE) of the writer: 4 or 8
+  ParticleLayout layout;  // 0 (AoS) in the files of 08-streaming
+  uint64_t numDataPoints;
+  double maxMagnitudeR;   // the radial coordinate does not exceed this value
+  uint64_t seed;          // of the generator, for reference
+  uint8_t padding[24];
+};
+static_assert(sizeof(ParticleFileHeader) == 64);
+
+const uint32_t particleFileVersion = 1;
+
+bool write_particle_file(const std::string& file_name, const InputDataType& data, size_t seed);
+bool read_particle_file_header(const std::string& file_name, ParticleFileHeader& header);
+
+struct StreamStats {
+  size_t bytes = 0;        // particle bytes read
+  double seconds = 0;      // wall time of the whole stream
+  double waitTime = 0;     // time «process» waited for the reader
+};
+
+// Reads the particles of a file in chunks of «chunkParticles» (rounded
+// up to whole blocks with AoSoA) and calls «process» on each chunk in
+// order, with the grid of «grid» and the particles of the chunk in the
+// layout of the file. A reader thread fills one of two
+// chunk buffers while «process» works on the other, and asks the
+// kernel to read ahead the chunk after the one being read, so memory
+// use is bounded by two chunks whatever the file size. With
+// «dropCache» the file's pages are evicted from the page cache first,
+// so that the data really comes from the disk.
+bool stream_particles(const std::string& file_name, size_t chunkParticles, bool dropCache, const InputDataType& grid,
+                      const std::function<void(const InputDataType&)>& process, StreamStats& stats);
+
+#endif
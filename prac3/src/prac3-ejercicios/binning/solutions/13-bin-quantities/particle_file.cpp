@@ -0,0 +1,182 @@
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <omp.h>
+
+#include "particle_file.h"
+
+using namespace std;
+
+// Calls f(offset, size, data) for each range of the file that holds the
+// particles [first, first + count) and where they go in the arrays of
+// «chunk», in the layout of the file, and returns whether all succeed
+template<typename F>
+static bool for_each_range(const ParticleFileHeader& header, size_t first, size_t count, const InputDataType& chunk, F f) {
+  const off_t base = sizeof(ParticleFileHeader);
+  switch (header.layout) {
+  case ParticleLayout::SoA:
+    return f(base + sizeof(FTYPE) * first, sizeof(FTYPE) * count, (char*) chunk.r)
+      && f(base + sizeof(FTYPE) * (header.numDataPoints + first), sizeof(FTYPE) * count, (char*) chunk.phi);
+  case ParticleLayout::AoSoA:
+    return f(base + sizeof(ParticleBlock) * (first / particleBlockSize),
+             sizeof(ParticleBlock) * ((count + particleBlockSize - 1) / particleBlockSize), (char*) chunk.blocks);
+  default:
+    return f(base + sizeof(Particle) * first, sizeof(Particle) * count, (char*) chunk.particles);
+  }
+}
+
+bool write_particle_file(const string& file_name, const InputDataType& data, size_t seed) {
+  FILE* out = fopen(file_name.c_str(), "wb");
+  if (out == nullptr) {
+    return false;
+  }
+  ParticleFileHeader header = {};
+  memcpy(header.magic, "PART", 4);
+  header.version = particleFileVersion;
+  header.ftypeSize = sizeof(FTYPE);
+  header.layout = data.layout;
+  header.numDataPoints = data.numDataPoints;
+  header.maxMagnitudeR = data.maxMagnitudeR;
+  header.seed = seed;
+  // The ranges are consecutive, so they are written in order
+  bool ok = fwrite(&header, sizeof(header), 1, out) == 1
+    && for_each_range(header, 0, data.numDataPoints, data, [&](off_t, size_t size, const char* bytes) {
+      return fwrite(bytes, 1, size, out) == size;
+    });
+  return fclose(out) == 0 && ok;
+}
+
+static bool read_header(int fd, ParticleFileHeader& header) {
+  return pread(fd, &header, sizeof(header), 0) == sizeof(header)
+    && !memcmp(header.magic, "PART", 4)
+    && header.version == particleFileVersion
+    && header.ftypeSize == sizeof(FTYPE)
+    && header.layout <= ParticleLayout::AoSoA;
+}
+
+bool read_particle_file_header(const string& file_name, ParticleFileHeader& header) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = read_header(fd, header);
+  close(fd);
+  return ok;
+}
+
+// Reads exactly «size» bytes at «offset», retrying short reads
+static bool pread_all(int fd, char* data, size_t size, off_t offset) {
+  while (size > 0) {
+    ssize_t n = pread(fd, data, size, offset);
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+bool stream_particles(const string& file_name, size_t chunkParticles, bool dropCache, const InputDataType& grid,
+                      const function<void(const InputDataType&)>& process, StreamStats& stats) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  ParticleFileHeader header;
+  if (fd < 0 || !read_header(fd, header)) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+  if (header.layout == ParticleLayout::AoSoA) {
+    chunkParticles = (chunkParticles + particleBlockSize - 1) / particleBlockSize * particleBlockSize;
+  }
+  const size_t chunkBytes = particle_bytes(header.layout, chunkParticles);
+  const size_t numChunks = (header.numDataPoints + chunkParticles - 1) / chunkParticles;
+  if (dropCache) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  struct Chunk {
+    unique_ptr<char[], decltype(&free)> buffer{nullptr, &free};
+    InputDataType data;
+    bool full = false;
+  } chunks[2];
+  for (auto& c : chunks) {
+    c.buffer.reset((char*) aligned_alloc(64, chunkBytes));
+    c.data = grid;
+    set_particle_arrays(c.data, header.layout, chunkParticles, c.buffer.get());
+  }
+  mutex m;
+  condition_variable changed;
+  bool failed = false;
+
+  const double start = omp_get_wtime();
+  thread reader([&] {
+    for (size_t c = 0; c < numChunks; ++c) {
+      Chunk& chunk = chunks[c % 2];
+      {
+        unique_lock<mutex> lock(m);
+        changed.wait(lock, [&] { return !chunk.full || failed; });
+        if (failed) {
+          return;
+        }
+      }
+      const size_t first = c * chunkParticles;
+      const size_t count = min(chunkParticles, size_t(header.numDataPoints - first));
+      // Readahead of the next chunk while this one is read
+      if (c + 1 < numChunks) {
+        const size_t nextCount = min(chunkParticles, size_t(header.numDataPoints - first - count));
+        for_each_range(header, first + count, nextCount, chunk.data, [&](off_t offset, size_t size, char*) {
+          return posix_fadvise(fd, offset, size, POSIX_FADV_WILLNEED) == 0;
+        });
+      }
+      bool ok = for_each_range(header, first, count, chunk.data, [&](off_t offset, size_t size, char* data) {
+        return pread_all(fd, data, size, offset);
+      });
+      {
+        lock_guard<mutex> lock(m);
+        chunk.data.numDataPoints = count;
+        chunk.full = true;
+        failed = !ok;
+      }
+      changed.notify_all();
+      if (!ok) {
+        return;
+      }
+    }
+  });
+
+  for (size_t c = 0; c < numChunks; ++c) {
+    Chunk& chunk = chunks[c % 2];
+    {
+      unique_lock<mutex> lock(m);
+      if (!chunk.full && !failed) {
+        const double waitStart = omp_get_wtime();
+        changed.wait(lock, [&] { return chunk.full || failed; });
+        stats.waitTime += omp_get_wtime() - waitStart;
+      }
+      if (failed) {
+        break;
+      }
+    }
+    process(chunk.data);
+    stats.bytes += sizeof(Particle) * chunk.data.numDataPoints;
+    {
+      lock_guard<mutex> lock(m);
+      chunk.full = false;
+    }
+    changed.notify_all();
+  }
+  reader.join();
+  stats.seconds += omp_get_wtime() - start;
+  close(fd);
+  return !failed;
+}
@@ -0,0 +1,990 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include <omp.h>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+#include "util.h"
+
+#include "binning.h"
+#include "fast_sincos.h"
+
+using namespace std;
+
+Privatization privatization = Privatization::Auto;
+HistogramUpdate histogramUpdate = HistogramUpdate::Auto;
+SortScatter sortScatter = SortScatter::Auto;
+SumPrecision sumPrecision = SumPrecision::Double;
+bool compensatedSums = false;
+Classifier classifier = Classifier::Trig;
+int polarBandsPerBin = 32;
+
+void set_bin_grid(InputDataType& data, int nBinsX, int nBinsY, FTYPE maxMagnitudeR) {
+  data.nBinsX = nBinsX;
+  data.nBinsY = nBinsY;
+  data.maxMagnitudeR = maxMagnitudeR;
+  data.xMin = -maxMagnitudeR*FTYPE(1.000001);
+  data.xMax = +maxMagnitudeR*FTYPE(1.000001);
+  data.yMin = -maxMagnitudeR*FTYPE(1.000001);
+  data.yMax = +maxMagnitudeR*FTYPE(1.000001);
+  data.binsPerUnitX = (FTYPE)nBinsX/(data.xMax - data.xMin);
+  data.binsPerUnitY = (FTYPE)nBinsY/(data.yMax - data.yMin);
+}
+
+// Table of Classifier::Polar for one grid. To find the interval of phi
+// without a search, [0, 2π) is split in «cells» equal angular cells, a
+// few per interval so that most cells have at most one interval start.
+// Cell c of band b is cells[b*(nCells + 1) + c]: the bin at its start
+// angle and the start angle of the next interval if it starts within the
+// cell, or a huge angle. The bin of phi is then the bin of its cell, or
+// of the next cell if phi is past that limit: one load for the cell and
+// one for the bin. Each band has one more cell with the bin at 2π. Cells
+// where several intervals start, and the intervals whose sector spans
+// several bins, have bin -1: their particles are classified with Trig.
+struct PolarCell {
+  FTYPE limit;
+  int bin;
+};
+
+struct PolarTable {
+  int nBinsX = 0, nBinsY = 0;
+  FTYPE xMin = 0, yMin = 0, binsPerUnitX = 0, binsPerUnitY = 0;
+  int bandsPerBin = 0;
+  int nBands = 0;
+  int nCells = 0;
+  FTYPE bandsPerUnit = 0;
+  FTYPE cellsPerRadian = 0;
+  vector<PolarCell> cells;
+  PolarTableStats stats = {};
+};
+
+static PolarTable polarTable;
+const int polarCellsPerInterval = 8;
+// Distance to the grid lines, relative to the radius of the grid, below
+// which the particles are classified with Trig: a few units in the last
+// place of single precision coordinates
+const double polarGuardDistance = 4e-6;
+const FTYPE polarPadding = 1e30; // not infinity, which -ffast-math assumes away
+
+static const PolarTable& get_polar_table(const InputDataType& inputData) {
+  PolarTable& t = polarTable;
+  if (t.nBinsX == inputData.nBinsX && t.nBinsY == inputData.nBinsY && t.xMin == inputData.xMin && t.yMin == inputData.yMin
+      && t.binsPerUnitX == inputData.binsPerUnitX && t.binsPerUnitY == inputData.binsPerUnitY && t.bandsPerBin == polarBandsPerBin) {
+    return t;
+  }
+  t.nBinsX = inputData.nBinsX;
+  t.nBinsY = inputData.nBinsY;
+  t.xMin = inputData.xMin;
+  t.yMin = inputData.yMin;
+  t.binsPerUnitX = inputData.binsPerUnitX;
+  t.binsPerUnitY = inputData.binsPerUnitY;
+  t.bandsPerBin = polarBandsPerBin;
+
+  // The bins are computed in double, away from the edges the same as
+  // Trig. A point is away from the edges when the bin does not change if
+  // it is displaced by the guard distance in x and y: closer to the grid
+  // lines rounding decides the bin, and Trig has to be used.
+  const double xMin = t.xMin, yMin = t.yMin, unitsX = 1 / double(t.binsPerUnitX), unitsY = 1 / double(t.binsPerUnitY);
+  const double guard = polarGuardDistance * -xMin;
+  auto bin_at = [&](double rho, double theta) {
+    int bin = -2;
+    for (double dx : {-guard, guard}) {
+      for (double dy : {-guard, guard}) {
+        const int iX = int(floor((rho*cos(theta) + dx - xMin)*t.binsPerUnitX));
+        const int iY = int(floor((rho*sin(theta) + dy - yMin)*t.binsPerUnitY));
+        const int b = iX >= 0 && iX < t.nBinsX && iY >= 0 && iY < t.nBinsY ? iX*t.nBinsY + iY : -1;
+        bin = bin == -2 || bin == b ? b : -1;
+      }
+    }
+    return bin;
+  };
+  // Angles in [0, 2π) at which the circle of radius rho crosses the
+  // lines at the guard distance of a grid line
+  auto crossings = [&](double rho, vector<double>& angles) {
+    for (int k = 0; k <= t.nBinsX; k++) {
+      for (double d : {-guard, guard}) {
+        const double x = xMin + k*unitsX + d;
+        if (fabs(x) < rho) {
+          const double a = acos(x / rho);
+          angles.push_back(a);
+          angles.push_back(2*M_PI - a);
+        }
+      }
+    }
+    for (int k = 0; k <= t.nBinsY; k++) {
+      for (double d : {-guard, guard}) {
+        const double y = yMin + k*unitsY + d;
+        if (fabs(y) < rho) {
+          const double a = asin(y / rho);
+          angles.push_back(a < 0 ? a + 2*M_PI : a);
+          angles.push_back(M_PI - a);
+        }
+      }
+    }
+  };
+
+  // As many bands as asked for while the table, with the most intervals
+  // a band can have, fits in maxPolarTableBytes
+  const double maxR = -xMin;
+  const int maxIntervals = 8*(t.nBinsX + t.nBinsY + 2) + 1;
+  const double binWidth = min(unitsX, unitsY);
+  t.nBands = max(1, int(min(ceil(maxR / binWidth * t.bandsPerBin),
+                            double(maxPolarTableBytes / ((polarCellsPerInterval * maxIntervals + 1) * sizeof(PolarCell))))));
+  t.bandsPerUnit = FTYPE(t.nBands / maxR);
+  const double bandWidth = maxR / t.nBands;
+
+  vector<vector<pair<double, int>>> bands(t.nBands);
+  double ambiguousArea = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:ambiguousArea)
+  for (int b = 0; b < t.nBands; b++) {
+    const double r0 = b*bandWidth, r1 = (b + 1)*bandWidth;
+    vector<double> angles = {0.0};
+    crossings(r0, angles);
+    crossings(r1, angles);
+    sort(angles.begin(), angles.end());
+    angles.erase(unique(angles.begin(), angles.end()), angles.end());
+    angles.push_back(2*M_PI);
+    auto& intervals = bands[b];
+    for (size_t j = 0; j + 1 < angles.size(); j++) {
+      const double mid = (angles[j] + angles[j + 1]) / 2;
+      const int bin0 = bin_at(r0, mid);
+      // The radial segments between the two arcs are inside the (convex) bin
+      const int bin = bin0 == bin_at(r1, mid) ? bin0 : -1;
+      if (bin < 0) {
+        ambiguousArea += (angles[j + 1] - angles[j]) / 2 * (r1*r1 - r0*r0);
+      }
+      if (intervals.empty() || intervals.back().second != bin) {
+        intervals.push_back({angles[j], bin});
+      }
+    }
+  }
+
+  size_t nIntervals = 1;
+  for (const auto& intervals : bands) {
+    nIntervals = max(nIntervals, intervals.size());
+  }
+
+  // The cell of an angle is computed as in the lookup, so a limit in an
+  // earlier cell than phi is never greater than phi
+  t.nCells = polarCellsPerInterval * nIntervals;
+  t.cellsPerRadian = FTYPE(t.nCells / (2*M_PI));
+  auto cell_of = [&](FTYPE angle) { return min(int(angle*t.cellsPerRadian), t.nCells - 1); };
+  t.cells.assign(size_t(t.nBands) * (t.nCells + 1), {polarPadding, -1});
+  double overflowArea = 0;
+  for (int b = 0; b < t.nBands; b++) {
+    const auto& intervals = bands[b];
+    const int n = intervals.size();
+    PolarCell* cells = &t.cells[size_t(b) * (t.nCells + 1)];
+    int j = 0; // interval at the start of the cell
+    for (int c = 0; c < t.nCells; c++) {
+      while (j + 1 < n && cell_of(FTYPE(intervals[j + 1].first)) < c) {
+        ++j;
+      }
+      int inCell = 0;
+      while (j + inCell + 1 < n && cell_of(FTYPE(intervals[j + inCell + 1].first)) == c) {
+        ++inCell;
+      }
+      if (inCell > 1) {
+        const double r0 = b*bandWidth, r1 = (b + 1)*bandWidth;
+        overflowArea += M_PI / t.nCells * (r1*r1 - r0*r0);
+      } else {
+        cells[c] = {inCell == 1 ? FTYPE(intervals[j + 1].first) : polarPadding, intervals[j].second};
+      }
+    }
+    cells[t.nCells].bin = intervals[n - 1].second;
+  }
+
+  t.stats = {t.nBands, int(nIntervals), t.nCells, sizeof(PolarCell) * t.cells.size(),
+             ambiguousArea / (M_PI*maxR*maxR), overflowArea / (M_PI*maxR*maxR)};
+  return t;
+}
+
+PolarTableStats polar_table_stats(const InputDataType& inputData) {
+  return get_polar_table(inputData).stats;
+}
+
+// Computes in block_bins[i] the bin of the n particles from «start»
+// with «classify», in a vectorised loop that reads the coordinates as
+// laid out in Layout; with another function of (r, phi) and array type,
+// any other value of them. With AoSoA, «start» is a multiple of
+// particleBlockSize and whole blocks are classified, so block_bins
+// needs room for n rounded up to a multiple of particleBlockSize.
+template<ParticleLayout Layout, typename Classify, typename Bin>
+static inline void ClassifyBlock(const InputDataType& inputData, int start, int n, Bin* block_bins, Classify classify) {
+  if constexpr (Layout == ParticleLayout::AoS) {
+    const Particle* particles = &inputData.particles[start];
+#pragma omp simd
+    for (int i = 0; i < n; i++) {
+      block_bins[i] = classify(particles[i].r, particles[i].phi);
+    }
+  } else if constexpr (Layout == ParticleLayout::SoA) {
+    const FTYPE* r = &inputData.r[start];
+    const FTYPE* phi = &inputData.phi[start];
+#pragma omp simd
+    for (int i = 0; i < n; i++) {
+      block_bins[i] = classify(r[i], phi[i]);
+    }
+  } else {
+    const ParticleBlock* blocks = &inputData.blocks[start / particleBlockSize];
+    for (int b = 0; b * particleBlockSize < n; b++) {
+      Bin* bins = &block_bins[b * particleBlockSize];
+#pragma omp simd
+      for (int l = 0; l < particleBlockSize; l++) {
+        bins[l] = classify(blocks[b].r[l], blocks[b].phi[l]);
+      }
+    }
+  }
+}
+
+// Classification of the particles of a grid of NX × NY bins, or of the
+// size of the input grid if they are 0, with the classifier selected.
+// With the sizes known at compile time, the bin index uses constants.
+template<int NX, int NY>
+class GridClassifier {
+public:
+  explicit GridClassifier(const InputDataType& inputData)
+    : nBinsY(NY > 0 ? NY : inputData.nBinsY), xMin(inputData.xMin), yMin(inputData.yMin),
+      binsPerUnitX(inputData.binsPerUnitX), binsPerUnitY(inputData.binsPerUnitY) {
+    polar = classifier == Classifier::Polar ? &get_polar_table(inputData) : nullptr;
+    // With the bins too small for the table, all of it is Trig
+    if (polar != nullptr && polar->stats.ambiguousArea + polar->stats.overflowArea > 0.999) {
+      polar = nullptr;
+    }
+  }
+
+  // Computes in block_bins[i] the bin of the n particles from «start»,
+  // as ClassifyBlock; near_lines is scratch space of as many elements
+  template<ParticleLayout Layout>
+  void classify(const InputDataType& inputData, int start, int n, int* block_bins, int* near_lines) const {
+    const int nBinsY = this->nBinsY;
+    const FTYPE xMin = this->xMin, yMin = this->yMin;
+    const FTYPE binsPerUnitX = this->binsPerUnitX, binsPerUnitY = this->binsPerUnitY;
+    auto trig = [=](FTYPE r, FTYPE phi) {
+      // Transforming from cylindrical to Cartesian coordinates:
+      FTYPE sinPhi, cosPhi;
+      fast_sincos(phi, sinPhi, cosPhi);
+      const FTYPE x = r*cosPhi;
+      const FTYPE y = r*sinPhi;
+
+      // Calculating the bin numbers for these coordinates:
+      const int iX = int((x - xMin)*binsPerUnitX);
+      const int iY = int((y - yMin)*binsPerUnitY);
+      return iX*nBinsY + iY;
+    };
+    if (polar == nullptr) {
+      ClassifyBlock<Layout>(inputData, start, n, block_bins, trig);
+      return;
+    }
+    const PolarCell* polarCells = polar->cells.data();
+    const int nBands = polar->nBands;
+    const int nCells = polar->nCells;
+    const FTYPE bandsPerUnit = polar->bandsPerUnit;
+    const FTYPE cellsPerRadian = polar->cellsPerRadian;
+    ClassifyBlock<Layout>(inputData, start, n, block_bins, [=](FTYPE r, FTYPE phi) {
+      const int band = min(max(int(r*bandsPerUnit), 0), nBands - 1);
+      const int cell = band*(nCells + 1) + min(max(int(phi*cellsPerRadian), 0), nCells - 1);
+      const int bin = polarCells[cell + (polarCells[cell].limit <= phi ? 1 : 0)].bin;
+      // The table covers phi in [0, 2π) and r up to the radius of the grid:
+      // outside them the clamped cell is not that of the particle, use Trig
+      return phi >= 0 && phi < FTYPE(2*M_PI) && r >= 0 && r*bandsPerUnit < nBands ? bin : -1;
+    });
+    // Particles near grid lines: their indices are gathered without
+    // branches and then classified with Trig in a vectorised loop
+    int nearLines = 0;
+    for (int i = 0; i < n; i++) {
+      near_lines[nearLines] = i;
+      nearLines += block_bins[i] < 0 ? 1 : 0;
+    }
+#pragma omp simd
+    for (int k = 0; k < nearLines; k++) {
+      FTYPE r, phi;
+      load_particle<Layout>(inputData, start + near_lines[k], r, phi);
+      block_bins[near_lines[k]] = trig(r, phi);
+    }
+  }
+
+private:
+  int nBinsY;
+  FTYPE xMin, yMin, binsPerUnitX, binsPerUnitY;
+  const PolarTable* polar;
+};
+
+// Kernel for grids of NX × NY bins, or of the size of the input grid
+// if they are 0, and particles in Layout. With the sizes known at
+// compile time, the bin index and the loops over the bins use constants.
+template<int NX, int NY, ParticleLayout Layout>
+static void BinParticlesGrid(const InputDataType& inputData, BinsType& outputBins) {
+  const int nBinsX = NX > 0 ? NX : inputData.nBinsX;
+  const int nBinsY = NY > 0 ? NY : inputData.nBinsY;
+  const int nBins = nBinsX * nBinsY;
+
+  // Copies of the bins aligned and padded to whole cache lines, so that
+  // copies used by different threads never share a line
+  const size_t copyStride = (size_t(nBins) + 15) / 16 * 16;
+  const int nThreads = omp_get_max_threads();
+  const int maxCopies = max(size_t(1), maxPrivateBinsBytes / (sizeof(int) * copyStride));
+  Privatization mode = privatization;
+  if (mode == Privatization::Auto) {
+    mode = nThreads <= maxCopies ? Privatization::PerThread : Privatization::Sharded;
+  }
+  const int nCopies = mode == Privatization::PerThread ? nThreads : min(nThreads, maxCopies);
+  unique_ptr<int[], decltype(&free)> copies((int*) aligned_alloc(64, sizeof(int) * copyStride * nCopies), &free);
+  const GridClassifier<NX, NY> grid(inputData);
+
+  const bool useLanes = histogramUpdate == HistogramUpdate::Lanes
+    || (histogramUpdate == HistogramUpdate::Auto && sizeof(int) * nBins * histogramLanes <= maxLaneBinsBytes);
+
+#pragma omp parallel num_threads(nThreads)
+  {
+    const int t = omp_get_thread_num();
+    int* counts = &copies[(t % nCopies) * copyStride];
+    // Each copy is zeroed by the first thread that uses it (first touch).
+    // The team may have fewer than nThreads threads (OMP_DYNAMIC, a thread
+    // limit, nested parallelism), so its threads zero every copy between them
+    for (int c = t; c < nCopies; c += omp_get_num_threads()) {
+      for (int b = 0; b < nBins; b++) {
+        copies[c * copyStride + b] = 0;
+      }
+    }
+#pragma omp barrier
+
+    // Loop through all particle coordinates in blocks: the bins of a whole
+    // block are computed first in a vectorised loop and then counted
+    int block_bins[binningBlockSize];
+    int near_lines[binningBlockSize];
+    // Sub-histograms of the lanes, interleaved: bin b of lane l is laneBins[b*histogramLanes + l]
+    vector<int> laneBins(useLanes ? nBins * histogramLanes : 0, 0);
+#pragma omp for schedule(static)
+    for (int start = 0; start < inputData.numDataPoints; start += binningBlockSize) {
+      const int n = min(binningBlockSize, inputData.numDataPoints - start);
+      grid.template classify<Layout>(inputData, start, n, block_bins, near_lines);
+
+      // Incrementing the appropriate bins in the counter
+      if (useLanes) {
+        int* lanes = laneBins.data();
+        int i = 0;
+        for (; i + histogramLanes <= n; i += histogramLanes) {
+#pragma omp simd
+          for (int l = 0; l < histogramLanes; l++) {
+            ++lanes[block_bins[i + l]*histogramLanes + l];
+          }
+        }
+        for (; i < n; i++) {
+          ++lanes[block_bins[i]*histogramLanes + i % histogramLanes];
+        }
+      } else if (mode == Privatization::PerThread) {
+        for (int i = 0; i < n; i++) {
+          ++counts[block_bins[i]];
+        }
+      } else {
+        for (int i = 0; i < n; i++) {
+#pragma omp atomic
+          ++counts[block_bins[i]];
+        }
+      }
+    }
+
+    if (useLanes) {
+      for (int b = 0; b < nBins; b++) {
+        int sum = 0;
+        for (int l = 0; l < histogramLanes; l++) {
+          sum += laneBins[b*histogramLanes + l];
+        }
+        if (mode == Privatization::PerThread) {
+          counts[b] += sum;
+        } else {
+#pragma omp atomic
+          counts[b] += sum;
+        }
+      }
+#pragma omp barrier
+    }
+
+    // Parallel reduction: each thread adds up a range of bins over all copies
+    int* output = &outputBins[0][0];
+#pragma omp for schedule(static)
+    for (int b = 0; b < nBins; b++) {
+      int sum = 0;
+      for (int c = 0; c < nCopies; c++) {
+        sum += copies[c * copyStride + b];
+      }
+      output[b] += sum;
+    }
+  }
+}
+
+// Copies the aligned cache line «from» to the aligned line «to» with a
+// non-temporal store where there is one: the line goes to memory without
+// being read into the cache first, as it would for a regular store
+static inline void stream_line(void* to, const void* from) {
+#if defined(__AVX512F__)
+  _mm512_stream_si512((__m512i*) to, _mm512_load_si512(from));
+#elif defined(__AVX__)
+  _mm256_stream_si256((__m256i*) to, _mm256_load_si256((const __m256i*) from));
+  _mm256_stream_si256((__m256i*) to + 1, _mm256_load_si256((const __m256i*) from + 1));
+#else
+  memcpy(to, from, 64);
+#endif
+}
+
+// Orders the non-temporal stores before the stores that follow
+static inline void stream_fence() {
+#if defined(__AVX__)
+  _mm_sfence();
+#endif
+}
+
+// Sort of the particles of a grid of NX × NY bins, or of the size of the
+// input grid if they are 0, in Layout, into elements of the kind of Output
+template<int NX, int NY, ParticleLayout Layout, SortOutput Output>
+static void SortParticlesGrid(const InputDataType& inputData, BinsType& outputBins, SortedParticles& sorted) {
+  using Element = conditional_t<Output == SortOutput::Indices, int, Particle>;
+  const int nBinsX = NX > 0 ? NX : inputData.nBinsX;
+  const int nBinsY = NY > 0 ? NY : inputData.nBinsY;
+  const int nBins = nBinsX * nBinsY;
+  const size_t countStride = (size_t(nBins) + 15) / 16 * 16;
+  const int nThreads = omp_get_max_threads();
+  // Counts of each thread, and then its offset in each bin
+  unique_ptr<int[], decltype(&free)> threadCounts((int*) aligned_alloc(64, sizeof(int) * countStride * nThreads), &free);
+  const GridClassifier<NX, NY> grid(inputData);
+
+  // The output keeps its allocation from one call to the next, so that
+  // only the first one pays for the page faults
+  const size_t elementBytes = (sizeof(Element) * inputData.numDataPoints + 63) / 64 * 64;
+  auto [buffer, bufferBytes] = [&]() {
+    if constexpr (Output == SortOutput::Indices) {
+      return tie(sorted.indices, sorted.indicesBytes);
+    } else {
+      return tie(sorted.particles, sorted.particlesBytes);
+    }
+  }();
+  if (buffer == nullptr || bufferBytes < elementBytes) {
+    buffer.reset((Element*) aligned_alloc(64, elementBytes));
+    bufferBytes = elementBytes;
+  }
+  Element* out = buffer.get();
+  sorted.binStart.resize(nBins + 1);
+  int* binStart = sorted.binStart.data();
+  binStart[0] = 0;
+
+  const int perLine = 64 / sizeof(Element);
+  const bool buffered = sortScatter == SortScatter::Buffered
+    || (sortScatter == SortScatter::Auto && size_t(64) * nBins <= maxScatterBufferBytes);
+
+#pragma omp parallel num_threads(nThreads)
+  {
+    const int t = omp_get_thread_num();
+    int* counts = &threadCounts[t * countStride];
+    // The team may have fewer than nThreads threads (OMP_DYNAMIC, a thread
+    // limit, nested parallelism): the rows of the missing ones are zeroed
+    // too, since the offsets are computed over all the rows
+    for (int c = t; c < nThreads; c += omp_get_num_threads()) {
+      for (int b = 0; b < nBins; b++) {
+        threadCounts[c * countStride + b] = 0;
+      }
+    }
+    int block_bins[binningBlockSize];
+    int near_lines[binningBlockSize];
+
+    // First pass: each thread counts the bins of its particles. Both
+    // passes split the blocks among the threads with the same static
+    // schedule, so each thread sees the same particles in both.
+#pragma omp for schedule(static)
+    for (int start = 0; start < inputData.numDataPoints; start += binningBlockSize) {
+      const int n = min(binningBlockSize, inputData.numDataPoints - start);
+      grid.template classify<Layout>(inputData, start, n, block_bins, near_lines);
+      for (int i = 0; i < n; i++) {
+        ++counts[block_bins[i]];
+      }
+    }
+
+    // Size of each bin, then its range by a prefix sum over the bins,
+    // then the offset of each thread in it: the threads come in order of
+    // their particles, so the sort is stable
+    int* output = &outputBins[0][0];
+#pragma omp for schedule(static)
+    for (int b = 0; b < nBins; b++) {
+      int sum = 0;
+      for (int c = 0; c < nThreads; c++) {
+        sum += threadCounts[c * countStride + b];
+      }
+      binStart[b + 1] = sum;
+      output[b] += sum;
+    }
+#pragma omp single
+    for (int b = 0; b < nBins; b++) {
+      binStart[b + 1] += binStart[b];
+    }
+#pragma omp for schedule(static)
+    for (int b = 0; b < nBins; b++) {
+      int offset = binStart[b];
+      for (int c = 0; c < nThreads; c++) {
+        const int count = threadCounts[c * countStride + b];
+        threadCounts[c * countStride + b] = offset;
+        offset += count;
+      }
+    }
+
+    // Second pass: each thread writes its particles from its offsets
+    auto element = [&](int i) {
+      if constexpr (Output == SortOutput::Indices) {
+        return i;
+      } else {
+        Particle p;
+        load_particle<Layout>(inputData, i, p.r, p.phi);
+        return p;
+      }
+    };
+    if (buffered) {
+      // Element k of the output goes to slot k % perLine of the buffer of
+      // its bin, so a full buffer is an aligned line of the output. The
+      // first and the last line of a bin may be shared with other bins or
+      // threads, and only the thread's own elements are copied from them.
+      unique_ptr<Element[], decltype(&free)> lines((Element*) aligned_alloc(64, size_t(64) * nBins), &free);
+      vector<int> first(counts, counts + nBins);
+      auto flush = [&](int b, int from, int end) {
+        memcpy(&out[from], &lines[b * perLine + from % perLine], sizeof(Element) * (end - from));
+      };
+#pragma omp for schedule(static)
+      for (int start = 0; start < inputData.numDataPoints; start += binningBlockSize) {
+        const int n = min(binningBlockSize, inputData.numDataPoints - start);
+        grid.template classify<Layout>(inputData, start, n, block_bins, near_lines);
+        for (int i = 0; i < n; i++) {
+          const int b = block_bins[i];
+          const int k = counts[b]++;
+          lines[b * perLine + k % perLine] = element(start + i);
+          if ((k + 1) % perLine == 0) {
+            const int lineStart = k + 1 - perLine;
+            if (lineStart >= first[b]) {
+              stream_line(&out[lineStart], &lines[b * perLine]);
+            } else {
+              flush(b, first[b], k + 1);
+            }
+          }
+        }
+      }
+      stream_fence();
+      for (int b = 0; b < nBins; b++) {
+        const int end = counts[b];
+        if (end % perLine != 0) {
+          flush(b, max(end - end % perLine, first[b]), end);
+        }
+      }
+    } else {
+#pragma omp for schedule(static)
+      for (int start = 0; start < inputData.numDataPoints; start += binningBlockSize) {
+        const int n = min(binningBlockSize, inputData.numDataPoints - start);
+        grid.template classify<Layout>(inputData, start, n, block_bins, near_lines);
+        for (int i = 0; i < n; i++) {
+          out[counts[block_bins[i]]++] = element(start + i);
+        }
+      }
+    }
+  }
+}
+
+// Accumulators of a bin in BinParticlesWeighted, in one cache line: its
+// count, and the sums of its quantities followed, when they are
+// compensated, by their compensations
+template<typename T>
+struct alignas(64) BinLine {
+  static constexpr int nValues = (64 - sizeof(T)) / sizeof(T);
+  int count;
+  T values[nValues];
+};
+static_assert(sizeof(BinLine<float>) == 64 && sizeof(BinLine<double>) == 64);
+
+// Hides v from the optimiser, so that -ffast-math cannot reassociate
+// the operations of a compensated sum and lose its compensation
+template<typename T>
+static inline T opaque(T v) {
+#if defined(__x86_64__) || defined(__i386__)
+  asm("" : "+x"(v));
+#elif defined(__aarch64__)
+  asm("" : "+w"(v));
+#else
+  volatile T w = v;
+  v = w;
+#endif
+  return v;
+}
+
+// Computes in values[i] quantity q of the n particles from «start»
+template<ParticleLayout Layout>
+static inline void QuantityBlock(const InputDataType& inputData, int start, int n, Quantity q, FTYPE* values) {
+  switch (q) {
+  case Quantity::R:
+    ClassifyBlock<Layout>(inputData, start, n, values, [](FTYPE r, FTYPE) { return r; });
+    break;
+  case Quantity::R2:
+    ClassifyBlock<Layout>(inputData, start, n, values, [](FTYPE r, FTYPE) { return r*r; });
+    break;
+  case Quantity::X:
+    ClassifyBlock<Layout>(inputData, start, n, values, [](FTYPE r, FTYPE phi) {
+      FTYPE sinPhi, cosPhi;
+      fast_sincos(phi, sinPhi, cosPhi);
+      return r*cosPhi;
+    });
+    break;
+  case Quantity::Y:
+    ClassifyBlock<Layout>(inputData, start, n, values, [](FTYPE r, FTYPE phi) {
+      FTYPE sinPhi, cosPhi;
+      fast_sincos(phi, sinPhi, cosPhi);
+      return r*sinPhi;
+    });
+    break;
+  case Quantity::Phi:
+    ClassifyBlock<Layout>(inputData, start, n, values, [](FTYPE, FTYPE phi) { return phi; });
+    break;
+  }
+}
+
+// Weighted kernel for grids of NX × NY bins, or of the size of the input
+// grid if they are 0, particles in Layout and sums in T, compensated or
+// not
+template<int NX, int NY, ParticleLayout Layout, typename T, bool Compensated>
+static void BinParticlesWeightedGrid(const InputDataType& inputData, BinsType& outputBins, BinSumsType& outputSums) {
+  const int nBinsX = NX > 0 ? NX : inputData.nBinsX;
+  const int nBinsY = NY > 0 ? NY : inputData.nBinsY;
+  const int nBins = nBinsX * nBinsY;
+  const vector<Quantity>& quantities = outputSums.quantities;
+  const int nQuantities = quantities.size();
+  const int nThreads = omp_get_max_threads();
+  unique_ptr<BinLine<T>[], decltype(&free)> copies((BinLine<T>*) aligned_alloc(64, sizeof(BinLine<T>) * nBins * nThreads), &free);
+  const GridClassifier<NX, NY> grid(inputData);
+
+#pragma omp parallel num_threads(nThreads)
+  {
+    const int t = omp_get_thread_num();
+    BinLine<T>* lines = &copies[size_t(t) * nBins];
+    // The team may have fewer than nThreads threads (OMP_DYNAMIC, a thread
+    // limit, nested parallelism): the copies of the missing ones are
+    // zeroed too, since the reduction adds up all of them
+    for (int c = t; c < nThreads; c += omp_get_num_threads()) {
+      for (int b = 0; b < nBins; b++) {
+        copies[size_t(c) * nBins + b] = {};
+      }
+    }
+
+    int block_bins[binningBlockSize];
+    int near_lines[binningBlockSize];
+    // Quantity q of particle i of the block is block_values[q*binningBlockSize + i]
+    vector<FTYPE> block_values(nQuantities * binningBlockSize);
+#pragma omp for schedule(static)
+    for (int start = 0; start < inputData.numDataPoints; start += binningBlockSize) {
+      const int n = min(binningBlockSize, inputData.numDataPoints - start);
+      grid.template classify<Layout>(inputData, start, n, block_bins, near_lines);
+      for (int q = 0; q < nQuantities; q++) {
+        QuantityBlock<Layout>(inputData, start, n, quantities[q], &block_values[q * binningBlockSize]);
+      }
+      for (int i = 0; i < n; i++) {
+        BinLine<T>& line = lines[block_bins[i]];
+        ++line.count;
+        for (int q = 0; q < nQuantities; q++) {
+          const T value = block_values[q * binningBlockSize + i];
+          if constexpr (Compensated) {
+            T& sum = line.values[q];
+            T& compensation = line.values[nQuantities + q];
+            const T y = opaque(value - compensation);
+            const T s = opaque(sum + y);
+            compensation = opaque(s - sum) - y;
+            sum = s;
+          } else {
+            line.values[q] += value;
+          }
+        }
+      }
+    }
+
+    // Parallel reduction of the copies, in double precision
+    int* output = &outputBins[0][0];
+    double* outputSum = outputSums.sums.data();
+#pragma omp for schedule(static)
+    for (int b = 0; b < nBins; b++) {
+      for (int c = 0; c < nThreads; c++) {
+        const BinLine<T>& line = copies[size_t(c) * nBins + b];
+        output[b] += line.count;
+        for (int q = 0; q < nQuantities; q++) {
+          outputSum[size_t(b) * nQuantities + q] += double(line.values[q]) - (Compensated ? double(line.values[nQuantities + q]) : 0.0);
+        }
+      }
+    }
+  }
+}
+
+// Bins the particles in Layout into each grid of «grids» with the
+// transform to Cartesian coordinates shared: for each block, x and y
+// are computed once and then the bins of each grid, in vectorised loops,
+// counted by each thread in its own copy of the grid
+template<ParticleLayout Layout>
+static void BinParticlesShared(const InputDataType& inputData, const vector<BinsType*>& grids) {
+  struct Grid {
+    int nBinsY;
+    size_t offset;    // of the bins of the grid in a copy
+    FTYPE xMin, yMin, binsPerUnitX, binsPerUnitY;
+  };
+  vector<Grid> params;
+  size_t copyStride = 0;
+  for (const BinsType* g : grids) {
+    InputDataType grid = inputData;
+    set_bin_grid(grid, g->nBinsX, g->nBinsY, inputData.maxMagnitudeR);
+    params.push_back({g->nBinsY, copyStride, grid.xMin, grid.yMin, grid.binsPerUnitX, grid.binsPerUnitY});
+    // Whole cache lines for each grid
+    copyStride += (size_t(g->nBinsX) * g->nBinsY + 15) / 16 * 16;
+  }
+  const int nThreads = omp_get_max_threads();
+  unique_ptr<int[], decltype(&free)> copies((int*) aligned_alloc(64, sizeof(int) * copyStride * nThreads), &free);
+
+#pragma omp parallel num_threads(nThreads)
+  {
+    const int t = omp_get_thread_num();
+    int* counts = &copies[t * copyStride];
+    // The team may have fewer than nThreads threads (OMP_DYNAMIC, a thread
+    // limit, nested parallelism): the copies of the missing ones are
+    // zeroed too, since the reduction adds up all of them
+    for (int c = t; c < nThreads; c += omp_get_num_threads()) {
+      for (size_t b = 0; b < copyStride; b++) {
+        copies[c * copyStride + b] = 0;
+      }
+    }
+
+    FTYPE block_r[binningBlockSize];
+    FTYPE block_cos[binningBlockSize];
+    FTYPE block_sin[binningBlockSize];
+    int block_bins[binningBlockSize];
+#pragma omp for schedule(static)
+    for (int start = 0; start < inputData.numDataPoints; start += binningBlockSize) {
+      const int n = min(binningBlockSize, inputData.numDataPoints - start);
+      // The sine and cosine of the angle, the costly part of the
+      // transform to Cartesian coordinates:
+      auto transform = [&](int i, FTYPE r, FTYPE phi) {
+        block_r[i] = r;
+        fast_sincos(phi, block_sin[i], block_cos[i]);
+      };
+      if constexpr (Layout == ParticleLayout::AoSoA) {
+        const ParticleBlock* blocks = &inputData.blocks[start / particleBlockSize];
+        for (int b = 0; b * particleBlockSize < n; b++) {
+#pragma omp simd
+          for (int l = 0; l < particleBlockSize; l++) {
+            transform(b * particleBlockSize + l, blocks[b].r[l], blocks[b].phi[l]);
+          }
+        }
+      } else {
+#pragma omp simd
+        for (int i = 0; i < n; i++) {
+          FTYPE r, phi;
+          load_particle<Layout>(inputData, start + i, r, phi);
+          transform(i, r, phi);
+        }
+      }
+      for (const Grid& g : params) {
+        const int nBinsY = g.nBinsY;
+        const FTYPE xMin = g.xMin, yMin = g.yMin;
+        const FTYPE binsPerUnitX = g.binsPerUnitX;
+        const FTYPE binsPerUnitY = g.binsPerUnitY;
+        // The bin with the same expression as the Trig classifier of
+        // BinParticles, so that a grid binned here gets the same bins
+#pragma omp simd
+        for (int i = 0; i < n; i++) {
+          const FTYPE x = block_r[i]*block_cos[i];
+          const FTYPE y = block_r[i]*block_sin[i];
+          const int iX = int((x - xMin)*binsPerUnitX);
+          const int iY = int((y - yMin)*binsPerUnitY);
+          block_bins[i] = iX*nBinsY + iY;
+        }
+        int* gridCounts = &counts[g.offset];
+        for (int i = 0; i < n; i++) {
+          ++gridCounts[block_bins[i]];
+        }
+      }
+    }
+
+    // Parallel reduction: each thread adds up a range of bins over all copies
+    for (size_t k = 0; k < grids.size(); k++) {
+      int* output = grids[k]->counts.data();
+      const int nBins = grids[k]->counts.size();
+#pragma omp for schedule(static)
+      for (int b = 0; b < nBins; b++) {
+        int sum = 0;
+        for (int c = 0; c < nThreads; c++) {
+          sum += copies[c * copyStride + params[k].offset + b];
+        }
+        output[b] += sum;
+      }
+    }
+  }
+}
+
+// Adds to each bin of «coarse» the bins of «fine» that make it up
+static void AggregateBins(const BinsType& fine, BinsType& coarse) {
+  const int fx = fine.nBinsX / coarse.nBinsX;
+  const int fy = fine.nBinsY / coarse.nBinsY;
+#pragma omp parallel for schedule(static)
+  for (int iX = 0; iX < coarse.nBinsX; iX++) {
+    int* row = coarse[iX];
+    for (int jX = iX * fx; jX < (iX + 1) * fx; jX++) {
+      const int* fineRow = fine[jX];
+      for (int iY = 0; iY < coarse.nBinsY; iY++) {
+        int sum = 0;
+        for (int jY = iY * fy; jY < (iY + 1) * fy; jY++) {
+          sum += fineRow[jY];
+        }
+        row[iY] += sum;
+      }
+    }
+  }
+}
+
+template<ParticleLayout Layout>
+static void ClassifyParticlesLayout(const InputDataType& inputData, int* bins) {
+  const GridClassifier<0, 0> grid(inputData);
+#pragma omp parallel
+  {
+    int block_bins[binningBlockSize];
+    int near_lines[binningBlockSize];
+#pragma omp for schedule(static)
+    for (int start = 0; start < inputData.numDataPoints; start += binningBlockSize) {
+      const int n = min(binningBlockSize, inputData.numDataPoints - start);
+      grid.template classify<Layout>(inputData, start, n, block_bins, near_lines);
+      copy(block_bins, block_bins + n, &bins[start]);
+    }
+  }
+}
+
+// Runs kernel.template operator()<NX, NY, Layout>() for the grid and the
+// layout of inputData: 10×10, 64×64, 256×256 and 1024×1024 grids with
+// their sizes known at compile time, the rest with NX = NY = 0 and the
+// sizes read at run time
+template<ParticleLayout Layout, typename Kernel>
+static void DispatchGrid(const InputDataType& inputData, Kernel kernel) {
+  const int nBinsX = inputData.nBinsX;
+  const int nBinsY = inputData.nBinsY;
+  if (nBinsX == 10 && nBinsY == 10) {
+    kernel.template operator()<10, 10, Layout>();
+  } else if (nBinsX == 64 && nBinsY == 64) {
+    kernel.template operator()<64, 64, Layout>();
+  } else if (nBinsX == 256 && nBinsY == 256) {
+    kernel.template operator()<256, 256, Layout>();
+  } else if (nBinsX == 1024 && nBinsY == 1024) {
+    kernel.template operator()<1024, 1024, Layout>();
+  } else {
+    kernel.template operator()<0, 0, Layout>();
+  }
+}
+
+template<typename Kernel>
+static void Dispatch(const InputDataType& inputData, Kernel kernel) {
+  switch (inputData.layout) {
+  case ParticleLayout::AoS:
+    DispatchGrid<ParticleLayout::AoS>(inputData, kernel);
+    break;
+  case ParticleLayout::SoA:
+    DispatchGrid<ParticleLayout::SoA>(inputData, kernel);
+    break;
+  case ParticleLayout::AoSoA:
+    DispatchGrid<ParticleLayout::AoSoA>(inputData, kernel);
+    break;
+  }
+}
+
+void BinParticles(const InputDataType& inputData, BinsType& outputBins) {
+  Dispatch(inputData, [&]<int NX, int NY, ParticleLayout Layout>() {
+    BinParticlesGrid<NX, NY, Layout>(inputData, outputBins);
+  });
+}
+
+void SortParticlesByBin(const InputDataType& inputData, SortOutput output, BinsType& outputBins, SortedParticles& sorted) {
+  Dispatch(inputData, [&]<int NX, int NY, ParticleLayout Layout>() {
+    if (output == SortOutput::Indices) {
+      SortParticlesGrid<NX, NY, Layout, SortOutput::Indices>(inputData, outputBins, sorted);
+    } else {
+      SortParticlesGrid<NX, NY, Layout, SortOutput::Particles>(inputData, outputBins, sorted);
+    }
+  });
+}
+
+void BinParticlesWeighted(const InputDataType& inputData, BinsType& outputBins, BinSumsType& outputSums) {
+  Dispatch(inputData, [&]<int NX, int NY, ParticleLayout Layout>() {
+    if (sumPrecision == SumPrecision::Float) {
+      if (compensatedSums) {
+        BinParticlesWeightedGrid<NX, NY, Layout, float, true>(inputData, outputBins, outputSums);
+      } else {
+        BinParticlesWeightedGrid<NX, NY, Layout, float, false>(inputData, outputBins, outputSums);
+      }
+    } else {
+      if (compensatedSums) {
+        BinParticlesWeightedGrid<NX, NY, Layout, double, true>(inputData, outputBins, outputSums);
+      } else {
+        BinParticlesWeightedGrid<NX, NY, Layout, double, false>(inputData, outputBins, outputSums);
+      }
+    }
+  });
+}
+
+void BinParticlesMulti(const InputDataType& inputData, vector<BinsType>& outputs) {
+  // Finest grids first. Each grid is derived from the coarsest of the
+  // finer grids in which it is nested, with the fewest bins to add up,
+  // or binned if there is none.
+  vector<int> order(outputs.size());
+  iota(order.begin(), order.end(), 0);
+  stable_sort(order.begin(), order.end(), [&](int a, int b) { return outputs[a].counts.size() > outputs[b].counts.size(); });
+  vector<int> parent(outputs.size(), -1);
+  vector<BinsType*> binned;
+  for (size_t k = 0; k < order.size(); k++) {
+    const BinsType& g = outputs[order[k]];
+    for (size_t j = 0; j < k; j++) {
+      const BinsType& f = outputs[order[j]];
+      if (f.counts.size() > g.counts.size() && f.nBinsX % g.nBinsX == 0 && f.nBinsY % g.nBinsY == 0) {
+        parent[order[k]] = order[j];
+      }
+    }
+    if (parent[order[k]] < 0) {
+      binned.push_back(&outputs[order[k]]);
+    }
+  }
+
+  if (binned.size() == 1) {
+    // A single grid to bin: the kernel of BinParticles
+    InputDataType grid = inputData;
+    set_bin_grid(grid, binned[0]->nBinsX, binned[0]->nBinsY, inputData.maxMagnitudeR);
+    BinParticles(grid, *binned[0]);
+  } else {
+    switch (inputData.layout) {
+    case ParticleLayout::AoS:
+      BinParticlesShared<ParticleLayout::AoS>(inputData, binned);
+      break;
+    case ParticleLayout::SoA:
+      BinParticlesShared<ParticleLayout::SoA>(inputData, binned);
+      break;
+    case ParticleLayout::AoSoA:
+      BinParticlesShared<ParticleLayout::AoSoA>(inputData, binned);
+      break;
+    }
+  }
+  for (int k : order) {
+    if (parent[k] >= 0) {
+      AggregateBins(outputs[parent[k]], outputs[k]);
+    }
+  }
+}
+
+void ClassifyParticles(const InputDataType& inputData, int* bins) {
+  switch (inputData.layout) {
+  case ParticleLayout::AoS:
+    ClassifyParticlesLayout<ParticleLayout::AoS>(inputData, bins);
+    break;
+  case ParticleLayout::SoA:
+    ClassifyParticlesLayout<ParticleLayout::SoA>(inputData, bins);
+    break;
+  case ParticleLayout::AoSoA:
+    ClassifyParticlesLayout<ParticleLayout::AoSoA>(inputData, bins);
+    break;
+  }
+}
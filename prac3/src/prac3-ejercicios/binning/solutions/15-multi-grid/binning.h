@@ -0,0 +1,312 @@
+#ifndef _BINNING_H_
+#define _BINNING_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#ifdef DOUBLE_PRECISION
+#define FTYPE double
+#define SIN sin
+#define COS cos
+#else
+#define FTYPE float
+#define SIN sinf
+#define COS cosf
+#endif
+
+struct Particle { 
+  FTYPE r;
+  FTYPE phi;
+};
+
+// How the cylindrical coordinates of the particles are laid out:
+//  - AoS: an array of Particle {r, phi} (particles).
+//  - SoA: separate arrays of r and of phi (r, phi), so that a vector of
+//    either coordinate is a contiguous load.
+//  - AoSoA: an array of ParticleBlock (blocks), each with the r and the
+//    phi of particleBlockSize consecutive particles, one cache line of
+//    each; the last block is padded with zeros.
+enum class ParticleLayout : uint32_t { AoS, SoA, AoSoA };
+const int particleBlockSize = 64 / sizeof(FTYPE);
+struct ParticleBlock {
+  FTYPE r[particleBlockSize];
+  FTYPE phi[particleBlockSize];
+};
+
+// Input data arrives as numDataPoints cylindrical coordinates of
+// particles, r and phi, in one of the layouts above; only the pointers
+// of that layout are used. It also carries the bin grid, set with
+// set_bin_grid: nBinsX × nBinsY bins covering [xMin, xMax) × [yMin, yMax)
+struct InputDataType {
+  int numDataPoints;
+  ParticleLayout layout = ParticleLayout::AoS;
+  Particle* particles = nullptr;
+  FTYPE* r = nullptr;
+  FTYPE* phi = nullptr;
+  ParticleBlock* blocks = nullptr;
+  int nBinsX;
+  int nBinsY;
+  // We assume that the radial coordinate does not exceed this value
+  FTYPE maxMagnitudeR;
+  // Boundaries of bins:
+  FTYPE xMin, xMax, yMin, yMax;
+  // Reciprocal of widths of bins:
+  FTYPE binsPerUnitX, binsPerUnitY;
+};
+
+// Default grid, the one of the previous steps
+const int defaultBinsX = 10;
+const int defaultBinsY = 10;
+const FTYPE defaultMaxMagnitudeR = 5.0;
+
+// Sets a grid of nBinsX × nBinsY bins covering the disc of radius
+// maxMagnitudeR. Defined in binning.cpp, not inline: with -ffast-math
+// each translation unit may round binsPerUnitX and binsPerUnitY
+// differently, and a grid set in main.cpp must get the bins of the same
+// grid set in binning.cpp
+void set_bin_grid(InputDataType& data, int nBinsX, int nBinsY, FTYPE maxMagnitudeR);
+
+// Bytes of numDataPoints particles in «layout», rounded up to whole
+// cache lines (and blocks for AoSoA)
+inline size_t particle_bytes(ParticleLayout layout, size_t numDataPoints) {
+  if (layout == ParticleLayout::AoSoA) {
+    return (numDataPoints + particleBlockSize - 1) / particleBlockSize * sizeof(ParticleBlock);
+  }
+  const size_t lines = (sizeof(FTYPE) * numDataPoints + 63) / 64;
+  return 2 * 64 * lines;
+}
+
+// Points the arrays of «layout» for numDataPoints particles into
+// «buffer», of particle_bytes(layout, numDataPoints) bytes
+inline void set_particle_arrays(InputDataType& data, ParticleLayout layout, size_t numDataPoints, void* buffer) {
+  data.numDataPoints = numDataPoints;
+  data.layout = layout;
+  data.particles = layout == ParticleLayout::AoS ? (Particle*) buffer : nullptr;
+  data.r = layout == ParticleLayout::SoA ? (FTYPE*) buffer : nullptr;
+  data.phi = layout == ParticleLayout::SoA ? (FTYPE*) buffer + (sizeof(FTYPE) * numDataPoints + 63) / 64 * 64 / sizeof(FTYPE) : nullptr;
+  data.blocks = layout == ParticleLayout::AoSoA ? (ParticleBlock*) buffer : nullptr;
+}
+
+// Buffer of the arrays, whatever the layout
+inline void* particle_buffer(const InputDataType& data) {
+  switch (data.layout) {
+  case ParticleLayout::SoA: return data.r;
+  case ParticleLayout::AoSoA: return data.blocks;
+  default: return data.particles;
+  }
+}
+
+// Access to particle i in the layout of the data, known at compile time
+template<ParticleLayout Layout>
+inline void store_particle(const InputDataType& data, size_t i, FTYPE r, FTYPE phi) {
+  if constexpr (Layout == ParticleLayout::AoS) {
+    data.particles[i].r = r;
+    data.particles[i].phi = phi;
+  } else if constexpr (Layout == ParticleLayout::SoA) {
+    data.r[i] = r;
+    data.phi[i] = phi;
+  } else {
+    data.blocks[i / particleBlockSize].r[i % particleBlockSize] = r;
+    data.blocks[i / particleBlockSize].phi[i % particleBlockSize] = phi;
+  }
+}
+
+template<ParticleLayout Layout>
+inline void load_particle(const InputDataType& data, size_t i, FTYPE& r, FTYPE& phi) {
+  if constexpr (Layout == ParticleLayout::AoS) {
+    r = data.particles[i].r;
+    phi = data.particles[i].phi;
+  } else if constexpr (Layout == ParticleLayout::SoA) {
+    r = data.r[i];
+    phi = data.phi[i];
+  } else {
+    r = data.blocks[i / particleBlockSize].r[i % particleBlockSize];
+    phi = data.blocks[i / particleBlockSize].phi[i % particleBlockSize];
+  }
+}
+
+// The output type is a matrix of bins with the shape of the input grid,
+// stored by rows (bins[iX][iY])
+struct BinsType {
+  int nBinsX = 0;
+  int nBinsY = 0;
+  std::vector<int> counts;
+
+  void resize(int x, int y) {
+    nBinsX = x;
+    nBinsY = y;
+    counts.assign(size_t(x) * y, 0);
+  }
+  int* operator[](int iX) { return &counts[size_t(iX) * nBinsY]; }
+  const int* operator[](int iX) const { return &counts[size_t(iX) * nBinsY]; }
+};
+
+// How the threads of BinParticles combine their counts:
+//  - PerThread: each thread bins into its own private copy of BinsType,
+//    padded to whole cache lines, and the copies are added up at the end.
+//  - Sharded: threads share a few copies (shards), incremented with
+//    atomics; with a single shard this is a plain atomic histogram.
+//  - Auto: PerThread while all private copies fit in maxPrivateBinsBytes,
+//    Sharded with as many shards as fit otherwise.
+enum class Privatization { Auto, PerThread, Sharded };
+extern Privatization privatization;
+const size_t maxPrivateBinsBytes = 1 << 20;
+
+// Particles whose bins are computed together in one vectorised loop
+const int binningBlockSize = 1024;
+
+// How each thread counts the bins of a block:
+//  - Scalar: one increment per particle in its histogram.
+//  - Lanes: each of histogramLanes SIMD lanes counts in its own
+//    sub-histogram, so a vector of increments never conflicts (and can
+//    be a gather/scatter) and runs of particles in the same bin do not
+//    serialise on one counter; the sub-histograms are added up at the end.
+//  - Auto: Lanes while the sub-histograms fit in maxLaneBinsBytes.
+enum class HistogramUpdate { Auto, Scalar, Lanes };
+extern HistogramUpdate histogramUpdate;
+const int histogramLanes = 16;
+const size_t maxLaneBinsBytes = 64 << 10;
+
+// How the bin of each particle is found:
+//  - Trig: converting (r, phi) to (x, y) with fast_sincos.
+//  - Polar: without transcendentals, in a table of the grid in polar
+//    coordinates. The disc is split in radial bands, polarBandsPerBin
+//    per bin width, and each band in the angular intervals between the
+//    angles at which its inner or outer circle comes within a guard
+//    distance of a grid line. When both arcs of an interval are in the
+//    same bin, so is the whole sector between them, and that is the bin
+//    of its particles: the band of r and the interval of phi, found from
+//    an index of equal angular cells. The particles of the other
+//    intervals, which are near grid lines, are classified with Trig, so
+//    both classifiers give the same bins. The bands are reduced if the
+//    table would take more than maxPolarTableBytes.
+enum class Classifier { Trig, Polar };
+extern Classifier classifier;
+extern int polarBandsPerBin;
+const size_t maxPolarTableBytes = 64 << 20;
+
+struct PolarTableStats {
+  int nBands;             // radial bands
+  int nIntervals;         // maximum angular intervals of a band
+  int nCells;             // angular cells of the index of a band
+  size_t bytes;
+  double ambiguousArea;   // fraction of the disc in intervals near grid lines
+  double overflowArea;    // fraction of the disc in cells with too many intervals
+};
+
+// Builds (or reuses) the polar table of the grid of inputData
+PolarTableStats polar_table_stats(const InputDataType& inputData);
+
+// Particles grouped by bin, as SortParticlesByBin leaves them: those of
+// bin b are the elements binStart[b] to binStart[b + 1] - 1, in their
+// input order. With SortOutput::Indices each element is the position of
+// a particle in the input (indices); with SortOutput::Particles, a copy
+// of its coordinates (particles).
+enum class SortOutput { Indices, Particles };
+
+struct SortedParticles {
+  std::vector<int> binStart;
+  std::unique_ptr<int[], decltype(&free)> indices{nullptr, &free};
+  std::unique_ptr<Particle[], decltype(&free)> particles{nullptr, &free};
+  size_t indicesBytes = 0;    // allocated for indices
+  size_t particlesBytes = 0;  // allocated for particles
+};
+
+// How SortParticlesByBin writes each element to its bin:
+//  - Direct: straight to the next position of the bin, so with many
+//    bins almost every write misses in the cache.
+//  - Buffered: into a cache-line write-combining buffer of the bin,
+//    copied to the output as a whole aligned line when full, with a
+//    non-temporal store: the line is written to memory once instead of
+//    being read into the cache for each of its elements.
+//  - Auto: Buffered while the buffers of a thread fit in
+//    maxScatterBufferBytes.
+enum class SortScatter { Auto, Direct, Buffered };
+extern SortScatter sortScatter;
+const size_t maxScatterBufferBytes = 1 << 20;
+
+// Groups the particles of inputData, in any layout, by bin into
+// «sorted» and adds their counts to outputBins, as BinParticles. Two
+// passes over the particles: each thread counts the bins of its range
+// of particles, the counts of all threads give by prefix sums the range
+// of each bin and the offset of each thread in it, and each thread
+// classifies its particles again and writes them into its part of the
+// ranges, without atomics.
+void SortParticlesByBin(const InputDataType& inputData, SortOutput output, BinsType& outputBins, SortedParticles& sorted);
+
+// Quantities of each particle that BinParticlesWeighted adds up per bin
+// besides counting it: R (for the mean radius of the bin), R2 (r², as
+// the energy in a harmonic potential), X and Y (for the centroid of the
+// bin) and Phi
+enum class Quantity { R, R2, X, Y, Phi };
+const char* const quantityNames[] = { "r", "r2", "x", "y", "phi" };
+
+// Precision of the sums of BinParticlesWeighted, and whether they are
+// compensated (Kahan): with compensation each sum carries the rounding
+// error of the previous additions, so the result is almost as accurate
+// as adding up in twice the precision
+enum class SumPrecision { Float, Double };
+extern SumPrecision sumPrecision;
+extern bool compensatedSums;
+
+// Each bin keeps its count and its sums in one cache line, so this is
+// the number of quantities that fit
+inline int max_bin_quantities(SumPrecision precision, bool compensated) {
+  const int sumSize = precision == SumPrecision::Float ? sizeof(float) : sizeof(double);
+  return (64 - sumSize) / sumSize / (compensated ? 2 : 1);
+}
+
+// Each thread keeps its own copy of those cache lines, so the grids with
+// sums are limited to this number of bins: 16 MB per thread at 512×512
+const size_t maxWeightedBins = 1 << 18;
+
+// Sums of the quantities per bin, with the shape of the input grid:
+// sums[(iX*nBinsY + iY)*quantities.size() + q]
+struct BinSumsType {
+  int nBinsX = 0;
+  int nBinsY = 0;
+  std::vector<Quantity> quantities;
+  std::vector<double> sums;
+
+  void resize(int x, int y, const std::vector<Quantity>& q) {
+    nBinsX = x;
+    nBinsY = y;
+    quantities = q;
+    sums.assign(size_t(x) * y * q.size(), 0);
+  }
+};
+
+// Bins the particles of inputData, in any layout, into outputBins as
+// BinParticles and, in the same pass, adds their quantities into
+// outputSums, which must already have the shape of the input grid, of
+// at most maxWeightedBins bins, and at most max_bin_quantities quantities. Each thread accumulates into
+// its own copy of the bins, a cache line per bin.
+void BinParticlesWeighted(const InputDataType& inputData, BinsType& outputBins, BinSumsType& outputSums);
+
+// Computes in bins[i] the bin of each particle of inputData, in any
+// layout, with the classifier and kernels of BinParticles
+void ClassifyParticles(const InputDataType& inputData, int* bins);
+
+// Bins the particles of inputData, in any layout, into each of
+// «outputs» in a single pass. The outputs are grids of any shape over
+// the disc of inputData. A grid nested in a finer one of the list (each
+// of its bins made of a whole number of the finer bins) is not binned
+// but derived from the finer one by adding up its bins, so a pyramid of
+// grids costs a binning at the finest resolution. The rest are binned
+// together: the coordinates of each particle are transformed once and
+// classified in each grid with the expression of the Trig classifier,
+// so they get the bins of BinParticles. Only in a derived grid may the
+// particles on the edges of the bins fall in a different bin than when
+// binned at the coarser resolution.
+void BinParticlesMulti(const InputDataType& inputData, std::vector<BinsType>& outputs);
+
+// Bins the particles of inputData, in any layout, into outputBins, which
+// must already have the shape of the input grid. 10×10, 64×64, 256×256 and 1024×1024
+// grids use kernels specialised at compile time for their size; the
+// rest a generic kernel with the sizes read at run time.
+void BinParticles(const InputDataType& inputData, BinsType& outputBins);
+
+#endif
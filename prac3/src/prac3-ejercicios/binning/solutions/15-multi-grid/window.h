@@ -0,0 +1,69 @@
+#ifndef _WINDOW_H_
+#define _WINDOW_H_
+
+#include <atomic>
+#include <deque>
+#include <memory>
+
+#include "binning.h"
+
+// Histogram of a window of a stream, as served to readers: the counts
+// of the particles of the batches ingested from windowStart to time
+struct WindowSnapshot {
+  BinsType bins;
+  double windowStart = 0;   // stream time of the start of the oldest epoch
+  double time = 0;          // stream time of the last batch
+  double publishTime = 0;   // wall time at which it was published
+  size_t particles = 0;     // sum of the bins
+};
+
+// Incremental binning of a stream of particle batches, with the
+// histogram of the last windowSeconds of stream time. The window is a
+// ring of epochs of windowSeconds / nEpochs: the batches are binned
+// into the sub-histogram of the current epoch, and when an epoch ends
+// its counts are added to the sum of the closed epochs of the window
+// and those of the epoch that leaves the window are subtracted, so
+// expiring data costs one pass over the bins per epoch, not re-binning.
+// The window then covers the last nEpochs closed epochs and the current
+// one: between windowSeconds and windowSeconds plus one epoch.
+//
+// ingest is called by a single thread. Readers get the last published
+// snapshot with snapshot() from any thread: a snapshot is immutable,
+// and a new one is swapped in atomically by ingest every
+// publishInterval seconds of wall time (0: after every batch), so
+// readers never wait for a batch to be binned and ingest never waits
+// for the readers.
+class WindowedBinning {
+public:
+  WindowedBinning(const InputDataType& grid, double windowSeconds, int nEpochs, double publishInterval);
+
+  // Bins «batch», received at stream time «time», which never decreases
+  void ingest(const InputDataType& batch, double time);
+
+  std::shared_ptr<const WindowSnapshot> snapshot() const { return published.load(); }
+
+  // Wall time spent in ingest closing epochs and publishing snapshots
+  double epochTime = 0;
+  double publishTime = 0;
+  size_t snapshots = 0;
+
+private:
+  void close_epoch();
+  void publish(double time);
+
+  int nBinsX, nBinsY;
+  double epochSeconds;
+  int nEpochs;
+  double publishInterval;
+  long epoch = -1;              // index of the current epoch
+  BinsType current;             // counts of the current epoch
+  size_t currentParticles = 0;
+  std::deque<BinsType> closed;  // closed epochs in the window, oldest first
+  std::deque<size_t> closedParticles;
+  BinsType closedSum;           // counts of all the closed epochs in the window
+  size_t closedSumParticles = 0;
+  double lastPublish = -1;
+  std::atomic<std::shared_ptr<const WindowSnapshot>> published;
+};
+
+#endif
@@ -0,0 +1,909 @@
+#include <cassert>
+#include <random>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <memory>
+#include <thread>
+#include <omp.h>
+
+#include "util.h"
+#include "binning.h"
+#include "particle_file.h"
+#include "philox.h"
+#include "fast_sincos.h"
+#include "window.h"
+#include "result_file.h"
+
+using namespace std;
+
+// How init_input_data generates the particles:
+//  - MT19937: sequentially, from a single Mersenne Twister (the particles
+//    of 00-reference and binning-reference-results).
+//  - Philox: in parallel and vectorised, each particle from its own
+//    counter of a Philox4x32-10 keyed with the seed (two particles per
+//    counter in single precision); the particles depend on the seed
+//    only, not on the number of threads.
+enum class Generator { MT19937, Philox };
+
+// Philox generation of init_input_data, with the skew and the layout
+// decided at compile time so that the loop has no branches
+template<bool Skewed, ParticleLayout Layout>
+static void init_particles_philox(const InputDataType& data, size_t seed) {
+  const FTYPE maxMagnitudeR = data.maxMagnitudeR;
+#ifdef DOUBLE_PRECISION
+  // Each counter gives one particle: two words for r and two for phi
+  const size_t particlesPerCounter = 1;
+#else
+  // Each counter gives two particles: one word for each r and phi
+  const size_t particlesPerCounter = 2;
+#endif
+  const size_t numCounters = (data.numDataPoints + particlesPerCounter - 1) / particlesPerCounter;
+#pragma omp parallel for simd schedule(static)
+  for (size_t c = 0; c < numCounters; ++c) {
+    const uint32_t c0 = uint32_t(c), c1 = uint32_t(uint64_t(c) >> 32);
+    const Philox4x32 w = philox4x32({{c0, c1, 0, 0}}, seed);
+    uint32_t wskew0 = 0, wskew1 = 0;
+    if constexpr (Skewed) {
+      // The skew takes the words of counter c + 2^64
+      const Philox4x32 ws = philox4x32({{c0, c1, 1, 0}}, seed);
+      wskew0 = ws.v[0];
+      wskew1 = ws.v[1];
+    }
+    auto place = [=](size_t i, FTYPE ur, FTYPE uphi, uint32_t wskew) {
+      const bool skew = Skewed && philox_uniform_float(wskew) < 0.9f;
+      store_particle<Layout>(data, i, ur * maxMagnitudeR * (skew ? FTYPE(0.08) : FTYPE(1)),
+                             uphi * FTYPE(2.0*M_PI) * (skew ? FTYPE(0.25) : FTYPE(1)));
+    };
+#ifdef DOUBLE_PRECISION
+    place(c, philox_uniform_double(w.v[0], w.v[1]), philox_uniform_double(w.v[2], w.v[3]), wskew0);
+#else
+    place(2*c, philox_uniform_float(w.v[0]), philox_uniform_float(w.v[1]), wskew0);
+    place(2*c + 1, philox_uniform_float(w.v[2]), philox_uniform_float(w.v[3]), wskew1);
+#endif
+  }
+}
+
+template<bool Skewed>
+static void init_particles_philox_layout(const InputDataType& data, size_t seed) {
+  switch (data.layout) {
+  case ParticleLayout::AoS:
+    init_particles_philox<Skewed, ParticleLayout::AoS>(data, seed);
+    break;
+  case ParticleLayout::SoA:
+    init_particles_philox<Skewed, ParticleLayout::SoA>(data, seed);
+    break;
+  case ParticleLayout::AoSoA:
+    init_particles_philox<Skewed, ParticleLayout::AoSoA>(data, seed);
+    break;
+  }
+}
+
+static void store_particle_any(const InputDataType& data, size_t i, FTYPE r, FTYPE phi) {
+  switch (data.layout) {
+  case ParticleLayout::AoS:
+    store_particle<ParticleLayout::AoS>(data, i, r, phi);
+    break;
+  case ParticleLayout::SoA:
+    store_particle<ParticleLayout::SoA>(data, i, r, phi);
+    break;
+  case ParticleLayout::AoSoA:
+    store_particle<ParticleLayout::AoSoA>(data, i, r, phi);
+    break;
+  }
+}
+
+static void load_particle_any(const InputDataType& data, size_t i, FTYPE& r, FTYPE& phi) {
+  switch (data.layout) {
+  case ParticleLayout::AoS:
+    load_particle<ParticleLayout::AoS>(data, i, r, phi);
+    break;
+  case ParticleLayout::SoA:
+    load_particle<ParticleLayout::SoA>(data, i, r, phi);
+    break;
+  case ParticleLayout::AoSoA:
+    load_particle<ParticleLayout::AoSoA>(data, i, r, phi);
+    break;
+  }
+}
+
+// The particles are generated in the disc of the grid of «data», which
+// must be set before, and stored in «layout». With «skewed», 90% of the
+// particles fall within the first quadrant and 8% of the radius instead
+// of uniformly in the disc
+void init_input_data(InputDataType& data, size_t seed, size_t numDataPoints, bool skewed = false, Generator generator = Generator::MT19937,
+                     ParticleLayout layout = ParticleLayout::AoS) {
+  const FTYPE maxMagnitudeR = data.maxMagnitudeR;
+  // Whole cache lines, which leave room for the second particle of the
+  // last Philox counter
+  const size_t bytes = particle_bytes(layout, numDataPoints);
+  set_particle_arrays(data, layout, numDataPoints, aligned_alloc(64, bytes));
+  if (generator == Generator::Philox) {
+    if (skewed) {
+      init_particles_philox_layout<true>(data, seed);
+    } else {
+      init_particles_philox_layout<false>(data, seed);
+    }
+  } else {
+    mt19937 generator_mt(seed); // 32 bit Mersenne Twister pseudo-random generator
+    uniform_real_distribution<FTYPE> distr(0.0, maxMagnitudeR);
+    uniform_real_distribution<FTYPE> distphi(0.0, 2.0*M_PI);
+    uniform_real_distribution<FTYPE> distskew(0.0, 1.0);
+    for (size_t i = 0; i < numDataPoints; ++i) {
+      FTYPE r = distr(generator_mt);
+      FTYPE phi = distphi(generator_mt);
+      if (skewed && distskew(generator_mt) < FTYPE(0.9)) {
+        r *= FTYPE(0.08);
+        phi *= FTYPE(0.25);
+      }
+      store_particle_any(data, i, r, phi);
+    }
+  }
+  if (layout == ParticleLayout::AoSoA) {
+    // Padding of the last block
+    for (size_t i = numDataPoints; i % particleBlockSize != 0; ++i) {
+      store_particle<ParticleLayout::AoSoA>(data, i, 0, 0);
+    }
+  }
+}
+
+const char* layout_names[] = { "aos", "soa", "aosoa" };
+
+void free_input_data(InputDataType& data) {
+  free(particle_buffer(data));
+  set_particle_arrays(data, data.layout, 0, nullptr);
+}
+
+const char* result_format_names[] = { "text", "binary" };
+
+// Writes «binnedData», binned on the grid of «grid» from numDataPoints
+// particles generated with «seed», in «format»
+void write_result(const string& out_file, const BinsType& binnedData, ResultFormat format, const InputDataType& grid, size_t numDataPoints, size_t seed) {
+  const double start = omp_get_wtime();
+  if (!write_result_file(out_file, binnedData, format, result_file_header(binnedData, grid, numDataPoints, seed))) {
+    printf("Problem writing result file.\n");
+    exit(1);
+  }
+  printf("Result written to %s (%s) in %.3fs\n", out_file.c_str(), result_format_names[size_t(format)], omp_get_wtime() - start);
+}
+
+// Compares «binnedData», binned on the grid of «grid», with a result
+// file of either format. The comparison of the bins is a single
+// vectorised pass with reductions.
+void check_result(const string& check_file, const BinsType& binnedData, const InputDataType& grid) {
+  const double start = omp_get_wtime();
+  BinsType check_data;
+  ResultFormat format;
+  ResultFileHeader header;
+  if (!read_result_file(check_file, check_data, format, header)) {
+    printf("Problem reading result file.\n");
+    exit(1);
+  }
+  const int nBinsX = binnedData.nBinsX;
+  const int nBinsY = binnedData.nBinsY;
+  if (check_data.nBinsX != nBinsX || check_data.nBinsY != nBinsY) {
+    printf(ESC_RED "The result has %d×%d bins but %s has %d×%d." ESC_RESET "\n", nBinsX, nBinsY, check_file.c_str(), check_data.nBinsX, check_data.nBinsY);
+    return;
+  }
+  if (format == ResultFormat::Binary && (header.xMin != double(grid.xMin) || header.xMax != double(grid.xMax) || header.yMin != double(grid.yMin)
+                                         || header.yMax != double(grid.yMax) || header.ftypeSize != sizeof(FTYPE))) {
+    printf(ESC_RED "%s was binned over [%g, %g) × [%g, %g) in %s precision." ESC_RESET "\n", check_file.c_str(), header.xMin, header.xMax, header.yMin, header.yMax,
+           header.ftypeSize == 8 ? "double" : "single");
+  }
+  const size_t nBins = binnedData.counts.size();
+  const int* counts = binnedData.counts.data();
+  const int* check_counts = check_data.counts.data();
+  int maxDiff = 0;
+  int nBinsDiff = 0;
+  int nNegative = 0;
+  long nPartsCheck = 0;
+  long nParts = 0;
+#pragma omp simd reduction(+:nBinsDiff, nNegative, nParts, nPartsCheck) reduction(max:maxDiff)
+  for (size_t b = 0; b < nBins; b++) {
+    const int diff = abs(counts[b] - check_counts[b]);
+    nNegative += (counts[b] | check_counts[b]) < 0 ? 1 : 0;
+    nParts += counts[b];
+    nPartsCheck += check_counts[b];
+    nBinsDiff += diff > 0 ? 1 : 0;
+    maxDiff = max(maxDiff, diff);
+  }
+  assert(nNegative == 0);
+  printf("Result checked against %s (%s%s) in %.3fs\n", check_file.c_str(), result_format_names[size_t(format)],
+         format == ResultFormat::Binary ? (", seed " + to_string(header.seed) + ", " + to_string(header.numDataPoints) + " particles").c_str() : "", omp_get_wtime() - start);
+  if (nBinsDiff > 0) {
+    int maxDiffThr = double(nParts) / (nBinsX * nBinsY) / 100000;
+    printf("Number of different bins: %d,  maximum bin difference: %d (threshold %d),  particle count: %ld,  reference particle count: %ld\n", nBinsDiff, maxDiff, maxDiffThr, nParts, nPartsCheck);
+    if (nParts != nPartsCheck) {
+      printf(ESC_RED "The number of input and output particles does not match with %s." ESC_RESET "\n", check_file.c_str());
+    }
+    if (maxDiff > maxDiffThr) {
+      printf(ESC_RED "The number of missclassified particles in some bins is too high with respect to %s." ESC_RESET "\n", check_file.c_str());
+    } else {
+      printf(ESC_GREEN "The result is similar enough to %s." ESC_RESET "\n", check_file.c_str());
+    }
+  } else {
+    assert(nPartsCheck == nParts && maxDiff == 0);
+    printf(ESC_GREEN "The result is exactly as in %s." ESC_RESET "\n", check_file.c_str());
+  }
+}
+
+void reset_bins(BinsType& bins) {
+  for (int i = 0; i < bins.nBinsX; i++) {
+    for (int j = 0; j < bins.nBinsY; j++) {
+      bins[i][j] = 0;
+    }
+  }
+}
+
+// Times BinParticles with each thread count of the comma-separated list
+// «threads_list» and prints the speedup over the first count and the
+// efficiency relative to it (1 if the time falls with the thread count)
+void report_scaling(const string& threads_list, const InputDataType& inputData, size_t repeat_times, size_t warmup_times) {
+  BinsType binnedData;
+  binnedData.resize(inputData.nBinsX, inputData.nBinsY);
+  double base_time = 0;
+  int base_threads = 0;
+  size_t start = 0;
+  while (start < threads_list.size()) {
+    size_t end = threads_list.find(',', start);
+    if (end == string::npos) {
+      end = threads_list.size();
+    }
+    int nThreads = atoi(threads_list.substr(start, end - start).c_str());
+    start = end + 1;
+    if (nThreads <= 0) {
+      fprintf(stderr, "Incorrect thread count in --scaling-threads: %s\n", threads_list.c_str());
+      exit(1);
+    }
+    omp_set_num_threads(nThreads);
+    vector<double> times;
+    for (size_t i = 0; i < repeat_times; ++i) {
+      reset_bins(binnedData);
+      double elapsed_time = measure_time(BinParticles, inputData, binnedData);
+      if (i >= warmup_times) {
+        times.push_back(elapsed_time);
+      }
+    }
+    double average_time = vector_average(times);
+    if (base_time == 0) {
+      base_time = average_time;
+      base_threads = nThreads;
+    }
+    const double speedup = base_time / average_time;
+    printf("Threads %3d: %7.3f±%.3fs  GP/s: %5.4g  speedup: %5.2f  efficiency: %5.1f%%\n", nThreads, average_time, vector_stddev(times), double(inputData.numDataPoints) / average_time / 1000000000, speedup, 100 * speedup * base_threads / nThreads);
+  }
+}
+
+// Checks that «sorted» groups the particles of inputData by bin: the
+// range of each bin has as many elements as particles has the bin, and
+// all of them are of the bin (with indices, each particle once and in
+// input order)
+void check_sorted(const InputDataType& inputData, SortOutput output, const SortedParticles& sorted) {
+  const int nBins = inputData.nBinsX * inputData.nBinsY;
+  const size_t numDataPoints = inputData.numDataPoints;
+  unique_ptr<int[]> bins(new int[numDataPoints]);
+  ClassifyParticles(inputData, bins.get());
+  vector<int> counts(nBins, 0);
+  for (size_t i = 0; i < numDataPoints; ++i) {
+    ++counts[bins[i]];
+  }
+  if (output == SortOutput::Particles) {
+    InputDataType sortedData = inputData;
+    set_particle_arrays(sortedData, ParticleLayout::AoS, numDataPoints, sorted.particles.get());
+    ClassifyParticles(sortedData, bins.get());
+  }
+  size_t wrong = 0;
+  for (int b = 0; b < nBins; ++b) {
+    const int start = sorted.binStart[b];
+    const int end = sorted.binStart[b + 1];
+    if (end - start != counts[b]) {
+      wrong += abs(end - start - counts[b]);
+    }
+    for (int k = start; k < end; ++k) {
+      if (output == SortOutput::Indices) {
+        const int i = sorted.indices[k];
+        wrong += bins[i] != b || (k > start && i <= sorted.indices[k - 1]);
+      } else {
+        wrong += bins[k] != b;
+      }
+    }
+  }
+  if (sorted.binStart[nBins] != int(numDataPoints) || wrong > 0) {
+    printf(ESC_RED "The particles are not grouped by bin: %zu misplaced." ESC_RESET "\n", wrong);
+  } else {
+    printf(ESC_GREEN "The particles are grouped by bin." ESC_RESET "\n");
+  }
+}
+
+// Checks the sums of the quantities against adding up the same values
+// of all the particles in double precision, and prints for each the
+// total and its error relative to the sum of the absolute values (the
+// sum of x or of y is close to 0)
+void check_sums(const InputDataType& inputData, const BinSumsType& binSums) {
+  const int nQuantities = binSums.quantities.size();
+  const size_t nBins = size_t(binSums.nBinsX) * binSums.nBinsY;
+  for (int q = 0; q < nQuantities; ++q) {
+    const Quantity quantity = binSums.quantities[q];
+    double total = 0;
+    double absTotal = 0;
+#pragma omp parallel for reduction(+:total, absTotal)
+    for (int i = 0; i < inputData.numDataPoints; ++i) {
+      FTYPE r = 0, phi = 0;
+      load_particle_any(inputData, i, r, phi);
+      FTYPE sinPhi, cosPhi;
+      fast_sincos(phi, sinPhi, cosPhi);
+      const FTYPE value = quantity == Quantity::R ? r
+        : quantity == Quantity::R2 ? r*r
+        : quantity == Quantity::X ? r*cosPhi
+        : quantity == Quantity::Y ? r*sinPhi
+        : phi;
+      total += value;
+      absTotal += fabs(value);
+    }
+    double binned = 0;
+    for (size_t b = 0; b < nBins; ++b) {
+      binned += binSums.sums[b * nQuantities + q];
+    }
+    printf("Sum of %-3s: %.10g (error %.2e of the sum of |%s|)\n", quantityNames[size_t(quantity)], binned, fabs(binned - total) / absTotal, quantityNames[size_t(quantity)]);
+  }
+}
+
+// With Classifier::Polar, builds the table of the grid of «grid» before
+// the binning is timed and prints its size and build time
+void prepare_classifier(const InputDataType& grid) {
+  if (classifier == Classifier::Polar) {
+    double build_time = omp_get_wtime();
+    PolarTableStats stats = polar_table_stats(grid);
+    build_time = omp_get_wtime() - build_time;
+    printf("Polar table: %d bands × %d intervals, %d cells (%.1f MB) built in %.3fs, %.2f%% + %.2f%% of the disc classified with trig\n", stats.nBands, stats.nIntervals,
+           stats.nCells, double(stats.bytes) / 1000000, build_time, 100 * stats.ambiguousArea, 100 * stats.overflowArea);
+  }
+}
+
+// Bins the particles of «particles_file» chunk by chunk while
+// stream_particles reads them, so only two chunks are ever in memory.
+// The file is first read once without binning to know the raw read
+// speed, against which the GB/s of each run are reported.
+int stream_binning(const string& particles_file, size_t chunkParticles, bool dropCache, size_t nBinsX, size_t nBinsY,
+                   size_t repeat_times, size_t warmup_times, const string& result_output_file, ResultFormat result_format, const string& result_check_file) {
+  ParticleFileHeader header;
+  if (!read_particle_file_header(particles_file, header)) {
+    fprintf(stderr, "Problem reading particle file header (or particles not in %s): %s\n",
+#ifdef DOUBLE_PRECISION
+            "double precision",
+#else
+            "single precision",
+#endif
+            particles_file.c_str());
+    return 1;
+  }
+  const size_t numDataPoints = header.numDataPoints;
+  printf("Measuring time to bin %ld particles (%.3f GP, %.3f GB) of %s (%s) in %zu×%zu bins in chunks of %zu particles (%.1f MB)\n", numDataPoints, double(numDataPoints) / 1000000000,
+         double(numDataPoints * sizeof(Particle)) / 1000000000, particles_file.c_str(), layout_names[size_t(header.layout)], nBinsX, nBinsY, chunkParticles, double(chunkParticles * sizeof(Particle)) / 1000000);
+
+  InputDataType grid;
+  set_bin_grid(grid, nBinsX, nBinsY, header.maxMagnitudeR);
+
+  StreamStats raw;
+  if (!stream_particles(particles_file, chunkParticles, dropCache, grid, [](const InputDataType&) {}, raw)) {
+    fprintf(stderr, "Problem reading particle file: %s\n", particles_file.c_str());
+    return 1;
+  }
+  const double raw_gbps = raw.bytes / raw.seconds / 1000000000;
+  printf("    Raw read: %7.2fs ⇒ %5.4g GB/s%s\n", raw.seconds, raw_gbps, dropCache ? "" : "  (from the page cache if it fits)");
+
+  prepare_classifier(grid);
+  BinsType binnedData;
+  binnedData.resize(nBinsX, nBinsY);
+
+  vector<double> times;
+  vector<double> pps;
+  vector<double> gbps;
+  for (size_t i = 0; i < repeat_times; ++i) {
+    reset_bins(binnedData);
+    StreamStats stats;
+    bool ok = stream_particles(particles_file, chunkParticles, dropCache, grid, [&](const InputDataType& chunk) {
+      BinParticles(chunk, binnedData);
+    }, stats);
+    if (!ok) {
+      fprintf(stderr, "Problem reading particle file: %s\n", particles_file.c_str());
+      return 1;
+    }
+    const double elapsed_time = stats.seconds;
+    if (i == 0) {
+      if (result_output_file != "") {
+        write_result(result_output_file, binnedData, result_format, grid, numDataPoints, header.seed);
+      }
+      if (result_check_file != "") {
+        check_result(result_check_file, binnedData, grid);
+      }
+    }
+    if (i >= warmup_times) {
+      times.push_back(elapsed_time);
+      pps.push_back(double(numDataPoints) / elapsed_time);
+      gbps.push_back(stats.bytes / elapsed_time / 1000000000);
+    }
+    printf("    Run %2ld/%2ld: %7.2fs ⇒ %5.4g GP/s  %5.4g GB/s (%3.0f%% of raw read)  waiting for the reader: %5.2fs  %s\n", i + 1, repeat_times, elapsed_time,
+           double(numDataPoints) / elapsed_time / 1000000000, stats.bytes / elapsed_time / 1000000000, 100 * raw.seconds / elapsed_time, stats.waitTime,
+           i < warmup_times ? "(warmup)" : "");
+  }
+
+  double average_time = vector_average(times);
+  double stddev_time = vector_stddev(times);
+  double average_pps = vector_average_harmonic(pps);
+  double stddev_pps = vector_stddev_harmonic(pps);
+  double average_gbps = vector_average_harmonic(gbps);
+  printf(ESC_BOLD "Average time (s): %7.2f±%.2f  GP/s: %5.4g±%.4g  GB/s: %5.4g (raw read %5.4g) " ESC_RESET "   numDataPoints = %ld \n", average_time, stddev_time,
+         average_pps / 1000000000, stddev_pps / 1000000000, average_gbps, raw_gbps, numDataPoints);
+  return 0;
+}
+
+// Particles «start» to «start» + n of «data»; with AoSoA, «start» is a
+// multiple of particleBlockSize
+static InputDataType slice_input_data(const InputDataType& data, size_t start, size_t n) {
+  InputDataType slice = data;
+  slice.numDataPoints = n;
+  switch (data.layout) {
+  case ParticleLayout::AoS:
+    slice.particles += start;
+    break;
+  case ParticleLayout::SoA:
+    slice.r += start;
+    slice.phi += start;
+    break;
+  case ParticleLayout::AoSoA:
+    slice.blocks += start / particleBlockSize;
+    break;
+  }
+  return slice;
+}
+
+// Feeds the particles of inputData to a WindowedBinning as a live stream
+// for «stream_seconds»: batches of «batchParticles», cycling through the
+// particles, time-stamped with the wall time since the start, as fast as
+// they are ingested. Meanwhile a reader thread takes a snapshot every
+// «read_interval» seconds, checks that its bins add up to its particle
+// count and measures how long it took to get it and how old its data is.
+int window_binning(const InputDataType& inputData, size_t batchParticles, double window_seconds, size_t window_epochs, double publish_interval,
+                   double read_interval, double stream_seconds) {
+  printf("Sliding window of %gs in %zu epochs, batches of %zu particles, snapshots published every %gs and read every %gs for %gs\n", window_seconds, window_epochs,
+         batchParticles, publish_interval, read_interval, stream_seconds);
+  WindowedBinning window(inputData, window_seconds, window_epochs, publish_interval);
+
+  atomic<bool> done = false;
+  size_t reads = 0;
+  size_t inconsistent = 0;
+  vector<double> read_times;
+  vector<double> ages;
+  thread reader([&] {
+    while (!done.load()) {
+      const double start = omp_get_wtime();
+      shared_ptr<const WindowSnapshot> snap = window.snapshot();
+      const double end = omp_get_wtime();
+      read_times.push_back(end - start);
+      ages.push_back(end - snap->publishTime);
+      size_t sum = 0;
+      for (int count : snap->bins.counts) {
+        sum += count;
+      }
+      inconsistent += sum != snap->particles;
+      ++reads;
+      this_thread::sleep_for(chrono::duration<double>(read_interval));
+    }
+  });
+
+  const size_t numDataPoints = inputData.numDataPoints;
+  size_t ingested = 0;
+  size_t next = 0;
+  double binning_time = 0;
+  const double start = omp_get_wtime();
+  double now = start;
+  while (now - start < stream_seconds) {
+    const size_t n = min(batchParticles, numDataPoints - next);
+    const double batch_start = omp_get_wtime();
+    window.ingest(slice_input_data(inputData, next, n), batch_start - start);
+    now = omp_get_wtime();
+    binning_time += now - batch_start;
+    ingested += n;
+    next = next + n == numDataPoints ? 0 : next + n;
+  }
+  const double elapsed_time = now - start;
+  done = true;
+  reader.join();
+
+  shared_ptr<const WindowSnapshot> last = window.snapshot();
+  printf("Ingested %zu particles in %.2fs ⇒ %5.4g GP/s (binning %.2fs, closing epochs %.3fs, publishing %zu snapshots %.3fs)\n", ingested, elapsed_time,
+         double(ingested) / elapsed_time / 1000000000, binning_time - window.epochTime - window.publishTime, window.epochTime, window.snapshots, window.publishTime);
+  printf("Last snapshot: %zu particles of [%.2fs, %.2fs] of the stream\n", last->particles, last->windowStart, last->time);
+  printf("Reader: %zu snapshots, %zu inconsistent, got in %.2f±%.2fµs (max %.2fµs), data published %.2f±%.2fms before (max %.2fms)\n", reads, inconsistent,
+         1e6 * vector_average(read_times), 1e6 * vector_stddev(read_times), 1e6 * *max_element(read_times.begin(), read_times.end()),
+         1e3 * vector_average(ages), 1e3 * vector_stddev(ages), 1e3 * *max_element(ages.begin(), ages.end()));
+  printf(ESC_BOLD "Ingest rate: %5.4g GP/s  snapshot latency: %.2fµs, age %.2fms " ESC_RESET "   numDataPoints = %ld \n", double(ingested) / elapsed_time / 1000000000,
+         1e6 * vector_average(read_times), 1e3 * vector_average(ages), numDataPoints);
+  return inconsistent > 0;
+}
+
+// Times BinParticlesMulti on the grids of «grids_list», e.g.
+// "10x10,100x100,1000x1000", against a BinParticles run for each grid,
+// and compares the results of both
+int multi_grid_binning(const InputDataType& inputData, const string& grids_list, size_t repeat_times, size_t warmup_times) {
+  vector<BinsType> outputs;
+  size_t start = 0;
+  while (start < grids_list.size()) {
+    size_t end = grids_list.find(',', start);
+    if (end == string::npos) {
+      end = grids_list.size();
+    }
+    int nX = 0, nY = 0;
+    if (sscanf(grids_list.substr(start, end - start).c_str(), "%dx%d", &nX, &nY) != 2 || nX <= 0 || nY <= 0 || size_t(nX) * nY > (1 << 28)) {
+      fprintf(stderr, "Incorrect grid in --grids: %s\n", grids_list.c_str());
+      return 1;
+    }
+    outputs.emplace_back();
+    outputs.back().resize(nX, nY);
+    start = end + 1;
+  }
+
+  vector<double> times;
+  for (size_t i = 0; i < repeat_times; ++i) {
+    for (BinsType& bins : outputs) {
+      reset_bins(bins);
+    }
+    double elapsed_time = measure_time(BinParticlesMulti, inputData, outputs);
+    if (i >= warmup_times) {
+      times.push_back(elapsed_time);
+    }
+  }
+  const double multi_time = vector_average(times);
+  printf("Single pass over %s: %7.3f±%.3fs\n", grids_list.c_str(), multi_time, vector_stddev(times));
+
+  double separate_time = 0;
+  for (const BinsType& multi : outputs) {
+    InputDataType grid = inputData;
+    set_bin_grid(grid, multi.nBinsX, multi.nBinsY, inputData.maxMagnitudeR);
+    BinsType bins;
+    bins.resize(multi.nBinsX, multi.nBinsY);
+    times.clear();
+    for (size_t i = 0; i < repeat_times; ++i) {
+      reset_bins(bins);
+      double elapsed_time = measure_time(BinParticles, grid, bins);
+      if (i >= warmup_times) {
+        times.push_back(elapsed_time);
+      }
+    }
+    separate_time += vector_average(times);
+    int nBinsDiff = 0;
+    int maxDiff = 0;
+    for (size_t b = 0; b < bins.counts.size(); ++b) {
+      const int diff = abs(bins.counts[b] - multi.counts[b]);
+      nBinsDiff += diff > 0;
+      maxDiff = max(maxDiff, diff);
+    }
+    printf("    %4d×%-4d bins: separate run %7.3f±%.3fs, %d bins differ from the single pass by at most %d\n", multi.nBinsX, multi.nBinsY, vector_average(times),
+           vector_stddev(times), nBinsDiff, maxDiff);
+  }
+  printf(ESC_BOLD "Single pass: %7.3fs  separate runs: %7.3fs  speedup: %5.2f " ESC_RESET "   numDataPoints = %d \n", multi_time, separate_time, separate_time / multi_time,
+         inputData.numDataPoints);
+  return 0;
+}
+
+int main(const int argc, const char** argv) {
+  string result_output_file = "";
+  string result_format_name = "auto"; // of the written result: binary if the file name ends in .bin
+  string result_check_file = "";
+  size_t numDataPoints = 134217728; // 1<<27; // Problem size of the data sample
+  size_t seed = 1;
+  size_t repeat_times = 7; // total, including warmup
+  size_t warmup_times = 2;
+  string privatization_name = "auto";
+  string scaling_threads = ""; // e.g. "1,2,4,8"
+  string histogram_update_name = "auto";
+  string classifier_name = "trig";
+  size_t polar_bands_per_bin = polarBandsPerBin;
+  string distribution = "uniform";
+  string generator_name = "mt19937";
+  string layout_name = "aos";
+  size_t nBinsX = defaultBinsX;
+  size_t nBinsY = defaultBinsY;
+  double maxMagnitudeR = defaultMaxMagnitudeR;
+  string particles_file = "";       // binary particle file to bin in streaming
+  string write_particles_file = ""; // generates the particles into this file
+  size_t chunk_size = 1 << 22;      // particles per chunk when streaming
+  bool drop_cache = true;           // read the particle file from disk, not from the page cache
+  string sort_by_bin = "none";      // also group the particles by bin: none, indices or particles
+  string sort_scatter_name = "auto";
+  string quantities_list = "";      // also add up these quantities per bin, e.g. "r,r2,x,y"
+  string sum_precision_name = "double";
+  bool compensated_sums = false;
+  double window_seconds = 0;        // bin a live stream in a sliding window of this length
+  size_t window_epochs = 10;
+  double publish_interval = 0.01;   // seconds between the snapshots of the window
+  double read_interval = 0.001;     // seconds between the reads of a snapshot
+  double stream_seconds = 5;
+  string grids_list = "";           // bin into all these grids in one pass, e.g. "10x10,100x100,1000x1000"
+
+  for (int i = 1; i < argc; ++i) {
+    if (!parse_size_arg(argv[i], "num-data-points", numDataPoints)
+        && !parse_string_arg(argv[i], "write-result-file", result_output_file)
+        && !parse_string_arg(argv[i], "result-format", result_format_name)
+        && !parse_string_arg(argv[i], "check-result-file", result_check_file)
+        && !parse_size_arg(argv[i], "seed", seed)
+        && !parse_size_arg(argv[i], "repeat-times", repeat_times)
+        && !parse_size_arg(argv[i], "warmup-times", warmup_times)
+        && !parse_string_arg(argv[i], "privatization", privatization_name)
+        && !parse_string_arg(argv[i], "scaling-threads", scaling_threads)
+        && !parse_string_arg(argv[i], "histogram-update", histogram_update_name)
+        && !parse_string_arg(argv[i], "classifier", classifier_name)
+        && !parse_size_arg(argv[i], "polar-bands-per-bin", polar_bands_per_bin)
+        && !parse_string_arg(argv[i], "distribution", distribution)
+        && !parse_string_arg(argv[i], "generator", generator_name)
+        && !parse_string_arg(argv[i], "layout", layout_name)
+        && !parse_size_arg(argv[i], "bins-x", nBinsX)
+        && !parse_size_arg(argv[i], "bins-y", nBinsY)
+        && !parse_double_arg(argv[i], "max-r", maxMagnitudeR)
+        && !parse_string_arg(argv[i], "particles-file", particles_file)
+        && !parse_string_arg(argv[i], "write-particles-file", write_particles_file)
+        && !parse_size_arg(argv[i], "chunk-size", chunk_size)
+        && !parse_bool_arg(argv[i], "drop-cache", drop_cache)
+        && !parse_string_arg(argv[i], "sort-by-bin", sort_by_bin)
+        && !parse_string_arg(argv[i], "sort-scatter", sort_scatter_name)
+        && !parse_string_arg(argv[i], "quantities", quantities_list)
+        && !parse_string_arg(argv[i], "sum-precision", sum_precision_name)
+        && !parse_bool_arg(argv[i], "compensated-sums", compensated_sums)
+        && !parse_double_arg(argv[i], "window", window_seconds)
+        && !parse_size_arg(argv[i], "window-epochs", window_epochs)
+        && !parse_double_arg(argv[i], "publish-interval", publish_interval)
+        && !parse_double_arg(argv[i], "read-interval", read_interval)
+        && !parse_double_arg(argv[i], "stream-seconds", stream_seconds)
+        && !parse_string_arg(argv[i], "grids", grids_list)
+      ) {
+      fprintf(stderr, "Incorrect argument: %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  ResultFormat result_format;
+  if (result_format_name == "auto") {
+    const bool bin_extension = result_output_file.size() >= 4 && result_output_file.compare(result_output_file.size() - 4, 4, ".bin") == 0;
+    result_format = bin_extension ? ResultFormat::Binary : ResultFormat::Text;
+  } else if (result_format_name == "text") {
+    result_format = ResultFormat::Text;
+  } else if (result_format_name == "binary") {
+    result_format = ResultFormat::Binary;
+  } else {
+    fprintf(stderr, "Incorrect result format (auto, text or binary): %s\n", result_format_name.c_str());
+    return 1;
+  }
+
+  if (privatization_name == "auto") {
+    privatization = Privatization::Auto;
+  } else if (privatization_name == "per-thread") {
+    privatization = Privatization::PerThread;
+  } else if (privatization_name == "sharded") {
+    privatization = Privatization::Sharded;
+  } else {
+    fprintf(stderr, "Incorrect privatization (auto, per-thread or sharded): %s\n", privatization_name.c_str());
+    return 1;
+  }
+
+  if (histogram_update_name == "auto") {
+    histogramUpdate = HistogramUpdate::Auto;
+  } else if (histogram_update_name == "scalar") {
+    histogramUpdate = HistogramUpdate::Scalar;
+  } else if (histogram_update_name == "lanes") {
+    histogramUpdate = HistogramUpdate::Lanes;
+  } else {
+    fprintf(stderr, "Incorrect histogram update (auto, scalar or lanes): %s\n", histogram_update_name.c_str());
+    return 1;
+  }
+
+  if (classifier_name == "trig") {
+    classifier = Classifier::Trig;
+  } else if (classifier_name == "polar") {
+    classifier = Classifier::Polar;
+  } else {
+    fprintf(stderr, "Incorrect classifier (trig or polar): %s\n", classifier_name.c_str());
+    return 1;
+  }
+  if (polar_bands_per_bin == 0 || polar_bands_per_bin > 4096) {
+    fprintf(stderr, "Incorrect polar bands per bin: %zu\n", polar_bands_per_bin);
+    return 1;
+  }
+  polarBandsPerBin = polar_bands_per_bin;
+  if (nBinsX == 0 || nBinsY == 0 || nBinsX * nBinsY > (1 << 28) || maxMagnitudeR <= 0) {
+    fprintf(stderr, "Incorrect bin grid: %zu×%zu bins, maximum radius %g\n", nBinsX, nBinsY, maxMagnitudeR);
+    return 1;
+  }
+  if (distribution != "uniform" && distribution != "skewed") {
+    fprintf(stderr, "Incorrect distribution (uniform or skewed): %s\n", distribution.c_str());
+    return 1;
+  }
+  Generator generator;
+  if (generator_name == "mt19937") {
+    generator = Generator::MT19937;
+  } else if (generator_name == "philox") {
+    generator = Generator::Philox;
+  } else {
+    fprintf(stderr, "Incorrect generator (mt19937 or philox): %s\n", generator_name.c_str());
+    return 1;
+  }
+  size_t layout_index = 0;
+  while (layout_index < size(layout_names) && layout_name != layout_names[layout_index]) {
+    ++layout_index;
+  }
+  if (layout_index == size(layout_names)) {
+    fprintf(stderr, "Incorrect layout (aos, soa or aosoa): %s\n", layout_name.c_str());
+    return 1;
+  }
+  const ParticleLayout layout = ParticleLayout(layout_index);
+
+  if (sort_by_bin != "none" && sort_by_bin != "indices" && sort_by_bin != "particles") {
+    fprintf(stderr, "Incorrect sort by bin (none, indices or particles): %s\n", sort_by_bin.c_str());
+    return 1;
+  }
+  const SortOutput sort_output = sort_by_bin == "particles" ? SortOutput::Particles : SortOutput::Indices;
+  if (sort_scatter_name == "auto") {
+    sortScatter = SortScatter::Auto;
+  } else if (sort_scatter_name == "direct") {
+    sortScatter = SortScatter::Direct;
+  } else if (sort_scatter_name == "buffered") {
+    sortScatter = SortScatter::Buffered;
+  } else {
+    fprintf(stderr, "Incorrect sort scatter (auto, direct or buffered): %s\n", sort_scatter_name.c_str());
+    return 1;
+  }
+
+  vector<Quantity> quantities;
+  size_t start = 0;
+  while (start < quantities_list.size()) {
+    size_t end = quantities_list.find(',', start);
+    if (end == string::npos) {
+      end = quantities_list.size();
+    }
+    const string name = quantities_list.substr(start, end - start);
+    size_t q = 0;
+    while (q < size(quantityNames) && name != quantityNames[q]) {
+      ++q;
+    }
+    if (q == size(quantityNames)) {
+      fprintf(stderr, "Incorrect quantity (r, r2, x, y or phi): %s\n", name.c_str());
+      return 1;
+    }
+    quantities.push_back(Quantity(q));
+    start = end + 1;
+  }
+  if (sum_precision_name == "float") {
+    sumPrecision = SumPrecision::Float;
+  } else if (sum_precision_name == "double") {
+    sumPrecision = SumPrecision::Double;
+  } else {
+    fprintf(stderr, "Incorrect sum precision (float or double): %s\n", sum_precision_name.c_str());
+    return 1;
+  }
+  compensatedSums = compensated_sums;
+  if (int(quantities.size()) > max_bin_quantities(sumPrecision, compensatedSums)) {
+    fprintf(stderr, "Too many quantities for a cache line per bin (at most %d with %s%s sums): %s\n", max_bin_quantities(sumPrecision, compensatedSums),
+            compensatedSums ? "compensated " : "", sum_precision_name.c_str(), quantities_list.c_str());
+    return 1;
+  }
+  if (!quantities.empty() && nBinsX * nBinsY > maxWeightedBins) {
+    fprintf(stderr, "Too many bins for sums of quantities (at most %zu, a cache line per bin and thread): %zu×%zu bins\n", maxWeightedBins, nBinsX, nBinsY);
+    return 1;
+  }
+  if (!quantities.empty() && sort_by_bin != "none") {
+    fprintf(stderr, "Quantities cannot be added up while sorting by bin\n");
+    return 1;
+  }
+
+  if (chunk_size == 0 || chunk_size > (1u << 30)) {
+    fprintf(stderr, "Incorrect chunk size: %zu\n", chunk_size);
+    return 1;
+  }
+  if (window_seconds < 0 || window_epochs == 0 || window_epochs > 100000 || publish_interval < 0 || read_interval < 0 || stream_seconds <= 0) {
+    fprintf(stderr, "Incorrect sliding window: %gs in %zu epochs, publish interval %gs, read interval %gs, stream of %gs\n", window_seconds, window_epochs,
+            publish_interval, read_interval, stream_seconds);
+    return 1;
+  }
+  if (window_seconds > 0 && layout == ParticleLayout::AoSoA && chunk_size % particleBlockSize != 0) {
+    fprintf(stderr, "The chunk size must be a multiple of %d with layout aosoa: %zu\n", particleBlockSize, chunk_size);
+    return 1;
+  }
+
+  if (particles_file != "") {
+    return stream_binning(particles_file, chunk_size, drop_cache, nBinsX, nBinsY, repeat_times, warmup_times, result_output_file, result_format, result_check_file);
+  }
+
+  if (write_particles_file != "") {
+    InputDataType inputData;
+    set_bin_grid(inputData, nBinsX, nBinsY, maxMagnitudeR);
+    init_input_data(inputData, seed, numDataPoints, distribution == "skewed", generator, layout);
+    if (!write_particle_file(write_particles_file, inputData, seed)) {
+      fprintf(stderr, "Problem writing particle file: %s\n", write_particles_file.c_str());
+      return 1;
+    }
+    printf("Written %ld particles (%.3f GB, %s) to %s\n", numDataPoints, double(numDataPoints * sizeof(Particle)) / 1000000000, layout_name.c_str(), write_particles_file.c_str());
+    free_input_data(inputData);
+    return 0;
+  }
+
+  string action = sort_by_bin == "none" ? "bin" : "sort by bin (" + sort_by_bin + ")";
+  if (!quantities.empty()) {
+    action += " with sums of " + quantities_list + " in " + (compensatedSums ? "compensated " : "") + sum_precision_name;
+  }
+  printf("Measuring time to %s %ld particles (%.3f GP, %s) in %zu×%zu bins using %s\n", action.c_str(), numDataPoints, double(numDataPoints) / 1000000000, layout_name.c_str(), nBinsX, nBinsY,
+#ifdef DOUBLE_PRECISION
+         "double precision"
+#else
+	 "single precision"
+#endif
+);
+
+  vector<double> times;
+  vector<double> pps;
+
+  InputDataType inputData;
+  set_bin_grid(inputData, nBinsX, nBinsY, maxMagnitudeR);
+  // Timed apart from the binning: with mt19937 it takes longer than several runs
+  double generation_time = omp_get_wtime();
+  init_input_data(inputData, seed, numDataPoints, distribution == "skewed", generator, layout);
+  generation_time = omp_get_wtime() - generation_time;
+  printf("Generated the particles with %s in %.2fs ⇒ %5.4g GP/s using %d threads\n", generator_name.c_str(), generation_time,
+         double(numDataPoints) / generation_time / 1000000000, generator == Generator::Philox ? omp_get_max_threads() : 1);
+  prepare_classifier(inputData);
+  if (grids_list != "") {
+    const int status = multi_grid_binning(inputData, grids_list, repeat_times, warmup_times);
+    free_input_data(inputData);
+    return status;
+  }
+  if (window_seconds > 0) {
+    const int status = window_binning(inputData, chunk_size, window_seconds, window_epochs, publish_interval, read_interval, stream_seconds);
+    free_input_data(inputData);
+    return status;
+  }
+  BinsType binnedData;
+  binnedData.resize(nBinsX, nBinsY);
+  SortedParticles sorted;
+  BinSumsType binSums;
+  
+  for (size_t i = 0; i < repeat_times; ++i) {
+    reset_bins(binnedData);
+    binSums.resize(nBinsX, nBinsY, quantities);
+    double elapsed_time = sort_by_bin != "none" ? measure_time(SortParticlesByBin, inputData, sort_output, binnedData, sorted)
+                        : !quantities.empty() ? measure_time(BinParticlesWeighted, inputData, binnedData, binSums)
+                        : measure_time(BinParticles, inputData, binnedData);
+    if (i == 0) {
+      if (!quantities.empty()) {
+        check_sums(inputData, binSums);
+      }
+      if (sort_by_bin != "none") {
+        check_sorted(inputData, sort_output, sorted);
+      }
+      if (result_output_file != "") {
+        write_result(result_output_file, binnedData, result_format, inputData, numDataPoints, seed);
+      }
+      if (result_check_file != "") {
+        check_result(result_check_file, binnedData, inputData);
+      }
+    }
+    if (i >= warmup_times) {
+      times.push_back(elapsed_time);
+      pps.push_back(double(numDataPoints) / elapsed_time);
+    }
+    printf("    Run %2ld/%2ld: %7.2fs ⇒ %5.4g GP/s  %s\n", i + 1, repeat_times, elapsed_time, double(numDataPoints) / elapsed_time / 1000000000, i < warmup_times ? "(warmup)" : "");
+  }
+  
+  double average_time = vector_average(times);
+  double stddev_time = vector_stddev(times);
+  double average_pps = vector_average_harmonic(pps);
+  double stddev_pps = vector_stddev_harmonic(pps);
+  printf(ESC_BOLD "Average time (s): %7.2f±%.2f  GP/s: %5.4g±%.4g " ESC_RESET "   numDataPoints = %ld \n", average_time, stddev_time, average_pps / 1000000000, stddev_pps / 1000000000, numDataPoints);
+
+  if (scaling_threads != "") {
+    report_scaling(scaling_threads, inputData, repeat_times, warmup_times);
+  }
+
+  free_input_data(inputData);
+
+  return 0;
+}
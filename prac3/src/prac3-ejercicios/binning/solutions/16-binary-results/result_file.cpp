@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "result_file.h"
+
+using namespace std;
+
+ResultFileHeader result_file_header(const BinsType& bins, const InputDataType& grid, size_t numDataPoints, size_t seed) {
+  ResultFileHeader header = {};
+  memcpy(header.magic, "BINS", 4);
+  header.version = resultFileVersion;
+  header.nBinsX = bins.nBinsX;
+  header.nBinsY = bins.nBinsY;
+  header.xMin = grid.xMin;
+  header.xMax = grid.xMax;
+  header.yMin = grid.yMin;
+  header.yMax = grid.yMax;
+  header.ftypeSize = sizeof(FTYPE);
+  header.numDataPoints = numDataPoints;
+  header.seed = seed;
+  return header;
+}
+
+// The text is formatted into a buffer with to_chars, a row at a time,
+// instead of with ofstream <<
+static bool write_text(FILE* out, const BinsType& bins) {
+  vector<char> line(size_t(bins.nBinsY) * 12 + 2);
+  for (int i = 0; i < bins.nBinsX; ++i) {
+    char* p = line.data();
+    for (int j = 0; j < bins.nBinsY; ++j) {
+      p = to_chars(p, line.data() + line.size(), bins[i][j]).ptr;
+      *p++ = '\t';
+    }
+    *p++ = '\n';
+    if (fwrite(line.data(), 1, p - line.data(), out) != size_t(p - line.data())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Counts narrowed to T and widened back, a block at a time
+const size_t countBlockSize = 1 << 16;
+
+template<typename T>
+static bool write_counts(FILE* out, const vector<int>& counts) {
+  T block[countBlockSize];
+  for (size_t start = 0; start < counts.size(); start += countBlockSize) {
+    const size_t n = min(countBlockSize, counts.size() - start);
+#pragma omp simd
+    for (size_t b = 0; b < n; b++) {
+      block[b] = T(counts[start + b]);
+    }
+    if (fwrite(block, sizeof(T), n, out) != n) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template<typename T>
+static bool read_counts(FILE* in, vector<int>& counts) {
+  T block[countBlockSize];
+  for (size_t start = 0; start < counts.size(); start += countBlockSize) {
+    const size_t n = min(countBlockSize, counts.size() - start);
+    if (fread(block, sizeof(T), n, in) != n) {
+      return false;
+    }
+#pragma omp simd
+    for (size_t b = 0; b < n; b++) {
+      counts[start + b] = block[b];
+    }
+  }
+  return true;
+}
+
+bool write_result_file(const string& file_name, const BinsType& bins, ResultFormat format, const ResultFileHeader& header) {
+  FILE* out = fopen(file_name.c_str(), "wb");
+  if (out == nullptr) {
+    return false;
+  }
+  bool ok;
+  if (format == ResultFormat::Binary) {
+    const size_t nBins = bins.counts.size();
+    const int* counts = bins.counts.data();
+    int maxCount = 0;
+#pragma omp simd reduction(max:maxCount)
+    for (size_t b = 0; b < nBins; b++) {
+      maxCount = max(maxCount, counts[b]);
+    }
+    ResultFileHeader h = header;
+    h.countSize = maxCount < (1 << 8) ? 1 : maxCount < (1 << 16) ? 2 : 4;
+    ok = fwrite(&h, sizeof(h), 1, out) == 1;
+    if (h.countSize == 1) {
+      ok = ok && write_counts<uint8_t>(out, bins.counts);
+    } else if (h.countSize == 2) {
+      ok = ok && write_counts<uint16_t>(out, bins.counts);
+    } else {
+      ok = ok && fwrite(counts, sizeof(int), nBins, out) == nBins;
+    }
+  } else {
+    ok = write_text(out, bins);
+  }
+  return fclose(out) == 0 && ok;
+}
+
+// Parses the text of a whole file: one line per row of bins, all of the
+// same length; empty lines are skipped
+static bool parse_text(const char* text, const char* end, BinsType& bins) {
+  vector<int> counts;
+  int nBinsX = 0;
+  int nBinsY = 0;
+  const char* p = text;
+  while (p < end) {
+    int n = 0;
+    while (p < end && *p != '\n') {
+      if (*p == ' ' || *p == '\t' || *p == '\r') {
+        ++p;
+        continue;
+      }
+      int count;
+      auto [next, error] = from_chars(p, end, count);
+      if (error != errc()) {
+        return false;
+      }
+      counts.push_back(count);
+      ++n;
+      p = next;
+    }
+    ++p;
+    if (n == 0) {
+      continue;
+    }
+    if (nBinsY != 0 && n != nBinsY) {
+      return false;
+    }
+    nBinsY = n;
+    ++nBinsX;
+  }
+  if (nBinsX == 0) {
+    return false;
+  }
+  bins.nBinsX = nBinsX;
+  bins.nBinsY = nBinsY;
+  bins.counts = move(counts);
+  return true;
+}
+
+bool read_result_file(const string& file_name, BinsType& bins, ResultFormat& format, ResultFileHeader& header) {
+  FILE* in = fopen(file_name.c_str(), "rb");
+  if (in == nullptr) {
+    return false;
+  }
+  unique_ptr<FILE, decltype(&fclose)> closer(in, &fclose);
+  if (fread(&header, sizeof(header), 1, in) == 1 && !memcmp(header.magic, "BINS", 4)) {
+    format = ResultFormat::Binary;
+    if (header.version != resultFileVersion || header.nBinsX == 0 || header.nBinsY == 0 || size_t(header.nBinsX) * header.nBinsY > (1 << 28)) {
+      return false;
+    }
+    bins.resize(header.nBinsX, header.nBinsY);
+    bool ok;
+    if (header.countSize == 1) {
+      ok = read_counts<uint8_t>(in, bins.counts);
+    } else if (header.countSize == 2) {
+      ok = read_counts<uint16_t>(in, bins.counts);
+    } else if (header.countSize == 4) {
+      ok = fread(bins.counts.data(), sizeof(int), bins.counts.size(), in) == bins.counts.size();
+    } else {
+      ok = false;
+    }
+    // Nothing may follow the counts
+    return ok && fgetc(in) == EOF;
+  }
+  format = ResultFormat::Text;
+  header = {};
+  if (fseek(in, 0, SEEK_END) != 0) {
+    return false;
+  }
+  const long size = ftell(in);
+  if (size < 0 || fseek(in, 0, SEEK_SET) != 0) {
+    return false;
+  }
+  vector<char> text(size);
+  return fread(text.data(), 1, size, in) == size_t(size) && parse_text(text.data(), text.data() + size, bins);
+}
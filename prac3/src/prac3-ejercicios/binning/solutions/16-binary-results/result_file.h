@@ -0,0 +1,44 @@
+#ifndef _RESULT_FILE_H_
+#define _RESULT_FILE_H_
+
+#include <cstdint>
+#include <string>
+
+#include "binning.h"
+
+// Result files hold the counts of a BinsType in one of two formats:
+//  - Text: one line per row of bins, each count followed by a tab, as
+//    written by the previous steps and binning-reference-results.
+//  - Binary: this 96-byte header followed by the nBinsX × nBinsY counts
+//    by rows, as unsigned integers of countSize bytes: the fewest of 1,
+//    2 or 4 that hold the largest count. The header also records the
+//    range of the grid and how the result was obtained.
+enum class ResultFormat { Text, Binary };
+
+struct ResultFileHeader {
+  char magic[4];            // "BINS"
+  uint32_t version;
+  uint32_t nBinsX;
+  uint32_t nBinsY;
+  double xMin, xMax, yMin, yMax;
+  uint32_t ftypeSize;       // sizeof(FTYPE) of the binning: 4 or 8
+  uint32_t countSize;       // bytes of each count: 1, 2 or 4
+  uint64_t numDataPoints;   // particles binned
+  uint64_t seed;            // of the generator of the particles, for reference
+  uint8_t padding[24];
+};
+static_assert(sizeof(ResultFileHeader) == 96);
+
+const uint32_t resultFileVersion = 1;
+
+// Header of the binary file of «bins», with the range of «grid»
+ResultFileHeader result_file_header(const BinsType& bins, const InputDataType& grid, size_t numDataPoints, size_t seed);
+
+bool write_result_file(const std::string& file_name, const BinsType& bins, ResultFormat format, const ResultFileHeader& header);
+
+// Reads a result file of either format, told apart by the magic at its
+// start, into «bins» with the shape of the file; «header» is only read
+// from binary files
+bool read_result_file(const std::string& file_name, BinsType& bins, ResultFormat& format, ResultFileHeader& header);
+
+#endif
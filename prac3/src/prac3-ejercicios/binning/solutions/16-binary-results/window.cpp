@@ -0,0 +1,91 @@
+#include <cmath>
+#include <omp.h>
+
+#include "window.h"
+
+using namespace std;
+
+WindowedBinning::WindowedBinning(const InputDataType& grid, double windowSeconds, int nEpochs, double publishInterval)
+  : nBinsX(grid.nBinsX), nBinsY(grid.nBinsY), epochSeconds(windowSeconds / nEpochs), nEpochs(nEpochs), publishInterval(publishInterval) {
+  current.resize(nBinsX, nBinsY);
+  closedSum.resize(nBinsX, nBinsY);
+  publish(0);
+}
+
+void WindowedBinning::ingest(const InputDataType& batch, double time) {
+  const long e = long(floor(time / epochSeconds));
+  if (epoch < 0) {
+    epoch = e;
+  }
+  if (epoch < e) {
+    const double start = omp_get_wtime();
+    // After a gap longer than the window all the epochs have expired:
+    // closing nEpochs + 1 of them is enough to empty it
+    for (long k = 0; epoch + k < e && k <= nEpochs; k++) {
+      close_epoch();
+    }
+    epoch = e;
+    epochTime += omp_get_wtime() - start;
+  }
+
+  BinParticles(batch, current);
+  currentParticles += batch.numDataPoints;
+
+  const double now = omp_get_wtime();
+  if (now - lastPublish >= publishInterval) {
+    publish(time);
+    publishTime += omp_get_wtime() - now;
+  }
+}
+
+void WindowedBinning::close_epoch() {
+  const int nBins = nBinsX * nBinsY;
+  int* sum = closedSum.counts.data();
+  const int* counts = current.counts.data();
+#pragma omp parallel for simd schedule(static)
+  for (int b = 0; b < nBins; b++) {
+    sum[b] += counts[b];
+  }
+  closedSumParticles += currentParticles;
+  closed.push_back(move(current));
+  closedParticles.push_back(currentParticles);
+  currentParticles = 0;
+
+  if (int(closed.size()) > nEpochs) {
+    // The oldest epoch leaves the window, and its bins are reused for
+    // the new one
+    const int* expired = closed.front().counts.data();
+#pragma omp parallel for simd schedule(static)
+    for (int b = 0; b < nBins; b++) {
+      sum[b] -= expired[b];
+    }
+    closedSumParticles -= closedParticles.front();
+    current = move(closed.front());
+    closed.pop_front();
+    closedParticles.pop_front();
+    current.resize(nBinsX, nBinsY);
+  } else {
+    current = BinsType();
+    current.resize(nBinsX, nBinsY);
+  }
+}
+
+void WindowedBinning::publish(double time) {
+  const int nBins = nBinsX * nBinsY;
+  auto snap = make_shared<WindowSnapshot>();
+  snap->bins.resize(nBinsX, nBinsY);
+  int* bins = snap->bins.counts.data();
+  const int* sum = closedSum.counts.data();
+  const int* counts = current.counts.data();
+#pragma omp parallel for simd schedule(static)
+  for (int b = 0; b < nBins; b++) {
+    bins[b] = sum[b] + counts[b];
+  }
+  snap->windowStart = max(epoch - long(closed.size()), 0L) * epochSeconds;
+  snap->time = time;
+  snap->particles = closedSumParticles + currentParticles;
+  snap->publishTime = omp_get_wtime();
+  lastPublish = snap->publishTime;
+  published.store(move(snap));
+  ++snapshots;
+}
@@ -0,0 +1,833 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <omp.h>
+
+using namespace std;
+
+struct ParticleSet {
+  float *x, *y, *z;
+  float *vx, *vy, *vz;
+};
+
+// Adapted to the new SoA: ParticleSet
+void MoveParticles_Orig(const int nParticles, ParticleSet& particle, const float dt) {
+
+  // Loop over particles that experience force
+  for (int i = 0; i < nParticles; i++) {
+
+    // Components of the gravity force on particle i
+    float Fx = 0, Fy = 0, Fz = 0;
+
+    // Loop over particles that exert force: vectorization expected here
+    for (int j = 0; j < nParticles; j++) {
+
+      // Avoid singularity and interaction with self
+      const float softening = 1e-20;
+
+      // Newton's law of universal gravity
+      const float dx = particle.x[j] - particle.x[i];
+      const float dy = particle.y[j] - particle.y[i];
+      const float dz = particle.z[j] - particle.z[i];
+      const float drSquared = dx*dx + dy*dy + dz*dz + softening;
+      const float drPower32 = pow(drSquared, 3.0/2.0);
+
+      // Calculate the net force
+      Fx += dx / drPower32;
+      Fy += dy / drPower32;
+      Fz += dz / drPower32;
+    }
+
+    // Accelerate particles in response to the gravitational force
+    particle.vx[i] += dt*Fx;
+    particle.vy[i] += dt*Fy;
+    particle.vz[i] += dt*Fz;
+  }
+
+  // Move particles according to their velocities
+  // O(N) work, so using a serial loop
+  for (int i = 0 ; i < nParticles; i++) {
+    particle.x[i]  += particle.vx[i]*dt;
+    particle.y[i]  += particle.vy[i]*dt;
+    particle.z[i]  += particle.vz[i]*dt;
+  }
+}
+
+// Barnes–Hut: the particles are grouped in an octree, and the force of
+// a cell that is far enough from a particle is that of its mass at its
+// centre of mass, corrected with its quadrupole moment; only the
+// particles of near leaves are added one by one. This makes a step
+// O(N log N) instead of O(N²), with an error that grows with the
+// opening angle theta: a cell of side s at a distance d of the
+// particles is taken as a whole when s < theta·d.
+float theta = 0.4f;
+
+// Maximum particles in a leaf of the octree
+const int leafSize = 16;
+
+// Maximum particles in a group: the largest subtrees with at most
+// groupSize particles, which share one walk of the tree and its
+// interaction list
+int groupSize = 256;
+
+// Bits of each coordinate in the Morton keys: the octree has at most
+// mortonBits levels below the root
+const int mortonBits = 21;
+
+// Floating point operations counted for each interaction with a
+// particle (as in the previous versions) and with a cell
+const int flopsParticleInteraction = 20;
+const int flopsCellInteraction = 50;
+
+// Interleaves the 21 low bits of v with two zero bits between each
+static inline uint64_t spread_bits(uint64_t v) {
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffffull;
+  v = (v | v << 16) & 0x1f0000ff0000ffull;
+  v = (v | v << 8) & 0x100f00f00f00f00full;
+  v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+  v = (v | v << 2) & 0x1249249249249249ull;
+  return v;
+}
+
+// The inverse of spread_bits
+static inline uint64_t compact_bits(uint64_t v) {
+  v &= 0x1249249249249249ull;
+  v = (v ^ (v >> 2)) & 0x10c30c30c30c30c3ull;
+  v = (v ^ (v >> 4)) & 0x100f00f00f00f00full;
+  v = (v ^ (v >> 8)) & 0x1f0000ff0000ffull;
+  v = (v ^ (v >> 16)) & 0x1f00000000ffffull;
+  v = (v ^ (v >> 32)) & 0x1fffff;
+  return v;
+}
+
+// Cells of one level of the octree while it is built bottom-up: the
+// particles start to start + count - 1 in key order, the level of their
+// box and, for cells already split in nodes, their children.
+struct CellList {
+  vector<int> start, count, level, firstChild, nChildren;
+
+  void resize(int n) {
+    start.resize(n);
+    count.resize(n);
+    level.resize(n);
+    firstChild.resize(n);
+    nChildren.resize(n);
+  }
+};
+
+// Octree of the particles, in SoA, with the buffers of a step so that
+// they are reused by the next one
+struct Octree {
+  // Particles sorted by Morton key: perm[i] is the index in the
+  // ParticleSet of the i-th particle, and (x, y, z) its position
+  vector<uint64_t> keys, keysTmp;
+  vector<int> perm, permTmp;
+  vector<float> x, y, z;
+  vector<float> ax, ay, az;   // accelerations, in key order
+
+  // Cube of the root, with 2^mortonBits cells of the keys in each axis
+  float rootX, rootY, rootZ, rootSide;
+
+  // Nodes, stored children before parents and the root last. A node
+  // has the particles start to start + count - 1; a leaf has no
+  // children, and the children of the rest are nChildren consecutive
+  // nodes from firstChild.
+  vector<int> start, count, firstChild, nChildren;
+  vector<float> boxX, boxY, boxZ, side;   // corner and side of the box
+  vector<float> cx, cy, cz, mass;         // monopole
+  vector<float> qxx, qxy, qxz, qyy, qyz, qzz;  // quadrupole about (cx, cy, cz)
+  int nNodes = 0;
+  vector<int> groups;
+
+  CellList cells, parents;
+  vector<int> heads, emitted;
+
+  // Statistics of the last step
+  double buildTime = 0, forceTime = 0;
+  double particleInteractions = 0, cellInteractions = 0;
+
+  void resize_nodes(int n);
+};
+
+void Octree::resize_nodes(int n) {
+  for (vector<int>* v : {&start, &count, &firstChild, &nChildren}) {
+    v->resize(n);
+  }
+  for (vector<float>* v : {&boxX, &boxY, &boxZ, &side, &cx, &cy, &cz, &mass,
+                           &qxx, &qxy, &qxz, &qyy, &qyz, &qzz}) {
+    v->resize(n);
+  }
+}
+
+// Exclusive prefix sum of v[0..n-1], in place; returns the total
+static int exclusive_sum(vector<int>& v, int n) {
+  vector<int> partial(omp_get_max_threads() + 1, 0);
+  int total = 0;
+#pragma omp parallel
+  {
+    const int nThreads = omp_get_num_threads(), t = omp_get_thread_num();
+    const int b = long(n) * t / nThreads, e = long(n) * (t + 1) / nThreads;
+    int sum = 0;
+    for (int i = b; i < e; i++) {
+      sum += v[i];
+    }
+    partial[t + 1] = sum;
+#pragma omp barrier
+#pragma omp single
+    {
+      for (int k = 0; k < nThreads; k++) {
+        partial[k + 1] += partial[k];
+      }
+      total = partial[nThreads];
+    }
+    sum = partial[t];
+    for (int i = b; i < e; i++) {
+      const int c = v[i];
+      v[i] = sum;
+      sum += c;
+    }
+  }
+  return total;
+}
+
+// Sorts keys, and perm with them, with a parallel LSD radix sort of
+// 8-bit digits: each thread counts the digits of its range, the counts
+// of all threads give by prefix sums the position of each thread in
+// each digit, and each thread scatters its range there. Passes in which
+// all keys have the same digit are skipped.
+static void sort_by_key(Octree& t, int n) {
+  const int digitBits = 8, nDigits = 1 << digitBits;
+  vector<int> counts(size_t(omp_get_max_threads()) * nDigits);
+  for (int shift = 0; shift < 3 * mortonBits; shift += digitBits) {
+    bool skip = false;
+#pragma omp parallel
+    {
+      const int nThreads = omp_get_num_threads(), th = omp_get_thread_num();
+      const int b = long(n) * th / nThreads, e = long(n) * (th + 1) / nThreads;
+      int* c = &counts[size_t(th) * nDigits];
+      fill(c, c + nDigits, 0);
+      for (int i = b; i < e; i++) {
+        c[(t.keys[i] >> shift) & (nDigits - 1)]++;
+      }
+#pragma omp barrier
+#pragma omp single
+      {
+        int sum = 0;
+        for (int d = 0; d < nDigits; d++) {
+          int total = 0;
+          for (int k = 0; k < nThreads; k++) {
+            const int ck = counts[size_t(k) * nDigits + d];
+            counts[size_t(k) * nDigits + d] = sum;
+            sum += ck;
+            total += ck;
+          }
+          skip = skip || total == n;
+        }
+      }
+      if (!skip) {
+        for (int i = b; i < e; i++) {
+          const int to = c[(t.keys[i] >> shift) & (nDigits - 1)]++;
+          t.keysTmp[to] = t.keys[i];
+          t.permTmp[to] = t.perm[i];
+        }
+      }
+    }
+    if (!skip) {
+      swap(t.keys, t.keysTmp);
+      swap(t.perm, t.permTmp);
+    }
+  }
+}
+
+// Copies the cell c of «cells» into the node «node» and computes its box
+// and moments: from its particles for a leaf, from those of its
+// children, already computed, for the rest
+static void make_node(Octree& t, const CellList& cells, int c, int node) {
+  const int start = cells.start[c], count = cells.count[c], level = cells.level[c];
+  const int firstChild = cells.firstChild[c], nChildren = cells.nChildren[c];
+  t.start[node] = start;
+  t.count[node] = count;
+  t.firstChild[node] = firstChild;
+  t.nChildren[node] = nChildren;
+
+  // Box of the cell: the key of any of its particles without the bits
+  // below its level
+  const int shift = mortonBits - level;
+  const float side = t.rootSide / float(1 << level);
+  const uint64_t key = t.keys[start];
+  t.side[node] = side;
+  t.boxX[node] = t.rootX + float(compact_bits(key >> 2) >> shift) * side;
+  t.boxY[node] = t.rootY + float(compact_bits(key >> 1) >> shift) * side;
+  t.boxZ[node] = t.rootZ + float(compact_bits(key) >> shift) * side;
+
+  double m = 0, sx = 0, sy = 0, sz = 0;
+  double qxx = 0, qxy = 0, qxz = 0, qyy = 0, qyz = 0, qzz = 0;
+  if (nChildren == 0) {
+    for (int i = start; i < start + count; i++) {
+      sx += t.x[i];
+      sy += t.y[i];
+      sz += t.z[i];
+    }
+    m = count;
+    sx /= m; sy /= m; sz /= m;
+    for (int i = start; i < start + count; i++) {
+      const double dx = t.x[i] - sx, dy = t.y[i] - sy, dz = t.z[i] - sz;
+      const double d2 = dx*dx + dy*dy + dz*dz;
+      qxx += 3*dx*dx - d2; qxy += 3*dx*dy; qxz += 3*dx*dz;
+      qyy += 3*dy*dy - d2; qyz += 3*dy*dz; qzz += 3*dz*dz - d2;
+    }
+  } else {
+    for (int k = firstChild; k < firstChild + nChildren; k++) {
+      m += t.mass[k];
+      sx += double(t.mass[k]) * t.cx[k];
+      sy += double(t.mass[k]) * t.cy[k];
+      sz += double(t.mass[k]) * t.cz[k];
+    }
+    sx /= m; sy /= m; sz /= m;
+    // Parallel axis theorem: the quadrupole of each child moved to the
+    // centre of mass of the node
+    for (int k = firstChild; k < firstChild + nChildren; k++) {
+      const double mk = t.mass[k];
+      const double dx = t.cx[k] - sx, dy = t.cy[k] - sy, dz = t.cz[k] - sz;
+      const double d2 = dx*dx + dy*dy + dz*dz;
+      qxx += t.qxx[k] + mk*(3*dx*dx - d2); qxy += t.qxy[k] + mk*3*dx*dy; qxz += t.qxz[k] + mk*3*dx*dz;
+      qyy += t.qyy[k] + mk*(3*dy*dy - d2); qyz += t.qyz[k] + mk*3*dy*dz; qzz += t.qzz[k] + mk*(3*dz*dz - d2);
+    }
+  }
+  t.mass[node] = m;
+  t.cx[node] = sx; t.cy[node] = sy; t.cz[node] = sz;
+  t.qxx[node] = qxx; t.qxy[node] = qxy; t.qxz[node] = qxz;
+  t.qyy[node] = qyy; t.qyz[node] = qyz; t.qzz[node] = qzz;
+}
+
+// Builds the octree of the particles:
+//  1. Morton key of each particle in the cube of their bounding box, and
+//     radix sort of the particles by key, so that the particles of any
+//     cell of the octree are consecutive.
+//  2. Bottom-up construction, one level at a time from the deepest: the
+//     cells of a level are the runs of particles with the same key
+//     prefix, and each cell of the level above is a run of consecutive
+//     cells of this one. When a parent has more than leafSize particles
+//     its children become nodes; otherwise it is a leaf candidate and
+//     its children are dropped. A parent with a single child is replaced
+//     by it, so that chains of nodes with one child are never stored.
+// Each level is a few parallel loops with prefix sums to place the
+// parents and the nodes, which are written without synchronisation.
+static void build_octree(const int nParticles, const ParticleSet& particle, Octree& t) {
+  const int n = nParticles;
+  t.keys.resize(n); t.keysTmp.resize(n);
+  t.perm.resize(n); t.permTmp.resize(n);
+  t.x.resize(n); t.y.resize(n); t.z.resize(n);
+  t.ax.resize(n); t.ay.resize(n); t.az.resize(n);
+
+  float minX = particle.x[0], minY = particle.y[0], minZ = particle.z[0];
+  float maxX = minX, maxY = minY, maxZ = minZ;
+#pragma omp parallel for simd reduction(min:minX,minY,minZ) reduction(max:maxX,maxY,maxZ)
+  for (int i = 0; i < n; i++) {
+    minX = min(minX, particle.x[i]); maxX = max(maxX, particle.x[i]);
+    minY = min(minY, particle.y[i]); maxY = max(maxY, particle.y[i]);
+    minZ = min(minZ, particle.z[i]); maxZ = max(maxZ, particle.z[i]);
+  }
+  // Slightly larger than the bounding box, so that no key overflows
+  const float side = max({maxX - minX, maxY - minY, maxZ - minZ, 1e-30f}) * 1.0001f;
+  t.rootX = minX; t.rootY = minY; t.rootZ = minZ; t.rootSide = side;
+
+  const float keysPerUnit = float(1 << mortonBits) / side;
+  const int maxKey = (1 << mortonBits) - 1;
+  uint64_t* keys = t.keys.data();
+  int* perm = t.perm.data();
+#pragma omp parallel for simd
+  for (int i = 0; i < n; i++) {
+    const int kx = min(int((particle.x[i] - minX) * keysPerUnit), maxKey);
+    const int ky = min(int((particle.y[i] - minY) * keysPerUnit), maxKey);
+    const int kz = min(int((particle.z[i] - minZ) * keysPerUnit), maxKey);
+    keys[i] = spread_bits(kx) << 2 | spread_bits(ky) << 1 | spread_bits(kz);
+    perm[i] = i;
+  }
+  sort_by_key(t, n);
+#pragma omp parallel for simd
+  for (int i = 0; i < n; i++) {
+    t.x[i] = particle.x[perm[i]];
+    t.y[i] = particle.y[perm[i]];
+    t.z[i] = particle.z[perm[i]];
+  }
+
+  // Cells of the deepest level: runs of equal keys
+  CellList& cells = t.cells;
+  CellList& parents = t.parents;
+  t.heads.resize(n + 1);
+  t.emitted.resize(n + 1);
+#pragma omp parallel for simd
+  for (int i = 0; i < n; i++) {
+    t.heads[i] = i == 0 || t.keys[i] != t.keys[i - 1];
+  }
+  int nCells = exclusive_sum(t.heads, n);
+  cells.resize(nCells);
+#pragma omp parallel for
+  for (int i = 0; i < n; i++) {
+    if (i == 0 || t.keys[i] != t.keys[i - 1]) {
+      cells.start[t.heads[i]] = i;
+    }
+  }
+#pragma omp parallel for simd
+  for (int c = 0; c < nCells; c++) {
+    const int end = c + 1 < nCells ? cells.start[c + 1] : n;
+    cells.count[c] = end - cells.start[c];
+    cells.level[c] = mortonBits;
+    cells.firstChild[c] = -1;
+    cells.nChildren[c] = 0;
+  }
+
+  t.nNodes = 0;
+  for (int level = mortonBits - 1; level >= 0; level--) {
+    // Parents: runs of cells with the same key prefix at this level
+    const int shift = 3 * (mortonBits - level);
+#pragma omp parallel for simd
+    for (int c = 0; c < nCells; c++) {
+      t.heads[c] = c == 0 || (t.keys[cells.start[c]] >> shift) != (t.keys[cells.start[c - 1]] >> shift);
+    }
+    const int nParents = exclusive_sum(t.heads, nCells);
+    parents.resize(nParents);
+#pragma omp parallel for
+    for (int c = 0; c < nCells; c++) {
+      if (c == 0 || (t.keys[cells.start[c]] >> shift) != (t.keys[cells.start[c - 1]] >> shift)) {
+        parents.firstChild[t.heads[c]] = c;
+      }
+    }
+#pragma omp parallel for
+    for (int p = 0; p < nParents; p++) {
+      const int first = parents.firstChild[p];
+      const int end = p + 1 < nParents ? parents.firstChild[p + 1] : nCells;
+      int count = 0;
+      for (int c = first; c < end; c++) {
+        count += cells.count[c];
+      }
+      parents.start[p] = cells.start[first];
+      parents.count[p] = count;
+      parents.nChildren[p] = end - first;
+      t.emitted[p] = count > leafSize && end - first > 1 ? end - first : 0;
+    }
+
+    // Nodes of the children of the parents that are split
+    const int nEmitted = exclusive_sum(t.emitted, nParents);
+    const int base = t.nNodes;
+    t.resize_nodes(base + nEmitted);
+#pragma omp parallel for schedule(dynamic, 64)
+    for (int p = 0; p < nParents; p++) {
+      const int first = parents.firstChild[p], nChildren = parents.nChildren[p];
+      if (nChildren == 1) {
+        // Replaced by its only child
+        parents.level[p] = cells.level[first];
+        parents.firstChild[p] = cells.firstChild[first];
+        parents.nChildren[p] = cells.nChildren[first];
+      } else if (parents.count[p] > leafSize) {
+        for (int k = 0; k < nChildren; k++) {
+          make_node(t, cells, first + k, base + t.emitted[p] + k);
+        }
+        parents.level[p] = level;
+        parents.firstChild[p] = base + t.emitted[p];
+      } else {
+        parents.level[p] = level;
+        parents.firstChild[p] = -1;
+        parents.nChildren[p] = 0;
+      }
+    }
+    t.nNodes = base + nEmitted;
+    swap(cells, parents);
+    nCells = nParents;
+  }
+
+  // The root
+  assert(nCells == 1);
+  t.resize_nodes(t.nNodes + 1);
+  make_node(t, cells, 0, t.nNodes);
+  t.nNodes++;
+
+  // Groups, from the root down
+  t.groups.clear();
+  vector<int> stack(1, t.nNodes - 1);
+  while (!stack.empty()) {
+    const int k = stack.back();
+    stack.pop_back();
+    if (t.count[k] <= groupSize || t.nChildren[k] == 0) {
+      t.groups.push_back(k);
+    } else {
+      for (int c = t.firstChild[k]; c < t.firstChild[k] + t.nChildren[k]; c++) {
+        stack.push_back(c);
+      }
+    }
+  }
+}
+
+// Cells and particles whose forces act on the particles of a group, in
+// SoA so that they are evaluated with unit-stride vector loops. The walk
+// only records the indices of the cells, gathered at the end.
+struct InteractionList {
+  vector<int> cells;
+  vector<float> px, py, pz;
+  vector<float> cx, cy, cz, mass, qxx, qxy, qxz, qyy, qyz, qzz;
+};
+
+// Builds the interaction list of the group «group» walking the tree from
+// the root: a node is opened when its box overlaps the bounding box of
+// the particles of the group or is not far enough from it for theta
+static void interaction_list(const Octree& t, int group, InteractionList& list, vector<int>& stack) {
+  const int start = t.start[group], end = start + t.count[group];
+  float minX = t.x[start], minY = t.y[start], minZ = t.z[start];
+  float maxX = minX, maxY = minY, maxZ = minZ;
+  for (int i = start + 1; i < end; i++) {
+    minX = min(minX, t.x[i]); maxX = max(maxX, t.x[i]);
+    minY = min(minY, t.y[i]); maxY = max(maxY, t.y[i]);
+    minZ = min(minZ, t.z[i]); maxZ = max(maxZ, t.z[i]);
+  }
+  const float theta2 = theta * theta;
+
+  list.cells.clear();
+  list.px.clear(); list.py.clear(); list.pz.clear();
+  stack.clear();
+  stack.push_back(t.nNodes - 1);
+  while (!stack.empty()) {
+    const int k = stack.back();
+    stack.pop_back();
+
+    const float side = t.side[k];
+    const bool overlaps = t.boxX[k] <= maxX && t.boxX[k] + side >= minX
+      && t.boxY[k] <= maxY && t.boxY[k] + side >= minY
+      && t.boxZ[k] <= maxZ && t.boxZ[k] + side >= minZ;
+    const float dx = max(max(minX - t.cx[k], t.cx[k] - maxX), 0.0f);
+    const float dy = max(max(minY - t.cy[k], t.cy[k] - maxY), 0.0f);
+    const float dz = max(max(minZ - t.cz[k], t.cz[k] - maxZ), 0.0f);
+    if (!overlaps && side * side < theta2 * (dx*dx + dy*dy + dz*dz)) {
+      list.cells.push_back(k);
+    } else if (t.nChildren[k] == 0) {
+      const float *x = t.x.data(), *y = t.y.data(), *z = t.z.data();
+      const int s = t.start[k], e = s + t.count[k];
+      list.px.insert(list.px.end(), x + s, x + e);
+      list.py.insert(list.py.end(), y + s, y + e);
+      list.pz.insert(list.pz.end(), z + s, z + e);
+    } else {
+      for (int c = t.firstChild[k]; c < t.firstChild[k] + t.nChildren[k]; c++) {
+        stack.push_back(c);
+      }
+    }
+  }
+
+  const int nC = list.cells.size();
+  for (vector<float>* v : {&list.cx, &list.cy, &list.cz, &list.mass, &list.qxx, &list.qxy, &list.qxz, &list.qyy, &list.qyz, &list.qzz}) {
+    v->resize(nC);
+  }
+  const int* cells = list.cells.data();
+#pragma omp simd
+  for (int c = 0; c < nC; c++) {
+    const int k = cells[c];
+    list.cx[c] = t.cx[k]; list.cy[c] = t.cy[k]; list.cz[c] = t.cz[k];
+    list.mass[c] = t.mass[k];
+    list.qxx[c] = t.qxx[k]; list.qxy[c] = t.qxy[k]; list.qxz[c] = t.qxz[k];
+    list.qyy[c] = t.qyy[k]; list.qyz[c] = t.qyz[k]; list.qzz[c] = t.qzz[k];
+  }
+}
+
+// Accelerations of the particles of each group from its interaction
+// list: one vector loop over the particles and one over the cells of
+// the list for each particle of the group
+static void compute_forces(Octree& t) {
+  double particleInteractions = 0, cellInteractions = 0;
+  const int nGroups = t.groups.size();
+#pragma omp parallel reduction(+:particleInteractions,cellInteractions)
+  {
+    InteractionList list;
+    vector<int> stack;
+#pragma omp for schedule(dynamic, 4)
+    for (int g = 0; g < nGroups; g++) {
+      const int group = t.groups[g];
+      interaction_list(t, group, list, stack);
+      const int nP = list.px.size(), nC = list.cx.size();
+      const float *px = list.px.data(), *py = list.py.data(), *pz = list.pz.data();
+      const float *cx = list.cx.data(), *cy = list.cy.data(), *cz = list.cz.data(), *mass = list.mass.data();
+      const float *qxx = list.qxx.data(), *qxy = list.qxy.data(), *qxz = list.qxz.data();
+      const float *qyy = list.qyy.data(), *qyz = list.qyz.data(), *qzz = list.qzz.data();
+
+      for (int i = t.start[group]; i < t.start[group] + t.count[group]; i++) {
+        const float x = t.x[i], y = t.y[i], z = t.z[i];
+
+        // Components of the gravity force on particle i
+        float Fx = 0, Fy = 0, Fz = 0;
+
+        // Particles of the near leaves, as in the previous versions
+#pragma omp simd reduction(+:Fx,Fy,Fz)
+        for (int j = 0; j < nP; j++) {
+          const float softening = 1e-20f;
+          const float dx = px[j] - x;
+          const float dy = py[j] - y;
+          const float dz = pz[j] - z;
+          const float rr = 1.0f/sqrtf(dx*dx + dy*dy + dz*dz + softening);
+          const float drPowerN32 = rr*rr*rr;
+          Fx += dx * drPowerN32;
+          Fy += dy * drPowerN32;
+          Fz += dz * drPowerN32;
+        }
+
+        // Far cells: with r from the particle to the centre of mass,
+        // F = M r/|r|³ - Q r/|r|⁵ + 5/2 (rᵀQ r) r/|r|⁷
+#pragma omp simd reduction(+:Fx,Fy,Fz)
+        for (int c = 0; c < nC; c++) {
+          const float dx = cx[c] - x;
+          const float dy = cy[c] - y;
+          const float dz = cz[c] - z;
+          const float rr = 1.0f/sqrtf(dx*dx + dy*dy + dz*dz);
+          const float rr2 = rr*rr;
+          const float rr3 = rr*rr2;
+          const float rr5 = rr3*rr2;
+          const float Qx = qxx[c]*dx + qxy[c]*dy + qxz[c]*dz;
+          const float Qy = qxy[c]*dx + qyy[c]*dy + qyz[c]*dz;
+          const float Qz = qxz[c]*dx + qyz[c]*dy + qzz[c]*dz;
+          const float rQr = dx*Qx + dy*Qy + dz*Qz;
+          const float radial = mass[c]*rr3 + 2.5f*rQr*rr5*rr2;
+          Fx += radial*dx - rr5*Qx;
+          Fy += radial*dy - rr5*Qy;
+          Fz += radial*dz - rr5*Qz;
+        }
+
+        t.ax[i] = Fx;
+        t.ay[i] = Fy;
+        t.az[i] = Fz;
+      }
+      particleInteractions += double(t.count[group]) * nP;
+      cellInteractions += double(t.count[group]) * nC;
+    }
+  }
+  t.particleInteractions = particleInteractions;
+  t.cellInteractions = cellInteractions;
+}
+
+void MoveParticles(const int nParticles, ParticleSet& particle, const float dt, Octree& tree) {
+
+  const double tStart = omp_get_wtime();
+  build_octree(nParticles, particle, tree);
+  const double tBuilt = omp_get_wtime();
+  compute_forces(tree);
+  tree.buildTime = tBuilt - tStart;
+  tree.forceTime = omp_get_wtime() - tBuilt;
+
+  // Accelerate particles in response to the gravitational force
+  const int* perm = tree.perm.data();
+#pragma omp parallel for simd
+  for (int i = 0; i < nParticles; i++) {
+    particle.vx[perm[i]] += dt*tree.ax[i];
+    particle.vy[perm[i]] += dt*tree.ay[i];
+    particle.vz[perm[i]] += dt*tree.az[i];
+  }
+
+  // Move particles according to their velocities
+#pragma omp parallel for simd
+  for (int i = 0 ; i < nParticles; i++) {
+    particle.x[i]  += particle.vx[i]*dt;
+    particle.y[i]  += particle.vy[i]*dt;
+    particle.z[i]  += particle.vz[i]*dt;
+  }
+}
+
+// The tree adds the forces in another order and approximates those of
+// far cells, so the velocities cannot match component by component to
+// an absolute tolerance: a particle near another gets changes of
+// velocity of thousands, and a small component of a large change has
+// the error of the whole. So the error of the change of velocity of
+// each particle, from those of «initial», is relative to its magnitude
+// (absolute below 1), and that of the positions to their value.
+const float tolerance = 1e-2f;
+
+static bool differs(float a, float b) {
+  return abs(a - b) > tolerance * max(1.0f, abs(a));
+}
+
+bool compare_particle_arrays(int nParticles, const ParticleSet& initial, const ParticleSet& a, const ParticleSet& b) {
+  for(int i = 0; i < nParticles; i++) {
+    if (differs(a.x[i], b.x[i])) {
+      printf("%d x %g %g %g\n", i, a.x[i], b.x[i], abs(a.x[i] - b.x[i]));
+      return false;
+    }
+    if (differs(a.y[i], b.y[i])) {
+      printf("%d y %g %g %g\n", i, a.y[i], b.y[i], abs(a.y[i] - b.y[i]));
+      return false;
+    }
+    if (differs(a.z[i], b.z[i])) {
+      printf("%d z %g %g %g\n", i, a.z[i], b.z[i], abs(a.z[i] - b.z[i]));
+      return false;
+    }
+    const float dvx = a.vx[i] - initial.vx[i], dvy = a.vy[i] - initial.vy[i], dvz = a.vz[i] - initial.vz[i];
+    const float ex = b.vx[i] - a.vx[i], ey = b.vy[i] - a.vy[i], ez = b.vz[i] - a.vz[i];
+    const float dv = sqrtf(dvx*dvx + dvy*dvy + dvz*dvz), error = sqrtf(ex*ex + ey*ey + ez*ez);
+    if (error > tolerance * max(1.0f, dv)) {
+      printf("%d v (%g %g %g) (%g %g %g) %g\n", i, a.vx[i], a.vy[i], a.vz[i], b.vx[i], b.vy[i], b.vz[i], error);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Relative error of the changes of velocity of b, from those of a,
+// both from the velocities of «initial»: root mean square and maximum.
+// Particles whose velocity does not change in a (a lone particle) have
+// no relative error and are left out; with none left both are 0
+void velocity_change_error(int nParticles, const ParticleSet& initial, const ParticleSet& a, const ParticleSet& b,
+                           double& rmsError, double& maxError) {
+  rmsError = 0;
+  maxError = 0;
+  int nSamples = 0;
+  for (int i = 0; i < nParticles; i++) {
+    const double ax = a.vx[i] - initial.vx[i], ay = a.vy[i] - initial.vy[i], az = a.vz[i] - initial.vz[i];
+    const double ex = b.vx[i] - a.vx[i], ey = b.vy[i] - a.vy[i], ez = b.vz[i] - a.vz[i];
+    const double change = ax*ax + ay*ay + az*az;
+    if (change == 0) {
+      continue;
+    }
+    const double error = sqrt((ex*ex + ey*ey + ez*ez) / change);
+    rmsError += error * error;
+    maxError = max(maxError, error);
+    nSamples++;
+  }
+  rmsError = nSamples > 0 ? sqrt(rmsError / nSamples) : 0;
+}
+
+ParticleSet alloc_particle_set(int nParticles) {
+  ParticleSet particle;
+  const size_t bytes = (sizeof(float)*nParticles + 63) / 64 * 64;
+  particle.x  = (float*) aligned_alloc(64, bytes);
+  particle.y  = (float*) aligned_alloc(64, bytes);
+  particle.z  = (float*) aligned_alloc(64, bytes);
+  particle.vx = (float*) aligned_alloc(64, bytes);
+  particle.vy = (float*) aligned_alloc(64, bytes);
+  particle.vz = (float*) aligned_alloc(64, bytes);
+  return particle;
+}
+
+void free_particle_set(ParticleSet& particle) {
+  free( particle.x );
+  free( particle.y );
+  free( particle.z );
+  free( particle.vx );
+  free( particle.vy );
+  free( particle.vz );
+}
+
+// MoveParticles_Orig is O(N²), so the result is checked on the first
+// particles only, as a problem of their own
+const int maxCheckParticles = 16384;
+
+int main(const int argc, const char** argv) {
+
+  // Problem size and other parameters
+  const int nParticles = (argc > 1 ? atoi(argv[1]) : 16384);
+  theta = (argc > 2 ? atof(argv[2]) : theta);
+  groupSize = (argc > 3 ? atoi(argv[3]) : groupSize);
+  if (theta < 0) {
+    fprintf(stderr, "Incorrect theta (0 or greater): %s\n", argv[2]);
+    return 1;
+  }
+  if (groupSize < 1) {
+    fprintf(stderr, "Incorrect group size (1 or greater): %s\n", argv[3]);
+    return 1;
+  }
+  const int nSteps = 10;  // Duration of test
+  const float dt = 0.01f; // Particle propagation time step
+
+  // Particle data stored as a Structure of Arrays (SoA)
+  // this may not be good in object-oriented programming,
+  // however, makes vectorization much more efficient
+  ParticleSet particle = alloc_particle_set(nParticles);
+
+  // Initialize random number generator and particles
+  mt19937 generator(0); // 32 bit Mersenne Twister pseudo-random generator
+  uniform_real_distribution<float> distribution(0,1);
+  for(int i = 0; i < nParticles; i++) {
+    particle.x[i] = distribution(generator);
+    particle.y[i] = distribution(generator);
+    particle.z[i] = distribution(generator);
+    particle.vx[i] = distribution(generator);
+    particle.vy[i] = distribution(generator);
+    particle.vz[i] = distribution(generator);
+  }
+
+  // Para calcular el resultado orginal y comprobar que da lo mismo, con
+  // las primeras nCheck partículas
+  const int nCheck = min(nParticles, maxCheckParticles);
+  ParticleSet particle_reference = alloc_particle_set(nCheck);
+  ParticleSet particle_check = alloc_particle_set(nCheck);
+  // Setting particle_reference and particle_check to the same initial values
+  for(int i = 0; i < nCheck; i++) {
+    particle_reference.x[i] = particle_check.x[i] = particle.x[i];
+    particle_reference.y[i] = particle_check.y[i] = particle.y[i];
+    particle_reference.z[i] = particle_check.z[i] = particle.z[i];
+    particle_reference.vx[i] = particle_check.vx[i] = particle.vx[i];
+    particle_reference.vy[i] = particle_check.vy[i] = particle.vy[i];
+    particle_reference.vz[i] = particle_check.vz[i] = particle.vz[i];
+  }
+  // Calcualte reference solution
+  MoveParticles_Orig(nCheck, particle_reference, dt);
+  Octree tree;
+  MoveParticles(nCheck, particle_check, dt, tree);
+  double rmsError, maxError;
+  velocity_change_error(nCheck, particle, particle_reference, particle_check, rmsError, maxError);
+  if (!compare_particle_arrays(nCheck, particle, particle_reference, particle_check)) {
+    printf("Relative error of the changes of velocity: %.2e rms, %.2e maximum.\n", rmsError, maxError);
+    printf("-----------------------------------------------------\n");
+    printf("\033[31mDO PANIC: The final result is wrong \033[0m\n");
+    printf("-----------------------------------------------------\n");
+    return 1;
+  }
+
+  // Perform benchmark
+  printf("\n\033[1mNBODY Version 06 (Barnes-Hut, theta = %g, groups of %d)\033[0m\n", theta, groupSize);
+  printf("\nPropagating %d particles using %d threads on %s...\n\n",
+	 nParticles, omp_get_max_threads(), "CPU");
+  double rate = 0, dRate = 0; // Benchmarking data
+  double time = 0, buildTime = 0;
+  const int skipSteps = 3; // Skip first iterations to warm-up
+  printf("\033[1m%5s %10s %10s %10s %10s %8s\033[0m\n", "Step", "Time, s", "Build, s", "Forces, s", "Interact/s", "GFLOP/s"); fflush(stdout);
+  for (int step = 1; step <= nSteps; step++) {
+
+    const double tStart = omp_get_wtime(); // Start timing
+    MoveParticles(nParticles, particle, dt, tree);
+    const double tEnd = omp_get_wtime(); // End timing
+
+    // Interactions actually computed, with particles and with cells
+    const double HztoInts   = tree.particleInteractions + tree.cellInteractions;
+    const double HztoGFLOPs = 1e-9*(flopsParticleInteraction*tree.particleInteractions + flopsCellInteraction*tree.cellInteractions);
+
+    if (step > skipSteps) { // Collect statistics
+      rate  += HztoGFLOPs/(tEnd - tStart);
+      dRate += HztoGFLOPs*HztoGFLOPs/((tEnd - tStart)*(tEnd-tStart));
+      time += tEnd - tStart;
+      buildTime += tree.buildTime;
+    }
+
+    printf("%5d %10.3e %10.3e %10.3e %10.3e %8.1f %s\n",
+	   step, (tEnd-tStart), tree.buildTime, tree.forceTime, HztoInts/(tEnd-tStart), HztoGFLOPs/(tEnd-tStart), (step<=skipSteps?"*":""));
+    fflush(stdout);
+  }
+  rate/=(double)(nSteps-skipSteps);
+  dRate=sqrt(dRate/(double)(nSteps-skipSteps)-rate*rate);
+  printf("-----------------------------------------------------\n");
+  printf("\033[1m%s %4s \033[32m%10.1f +- %.1f GFLOP/s\033[0m\n",
+	 "Average performance:", "", rate, dRate);
+  printf("\033[1m%s %3s %10.3e s (build %.3e s), %d nodes\033[0m\n",
+	 "Average time per step:", "", time/(nSteps-skipSteps), buildTime/(nSteps-skipSteps), tree.nNodes);
+  printf("-----------------------------------------------------\n");
+  printf("Interactions per particle in the last step: %.0f with particles, %.0f with cells.\n",
+	 tree.particleInteractions/nParticles, tree.cellInteractions/nParticles);
+  printf("* - warm-up, not included in average.\n");
+  printf("The result after 1 iteration of %d particles was correct.\n", nCheck);
+  printf("Relative error of the changes of velocity: %.2e rms, %.2e maximum.\n\n", rmsError, maxError);
+
+  free_particle_set(particle);
+  free_particle_set(particle_reference);
+  free_particle_set(particle_check);
+
+  return 0;
+}
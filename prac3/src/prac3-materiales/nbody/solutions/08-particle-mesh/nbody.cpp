@@ -0,0 +1,920 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <omp.h>
+
+using namespace std;
+
+struct ParticleSet {
+  float *x, *y, *z;
+  float *vx, *vy, *vz;
+};
+
+// Adapted to the new SoA: ParticleSet
+void MoveParticles_Orig(const int nParticles, ParticleSet& particle, const float dt) {
+
+  // Loop over particles that experience force
+  for (int i = 0; i < nParticles; i++) {
+
+    // Components of the gravity force on particle i
+    float Fx = 0, Fy = 0, Fz = 0;
+
+    // Loop over particles that exert force: vectorization expected here
+    for (int j = 0; j < nParticles; j++) {
+
+      // Avoid singularity and interaction with self
+      const float softening = 1e-20;
+
+      // Newton's law of universal gravity
+      const float dx = particle.x[j] - particle.x[i];
+      const float dy = particle.y[j] - particle.y[i];
+      const float dz = particle.z[j] - particle.z[i];
+      const float drSquared = dx*dx + dy*dy + dz*dz + softening;
+      const float drPower32 = pow(drSquared, 3.0/2.0);
+
+      // Calculate the net force
+      Fx += dx / drPower32;
+      Fy += dy / drPower32;
+      Fz += dz / drPower32;
+    }
+
+    // Accelerate particles in response to the gravitational force
+    particle.vx[i] += dt*Fx;
+    particle.vy[i] += dt*Fy;
+    particle.vz[i] += dt*Fz;
+  }
+
+  // Move particles according to their velocities
+  // O(N) work, so using a serial loop
+  for (int i = 0 ; i < nParticles; i++) {
+    particle.x[i]  += particle.vx[i]*dt;
+    particle.y[i]  += particle.vy[i]*dt;
+    particle.z[i]  += particle.vz[i]*dt;
+  }
+}
+
+// Particle-mesh with a short-range correction (P³M): the force is split
+// as 1/r² = [erf + ...] + [erfc + ...] at a scale rs of a few cells of a
+// mesh. The smooth long-range part is solved on the mesh:
+//  1. Cloud-in-cell assignment of the mass of the particles to the mesh.
+//  2. Convolution of the mass with the long-range force, by FFT: the mesh
+//     is padded to twice its size with zeros, so that the convolution is
+//     that of isolated particles, not of a periodic box.
+//  3. Cloud-in-cell interpolation of the force back to each particle.
+// The short-range part, which vanishes beyond a cutoff of a few rs, is
+// added pair by pair with the particles of the neighbouring cells. For
+// particles spread uniformly a step is O(N + M log M), with M cells.
+//
+// The mesh covers the bulk of the particles, not their bounding box:
+// particles that get close to others are shot far away, and a mesh over
+// all of them would leave the rest in a few cells. The particles outside
+// the mesh see the bulk as its mass at its centre of mass, and the bulk
+// sees their pull as a uniform field, plus their forces among them.
+
+// Cells of the mesh in each axis, a power of 2 (0: the smallest with
+// cellsPerParticle cells per particle, up to maxMeshSize: with fewer, the
+// short-range part, which grows with the particles in a cutoff sphere,
+// takes longer than the FFTs)
+int meshSize = 0;
+const int minMeshSize = 16;
+const int maxMeshSize = 256;
+const int cellsPerParticle = 8;
+
+// Split scale rs of the force, in cells of the mesh, and cutoff of the
+// short-range part, in units of rs: erfc(x) + 2x/√π·exp(-x²), with
+// x = r/(2rs), is 1.8·10⁻² at r = 4.5rs
+float splitRadius = 2.0f;
+const float cutoffRadii = 4.5f;
+
+// Cells of the short-range part in the cutoff: each cell gets the
+// particles of the cells up to shortRangeCells away
+const int shortRangeCells = 2;
+
+// The mesh covers, in each axis, the interquartile range of the
+// particles widened by fenceWidth times it at each side, within their
+// bounding box
+const float fenceWidth = 1.0f;
+
+// With fewer particles than this the quartiles tell little, and the mesh
+// covers all of them
+const int minFencedParticles = 64;
+
+// The kernel of the mesh fades to 0 over the last M/8 cells, and at
+// least taperCells (see setup_mesh)
+const int taperCells = 8;
+
+// Floating point operations counted for each pair of particles (as in
+// the previous versions), for each short-range pair and for each
+// complex point of a 1D FFT of S points, 5·log2(S)
+const int flopsParticleInteraction = 20;
+const int flopsShortRangeInteraction = 40;
+
+struct ParticleMesh {
+  int M = 0, S = 0, H = 0;          // cells of the mesh, of the padded mesh (2M) and S/2 + 1
+  int span = 0;                     // cells of the mesh with particles, the rest of M is margin
+  float kernelSplit = 0;            // splitRadius of the kernels
+  vector<float> twiddleRe, twiddleIm;  // exp(-2πik/S), k < S/2
+  vector<int> bitReverse;
+
+  // FFT of the long-range force of a unit mass, in cell units. The
+  // force is real and odd along its axis and even along the others, so
+  // its FFT is imaginary, odd and even in the same way: only its
+  // imaginary part in [0, H)³ is stored.
+  vector<float> kernelX, kernelY, kernelZ;
+
+  vector<float> rhoRe, rhoIm;       // S³: mass of the cells, then its FFT
+  vector<float> workRe, workIm;     // S³: each component of the force
+  vector<float> forceX, forceY, forceZ;  // M³: acceleration at the points of the mesh
+
+  // The mesh: M points from origin with a spacing h in each axis, the
+  // particles in the first span
+  float originX, originY, originZ, h;
+
+  // Cells of the short-range part: cubes of coarseSide cells of the
+  // mesh, nCoarse in each axis. The particles are sorted by cell, those
+  // outside the mesh last: perm[i] is the index in the ParticleSet of
+  // the i-th, (x, y, z) its position and (ax, ay, az) its acceleration;
+  // those of cell c are cellStart[c] to cellStart[c + 1] - 1.
+  int coarseSide, nCoarse, nBulk;
+  vector<int> cellOf, cellStart, perm, counts;
+  vector<float> x, y, z, ax, ay, az;
+
+  // Statistics of the last step
+  double setupTime = 0, sortTime = 0, assignTime = 0, fftTime = 0, interpolateTime = 0, shortRangeTime = 0;
+  double pairInteractions = 0, fftFlops = 0;
+};
+
+// Interleaved butterflies of a radix-2 FFT of S points, each a vector of
+// «width» consecutive complex numbers (SoA, re and im), «stride» floats
+// apart: the FFTs of «width» sequences at once, vectorised across them
+static void fft_vectors(const ParticleMesh& pm, float* re, float* im, size_t stride, int width, int sign) {
+  const int S = pm.S;
+  for (int i = 0; i < S; i++) {
+    const int j = pm.bitReverse[i];
+    if (j > i) {
+      swap_ranges(re + i*stride, re + i*stride + width, re + j*stride);
+      swap_ranges(im + i*stride, im + i*stride + width, im + j*stride);
+    }
+  }
+  for (int len = 2; len <= S; len *= 2) {
+    const int half = len / 2, step = S / len;
+    for (int i = 0; i < S; i += len) {
+      for (int k = 0; k < half; k++) {
+        const float wr = pm.twiddleRe[k*step], wi = sign*pm.twiddleIm[k*step];
+        float* ur = re + (i + k)*stride;
+        float* ui = im + (i + k)*stride;
+        float* vr = re + (i + k + half)*stride;
+        float* vi = im + (i + k + half)*stride;
+#pragma omp simd
+        for (int l = 0; l < width; l++) {
+          const float tr = vr[l]*wr - vi[l]*wi;
+          const float ti = vr[l]*wi + vi[l]*wr;
+          vr[l] = ur[l] - tr;
+          vi[l] = ui[l] - ti;
+          ur[l] += tr;
+          ui[l] += ti;
+        }
+      }
+    }
+  }
+}
+
+// FFT along z, the contiguous axis, of the lines of x < nx and y < ny: in
+// blocks of 16 lines, transposed so that they are transformed together
+static void fft_z(const ParticleMesh& pm, float* re, float* im, int nx, int ny, int sign) {
+  const int S = pm.S, block = 16;
+#pragma omp parallel
+  {
+    vector<float> bufRe(S * block), bufIm(S * block);
+#pragma omp for collapse(2)
+    for (int x = 0; x < nx; x++) {
+      for (int y0 = 0; y0 < ny; y0 += block) {
+        const size_t base = (size_t(x)*S + y0)*S;
+        for (int l = 0; l < block; l++) {
+          for (int z = 0; z < S; z++) {
+            bufRe[z*block + l] = re[base + size_t(l)*S + z];
+            bufIm[z*block + l] = im[base + size_t(l)*S + z];
+          }
+        }
+        fft_vectors(pm, bufRe.data(), bufIm.data(), block, block, sign);
+        for (int l = 0; l < block; l++) {
+          for (int z = 0; z < S; z++) {
+            re[base + size_t(l)*S + z] = bufRe[z*block + l];
+            im[base + size_t(l)*S + z] = bufIm[z*block + l];
+          }
+        }
+      }
+    }
+  }
+}
+
+// FFT along y of the planes x < nx, and along x of all
+static void fft_y(const ParticleMesh& pm, float* re, float* im, int nx, int sign) {
+  const size_t S = pm.S;
+#pragma omp parallel for
+  for (int x = 0; x < nx; x++) {
+    fft_vectors(pm, re + x*S*S, im + x*S*S, S, S, sign);
+  }
+}
+
+static void fft_x(const ParticleMesh& pm, float* re, float* im, int sign) {
+  const size_t S = pm.S;
+#pragma omp parallel for
+  for (int y = 0; y < int(S); y++) {
+    fft_vectors(pm, re + y*S, im + y*S, S*S, S, sign);
+  }
+}
+
+// 3D FFT of a mesh that is zero outside [0, n)³, and inverse (without
+// the 1/S³ factor) of which only [0, n)³ is needed: the lines that are
+// all zeros, or not needed, are skipped. Returns the operations counted.
+static double fft_forward(const ParticleMesh& pm, float* re, float* im, int n) {
+  fft_z(pm, re, im, n, n, -1);
+  fft_y(pm, re, im, n, -1);
+  fft_x(pm, re, im, -1);
+  return 5.0 * pm.S * log2(pm.S) * (double(n)*n + double(n)*pm.S + double(pm.S)*pm.S);
+}
+
+static double fft_inverse(const ParticleMesh& pm, float* re, float* im, int n) {
+  fft_x(pm, re, im, +1);
+  fft_y(pm, re, im, n, +1);
+  fft_z(pm, re, im, n, n, +1);
+  return 5.0 * pm.S * log2(pm.S) * (double(n)*n + double(n)*pm.S + double(pm.S)*pm.S);
+}
+
+// Allocates the mesh of M cells and computes the FFT of the long-range
+// force, once for each mesh size and split: the x component, sampled in
+// cell units, with one FFT, and the other two by symmetry, as
+// Ky(dx, dy, dz) = Kx(dy, dx, dz) and Kz(dx, dy, dz) = Kx(dz, dy, dx)
+static void setup_mesh(ParticleMesh& pm, int M) {
+  if (pm.M == M && pm.kernelSplit == splitRadius) {
+    return;
+  }
+  const double tStart = omp_get_wtime();
+  const int S = 2*M, H = S/2 + 1;
+  const size_t S3 = size_t(S)*S*S;
+  pm.M = M; pm.S = S; pm.H = H;
+  pm.span = M - max(M/8, taperCells);
+  pm.kernelSplit = splitRadius;
+  pm.twiddleRe.resize(S/2);
+  pm.twiddleIm.resize(S/2);
+  for (int k = 0; k < S/2; k++) {
+    pm.twiddleRe[k] = cos(-2*M_PI*k/S);
+    pm.twiddleIm[k] = sin(-2*M_PI*k/S);
+  }
+  pm.bitReverse.resize(S);
+  const int bits = log2(S);
+  for (int i = 0; i < S; i++) {
+    int r = 0;
+    for (int b = 0; b < bits; b++) {
+      r |= ((i >> b) & 1) << (bits - 1 - b);
+    }
+    pm.bitReverse[i] = r;
+  }
+  for (vector<float>* v : {&pm.rhoRe, &pm.rhoIm, &pm.workRe, &pm.workIm}) {
+    v->assign(S3, 0);
+  }
+  for (vector<float>* v : {&pm.forceX, &pm.forceY, &pm.forceZ}) {
+    v->resize(size_t(M)*M*M);
+  }
+
+  // Kx(d) = -dx/|d|³·[erf(x) - 2x/√π·exp(-x²)], x = |d|/(2rs): the pull
+  // of a unit mass at -d. No two particles are more than span - 1 cells
+  // apart in an axis, and beyond that it fades to 0 at M with a cosine
+  // in each axis: cut off sharply, the deconvolution below would spread
+  // the step back onto the distances that are used.
+  const double twoRs = 2*splitRadius;
+  vector<double> taper(M + 1);
+  for (int d = 0; d <= M; d++) {
+    const double t = max(0, d - (pm.span - 1)) / double(M - (pm.span - 1));
+    taper[d] = 0.5 + 0.5*cos(M_PI*t);
+  }
+#pragma omp parallel for collapse(2)
+  for (int i = 0; i < S; i++) {
+    for (int j = 0; j < S; j++) {
+      for (int k = 0; k < S; k++) {
+        const int dx = i < M ? i : i - S, dy = j < M ? j : j - S, dz = k < M ? k : k - S;
+        const double r = sqrt(double(dx)*dx + double(dy)*dy + double(dz)*dz);
+        const size_t idx = (size_t(i)*S + j)*S + k;
+        if (r == 0) {
+          pm.workRe[idx] = 0;
+        } else {
+          const double x = r / twoRs;
+          const double g = erf(x) - 2*x/sqrt(M_PI)*exp(-x*x);
+          pm.workRe[idx] = -dx * g / (r*r*r) * taper[abs(dx)]*taper[abs(dy)]*taper[abs(dz)];
+        }
+        pm.workIm[idx] = 0;
+      }
+    }
+  }
+  fft_forward(pm, pm.workRe.data(), pm.workIm.data(), S);
+  // The assignment and the interpolation each smooth the mass and the
+  // force with the cloud-in-cell window, sinc²(πn/S) in each axis: the
+  // kernels are divided by both
+  vector<double> window(H);
+  for (int a = 0; a < H; a++) {
+    const double s = a == 0 ? 1 : sin(M_PI*a/S) / (M_PI*a/S);
+    window[a] = s*s*s*s;
+  }
+  const size_t H3 = size_t(H)*H*H;
+  pm.kernelX.resize(H3); pm.kernelY.resize(H3); pm.kernelZ.resize(H3);
+#pragma omp parallel for collapse(2)
+  for (int a = 0; a < H; a++) {
+    for (int b = 0; b < H; b++) {
+      for (int c = 0; c < H; c++) {
+        const size_t idx = (size_t(a)*H + b)*H + c;
+        const float deconvolution = 1 / (window[a]*window[b]*window[c]);
+        pm.kernelX[idx] = pm.workIm[(size_t(a)*S + b)*S + c] * deconvolution;
+        pm.kernelY[idx] = pm.workIm[(size_t(b)*S + a)*S + c] * deconvolution;
+        pm.kernelZ[idx] = pm.workIm[(size_t(c)*S + b)*S + a] * deconvolution;
+      }
+    }
+  }
+  pm.setupTime = omp_get_wtime() - tStart;
+}
+
+// Places the mesh over the bulk of the particles, and sorts them by
+// cell of the short-range part with a counting sort: counts of each
+// thread, prefix sums and a scatter, the particles outside the mesh last
+static void sort_by_cell(const int nParticles, const ParticleSet& particle, ParticleMesh& pm) {
+  const int n = nParticles, span = pm.span;
+
+  // Bulk: from the quartiles of a sample of the particles
+  float lo[3], hi[3];
+  const float* coords[3] = {particle.x, particle.y, particle.z};
+  const int stride = max(1, n / 65536);
+  for (int a = 0; a < 3; a++) {
+    vector<float> sample;
+    for (int i = 0; i < n; i += stride) {
+      sample.push_back(coords[a][i]);
+    }
+    const int ns = sample.size();
+    const int iLo = ns / 4, iHi = ns - 1 - iLo;
+    nth_element(sample.begin(), sample.begin() + iLo, sample.end());
+    const float qLo = sample[iLo];
+    nth_element(sample.begin(), sample.begin() + iHi, sample.end());
+    const float qHi = sample[iHi];
+    float minC = coords[a][0], maxC = coords[a][0];
+#pragma omp parallel for simd reduction(min:minC) reduction(max:maxC)
+    for (int i = 0; i < n; i++) {
+      minC = min(minC, coords[a][i]);
+      maxC = max(maxC, coords[a][i]);
+    }
+    const bool fenced = n >= minFencedParticles;
+    lo[a] = fenced ? max(minC, qLo - fenceWidth*(qHi - qLo)) : minC;
+    hi[a] = fenced ? min(maxC, qHi + fenceWidth*(qHi - qLo)) : maxC;
+  }
+  const float side = max({hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2], 1e-30f}) * 1.0001f;
+  pm.originX = lo[0]; pm.originY = lo[1]; pm.originZ = lo[2];
+  pm.h = side / (pm.span - 1);
+
+  pm.coarseSide = ceil(cutoffRadii * splitRadius / shortRangeCells);
+  pm.nCoarse = (pm.span - 2) / pm.coarseSide + 1;
+  const int nCoarse = pm.nCoarse, nCells = nCoarse*nCoarse*nCoarse;
+  pm.cellOf.resize(n);
+  pm.perm.resize(n);
+  pm.cellStart.resize(nCells + 2);
+  for (vector<float>* v : {&pm.x, &pm.y, &pm.z, &pm.ax, &pm.ay, &pm.az}) {
+    v->resize(n);
+  }
+
+  // Cell of each particle, nCells for those outside the mesh
+  const float cellsPerUnit = 1 / pm.h;
+  int* cellOf = pm.cellOf.data();
+#pragma omp parallel for simd
+  for (int i = 0; i < n; i++) {
+    const float u = (particle.x[i] - pm.originX) * cellsPerUnit;
+    const float v = (particle.y[i] - pm.originY) * cellsPerUnit;
+    const float w = (particle.z[i] - pm.originZ) * cellsPerUnit;
+    const bool inside = u >= 0 && u < span - 1 && v >= 0 && v < span - 1 && w >= 0 && w < span - 1;
+    const int cx = int(u) / pm.coarseSide, cy = int(v) / pm.coarseSide, cz = int(w) / pm.coarseSide;
+    cellOf[i] = inside ? (cx*nCoarse + cy)*nCoarse + cz : nCells;
+  }
+
+  const int nBuckets = nCells + 1;
+  pm.counts.resize(size_t(omp_get_max_threads()) * nBuckets);
+#pragma omp parallel
+  {
+    const int nThreads = omp_get_num_threads(), th = omp_get_thread_num();
+    const int b = long(n) * th / nThreads, e = long(n) * (th + 1) / nThreads;
+    int* c = &pm.counts[size_t(th) * nBuckets];
+    fill(c, c + nBuckets, 0);
+    for (int i = b; i < e; i++) {
+      c[cellOf[i]]++;
+    }
+#pragma omp barrier
+#pragma omp single
+    {
+      int sum = 0;
+      for (int d = 0; d < nBuckets; d++) {
+        pm.cellStart[d] = sum;
+        for (int k = 0; k < nThreads; k++) {
+          const int ck = pm.counts[size_t(k) * nBuckets + d];
+          pm.counts[size_t(k) * nBuckets + d] = sum;
+          sum += ck;
+        }
+      }
+      pm.cellStart[nBuckets] = sum;
+    }
+    for (int i = b; i < e; i++) {
+      pm.perm[c[cellOf[i]]++] = i;
+    }
+  }
+  pm.nBulk = pm.cellStart[nCells];
+
+  const int* perm = pm.perm.data();
+#pragma omp parallel for simd
+  for (int i = 0; i < n; i++) {
+    pm.x[i] = particle.x[perm[i]];
+    pm.y[i] = particle.y[perm[i]];
+    pm.z[i] = particle.z[perm[i]];
+  }
+}
+
+// Cloud-in-cell: each particle of the bulk adds its mass to the 8
+// points of the mesh around it, weighted by its distance to each. The
+// particles of the slab of cells of the short-range part x = X only
+// reach the planes of the mesh from X·coarseSide to (X + 1)·coarseSide,
+// so the even slabs are done in parallel, and then the odd ones.
+static void assign_mass(ParticleMesh& pm) {
+  const int S = pm.S, nCoarse = pm.nCoarse;
+  float* rho = pm.rhoRe.data();
+#pragma omp parallel for
+  for (size_t i = 0; i < pm.rhoRe.size(); i += S) {
+    fill(&pm.rhoRe[i], &pm.rhoRe[i] + S, 0.0f);
+    fill(&pm.rhoIm[i], &pm.rhoIm[i] + S, 0.0f);
+  }
+  const float cellsPerUnit = 1 / pm.h;
+  for (int parity = 0; parity < 2; parity++) {
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int X = parity; X < nCoarse; X += 2) {
+      for (int i = pm.cellStart[X*nCoarse*nCoarse]; i < pm.cellStart[(X + 1)*nCoarse*nCoarse]; i++) {
+        const float u = (pm.x[i] - pm.originX) * cellsPerUnit;
+        const float v = (pm.y[i] - pm.originY) * cellsPerUnit;
+        const float w = (pm.z[i] - pm.originZ) * cellsPerUnit;
+        const int iu = u, iv = v, iw = w;
+        const float fu = u - iu, fv = v - iv, fw = w - iw;
+        float* p = rho + (size_t(iu)*S + iv)*S + iw;
+        const size_t dx = size_t(S)*S, dy = S;
+        p[0]       += (1 - fu)*(1 - fv)*(1 - fw);
+        p[1]       += (1 - fu)*(1 - fv)*fw;
+        p[dy]      += (1 - fu)*fv*(1 - fw);
+        p[dy + 1]  += (1 - fu)*fv*fw;
+        p[dx]      += fu*(1 - fv)*(1 - fw);
+        p[dx + 1]  += fu*(1 - fv)*fw;
+        p[dx + dy] += fu*fv*(1 - fw);
+        p[dx + dy + 1] += fu*fv*fw;
+      }
+    }
+  }
+}
+
+// Multiplies the FFT of the mass by that of a component of the force,
+// stored folded into [0, H)³ with its parity, into work
+static void multiply_kernel(ParticleMesh& pm, const vector<float>& kernel, int axis, float scale) {
+  const int S = pm.S, H = pm.H;
+#pragma omp parallel for collapse(2)
+  for (int i = 0; i < S; i++) {
+    for (int j = 0; j < S; j++) {
+      const int fi = i < H ? i : S - i, fj = j < H ? j : S - j;
+      const float sign = axis == 0 ? (i < H ? scale : -scale) : axis == 1 ? (j < H ? scale : -scale) : scale;
+      const float signHigh = axis == 2 ? -sign : sign;
+      const float* k = &kernel[(size_t(fi)*H + fj)*H];
+      const size_t row = (size_t(i)*S + j)*S;
+      const float* rr = &pm.rhoRe[row];
+      const float* ri = &pm.rhoIm[row];
+      float* wr = &pm.workRe[row];
+      float* wi = &pm.workIm[row];
+      // (re + i·im)·(i·kernel)
+#pragma omp simd
+      for (int c = 0; c < H; c++) {
+        wr[c] = -ri[c] * sign*k[c];
+        wi[c] = rr[c] * sign*k[c];
+      }
+#pragma omp simd
+      for (int c = H; c < S; c++) {
+        wr[c] = -ri[c] * signHigh*k[S - c];
+        wi[c] = rr[c] * signHigh*k[S - c];
+      }
+    }
+  }
+}
+
+// Long-range acceleration at the points of the mesh: FFT of the mass
+// and, for each component, product with the FFT of the force and
+// inverse FFT. The force in cell units is scaled by 1/h², and the
+// inverse FFT by 1/S³.
+static void solve_poisson(ParticleMesh& pm) {
+  const int M = pm.M, S = pm.S;
+  pm.fftFlops = fft_forward(pm, pm.rhoRe.data(), pm.rhoIm.data(), M);
+  const float scale = 1 / (double(S)*S*S * pm.h*pm.h);
+  const vector<float>* kernels[3] = {&pm.kernelX, &pm.kernelY, &pm.kernelZ};
+  vector<float>* forces[3] = {&pm.forceX, &pm.forceY, &pm.forceZ};
+  for (int a = 0; a < 3; a++) {
+    multiply_kernel(pm, *kernels[a], a, scale);
+    pm.fftFlops += fft_inverse(pm, pm.workRe.data(), pm.workIm.data(), M);
+    float* force = forces[a]->data();
+#pragma omp parallel for collapse(2)
+    for (int i = 0; i < M; i++) {
+      for (int j = 0; j < M; j++) {
+        copy_n(&pm.workRe[(size_t(i)*S + j)*S], M, force + (size_t(i)*M + j)*M);
+      }
+    }
+  }
+}
+
+// Cloud-in-cell interpolation of the acceleration of the mesh at each
+// particle of the bulk, with the weights of the assignment
+static void interpolate_forces(ParticleMesh& pm) {
+  const int M = pm.M;
+  const float cellsPerUnit = 1 / pm.h;
+  const float *fx = pm.forceX.data(), *fy = pm.forceY.data(), *fz = pm.forceZ.data();
+#pragma omp parallel for simd
+  for (int i = 0; i < pm.nBulk; i++) {
+    const float u = (pm.x[i] - pm.originX) * cellsPerUnit;
+    const float v = (pm.y[i] - pm.originY) * cellsPerUnit;
+    const float w = (pm.z[i] - pm.originZ) * cellsPerUnit;
+    const int iu = u, iv = v, iw = w;
+    const float fu = u - iu, fv = v - iv, fw = w - iw;
+    const size_t p = (size_t(iu)*M + iv)*M + iw, dx = size_t(M)*M, dy = M;
+    const float w000 = (1 - fu)*(1 - fv)*(1 - fw), w001 = (1 - fu)*(1 - fv)*fw;
+    const float w010 = (1 - fu)*fv*(1 - fw), w011 = (1 - fu)*fv*fw;
+    const float w100 = fu*(1 - fv)*(1 - fw), w101 = fu*(1 - fv)*fw;
+    const float w110 = fu*fv*(1 - fw), w111 = fu*fv*fw;
+    pm.ax[i] = w000*fx[p] + w001*fx[p + 1] + w010*fx[p + dy] + w011*fx[p + dy + 1]
+      + w100*fx[p + dx] + w101*fx[p + dx + 1] + w110*fx[p + dx + dy] + w111*fx[p + dx + dy + 1];
+    pm.ay[i] = w000*fy[p] + w001*fy[p + 1] + w010*fy[p + dy] + w011*fy[p + dy + 1]
+      + w100*fy[p + dx] + w101*fy[p + dx + 1] + w110*fy[p + dx + dy] + w111*fy[p + dx + dy + 1];
+    pm.az[i] = w000*fz[p] + w001*fz[p + 1] + w010*fz[p + dy] + w011*fz[p + dy + 1]
+      + w100*fz[p + dx] + w101*fz[p + dx + 1] + w110*fz[p + dx + dy] + w111*fz[p + dx + dy + 1];
+  }
+}
+
+// Short-range part of the force between the particles of each cell and
+// those of the cells around it, gathered in SoA as an interaction
+// list: erfc(x) + 2x/√π·exp(-x²) times the whole force, with erfc from
+// Abramowitz and Stegun 7.1.26 (error below 1.5·10⁻⁷), which shares the
+// exponential and vectorises. Then the particles outside the mesh.
+static void short_range_forces(ParticleMesh& pm) {
+  const int nCoarse = pm.nCoarse, nCells = nCoarse*nCoarse*nCoarse;
+  const float inv2rs = 1 / (2 * splitRadius * pm.h);
+  const float twoOverSqrtPi = 2 / sqrt(M_PI);
+  double pairInteractions = 0;
+#pragma omp parallel reduction(+:pairInteractions)
+  {
+    vector<float> px, py, pz;
+#pragma omp for schedule(dynamic, 16)
+    for (int c = 0; c < nCells; c++) {
+      if (pm.cellStart[c] == pm.cellStart[c + 1]) {
+        continue;
+      }
+      const int cx = c / (nCoarse*nCoarse), cy = c / nCoarse % nCoarse, cz = c % nCoarse;
+      px.clear(); py.clear(); pz.clear();
+      const int d = shortRangeCells;
+      for (int X = max(cx - d, 0); X <= min(cx + d, nCoarse - 1); X++) {
+        for (int Y = max(cy - d, 0); Y <= min(cy + d, nCoarse - 1); Y++) {
+          // The cells of Z from cz - d to cz + d are consecutive
+          const int first = (X*nCoarse + Y)*nCoarse + max(cz - d, 0);
+          const int last = (X*nCoarse + Y)*nCoarse + min(cz + d, nCoarse - 1);
+          const int s = pm.cellStart[first], e = pm.cellStart[last + 1];
+          px.insert(px.end(), &pm.x[0] + s, &pm.x[0] + e);
+          py.insert(py.end(), &pm.y[0] + s, &pm.y[0] + e);
+          pz.insert(pz.end(), &pm.z[0] + s, &pm.z[0] + e);
+        }
+      }
+      const int nP = px.size();
+      const float *lx = px.data(), *ly = py.data(), *lz = pz.data();
+      for (int i = pm.cellStart[c]; i < pm.cellStart[c + 1]; i++) {
+        const float x = pm.x[i], y = pm.y[i], z = pm.z[i];
+        float Fx = 0, Fy = 0, Fz = 0;
+#pragma omp simd reduction(+:Fx,Fy,Fz)
+        for (int j = 0; j < nP; j++) {
+          const float softening = 1e-20f;
+          const float dx = lx[j] - x;
+          const float dy = ly[j] - y;
+          const float dz = lz[j] - z;
+          const float r2 = dx*dx + dy*dy + dz*dz + softening;
+          const float rr = 1.0f/sqrtf(r2);
+          const float s = r2*rr*inv2rs;
+          const float e = expf(-s*s);
+          const float t = 1.0f/(1.0f + 0.3275911f*s);
+          const float erfc = t*(0.254829592f + t*(-0.284496736f + t*(1.421413741f + t*(-1.453152027f + t*1.061405429f))))*e;
+          const float drPowerN32 = (erfc + twoOverSqrtPi*s*e)*rr*rr*rr;
+          Fx += dx * drPowerN32;
+          Fy += dy * drPowerN32;
+          Fz += dz * drPowerN32;
+        }
+        pm.ax[i] += Fx;
+        pm.ay[i] += Fy;
+        pm.az[i] += Fz;
+      }
+      pairInteractions += double(pm.cellStart[c + 1] - pm.cellStart[c]) * nP;
+    }
+  }
+
+  // Particles outside the mesh
+  const int n = pm.x.size(), nBulk = pm.nBulk;
+  if (nBulk < n) {
+    double mx = 0, my = 0, mz = 0;
+#pragma omp parallel for reduction(+:mx,my,mz)
+    for (int i = 0; i < nBulk; i++) {
+      mx += pm.x[i]; my += pm.y[i]; mz += pm.z[i];
+    }
+    const float cx = mx / max(nBulk, 1), cy = my / max(nBulk, 1), cz = mz / max(nBulk, 1);
+    float Gx = 0, Gy = 0, Gz = 0;   // their pull on the bulk
+#pragma omp parallel for reduction(+:Gx,Gy,Gz)
+    for (int i = nBulk; i < n; i++) {
+      const float x = pm.x[i], y = pm.y[i], z = pm.z[i];
+      // Bulk as a point mass
+      const float bx = cx - x, by = cy - y, bz = cz - z;
+      const float rb = 1.0f/sqrtf(bx*bx + by*by + bz*bz + 1e-20f);
+      float Fx = nBulk*bx*rb*rb*rb, Fy = nBulk*by*rb*rb*rb, Fz = nBulk*bz*rb*rb*rb;
+      Gx -= bx*rb*rb*rb; Gy -= by*rb*rb*rb; Gz -= bz*rb*rb*rb;
+#pragma omp simd reduction(+:Fx,Fy,Fz)
+      for (int j = nBulk; j < n; j++) {
+        const float softening = 1e-20f;
+        const float dx = pm.x[j] - x;
+        const float dy = pm.y[j] - y;
+        const float dz = pm.z[j] - z;
+        const float rr = 1.0f/sqrtf(dx*dx + dy*dy + dz*dz + softening);
+        const float drPowerN32 = rr*rr*rr;
+        Fx += dx * drPowerN32;
+        Fy += dy * drPowerN32;
+        Fz += dz * drPowerN32;
+      }
+      pm.ax[i] = Fx;
+      pm.ay[i] = Fy;
+      pm.az[i] = Fz;
+    }
+#pragma omp parallel for simd
+    for (int i = 0; i < nBulk; i++) {
+      pm.ax[i] += Gx;
+      pm.ay[i] += Gy;
+      pm.az[i] += Gz;
+    }
+    pairInteractions += double(n - nBulk) * (n - nBulk + 1);
+  }
+  pm.pairInteractions = pairInteractions;
+}
+
+// Operations counted in the last step
+static double step_flops(const ParticleMesh& pm) {
+  const double outliers = double(pm.x.size() - pm.nBulk);
+  return pm.fftFlops + flopsShortRangeInteraction*(pm.pairInteractions - outliers*(outliers + 1))
+    + flopsParticleInteraction*outliers*(outliers + 1);
+}
+
+// Cells of the mesh in each axis for nParticles
+static int mesh_size(const int nParticles) {
+  int M = meshSize;
+  if (M == 0) {
+    for (M = minMeshSize; M < maxMeshSize && double(M)*M*M < double(cellsPerParticle)*nParticles; M *= 2);
+  }
+  return M;
+}
+
+void MoveParticles(const int nParticles, ParticleSet& particle, const float dt, ParticleMesh& pm) {
+
+  setup_mesh(pm, mesh_size(nParticles));
+
+  double t = omp_get_wtime();
+  sort_by_cell(nParticles, particle, pm);
+  pm.sortTime = omp_get_wtime() - t;
+  t = omp_get_wtime();
+  assign_mass(pm);
+  pm.assignTime = omp_get_wtime() - t;
+  t = omp_get_wtime();
+  solve_poisson(pm);
+  pm.fftTime = omp_get_wtime() - t;
+  t = omp_get_wtime();
+  interpolate_forces(pm);
+  pm.interpolateTime = omp_get_wtime() - t;
+  t = omp_get_wtime();
+  short_range_forces(pm);
+  pm.shortRangeTime = omp_get_wtime() - t;
+
+  // Accelerate particles in response to the gravitational force
+  const int* perm = pm.perm.data();
+#pragma omp parallel for simd
+  for (int i = 0; i < nParticles; i++) {
+    particle.vx[perm[i]] += dt*pm.ax[i];
+    particle.vy[perm[i]] += dt*pm.ay[i];
+    particle.vz[perm[i]] += dt*pm.az[i];
+  }
+
+  // Move particles according to their velocities
+#pragma omp parallel for simd
+  for (int i = 0 ; i < nParticles; i++) {
+    particle.x[i]  += particle.vx[i]*dt;
+    particle.y[i]  += particle.vy[i]*dt;
+    particle.z[i]  += particle.vz[i]*dt;
+  }
+}
+
+// The mesh adds the forces in another order and approximates their
+// long-range part, so the velocities cannot match component by component to
+// an absolute tolerance: a particle near another gets changes of
+// velocity of thousands, and a small component of a large change has
+// the error of the whole. So the error of the change of velocity of
+// each particle, from those of «initial», is relative to its magnitude
+// (absolute below 1), and that of the positions to their value.
+const float tolerance = 1e-2f;
+
+static bool differs(float a, float b) {
+  return abs(a - b) > tolerance * max(1.0f, abs(a));
+}
+
+bool compare_particle_arrays(int nParticles, const ParticleSet& initial, const ParticleSet& a, const ParticleSet& b) {
+  for(int i = 0; i < nParticles; i++) {
+    if (differs(a.x[i], b.x[i])) {
+      printf("%d x %g %g %g\n", i, a.x[i], b.x[i], abs(a.x[i] - b.x[i]));
+      return false;
+    }
+    if (differs(a.y[i], b.y[i])) {
+      printf("%d y %g %g %g\n", i, a.y[i], b.y[i], abs(a.y[i] - b.y[i]));
+      return false;
+    }
+    if (differs(a.z[i], b.z[i])) {
+      printf("%d z %g %g %g\n", i, a.z[i], b.z[i], abs(a.z[i] - b.z[i]));
+      return false;
+    }
+    const float dvx = a.vx[i] - initial.vx[i], dvy = a.vy[i] - initial.vy[i], dvz = a.vz[i] - initial.vz[i];
+    const float ex = b.vx[i] - a.vx[i], ey = b.vy[i] - a.vy[i], ez = b.vz[i] - a.vz[i];
+    const float dv = sqrtf(dvx*dvx + dvy*dvy + dvz*dvz), error = sqrtf(ex*ex + ey*ey + ez*ez);
+    if (error > tolerance * max(1.0f, dv)) {
+      printf("%d v (%g %g %g) (%g %g %g) %g\n", i, a.vx[i], a.vy[i], a.vz[i], b.vx[i], b.vy[i], b.vz[i], error);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Relative error of the changes of velocity of b, from those of a,
+// both from the velocities of «initial»: root mean square and maximum.
+// Particles whose velocity does not change in a (a lone particle) have
+// no relative error and are left out; with none left both are 0
+void velocity_change_error(int nParticles, const ParticleSet& initial, const ParticleSet& a, const ParticleSet& b,
+                           double& rmsError, double& maxError) {
+  rmsError = 0;
+  maxError = 0;
+  int nSamples = 0;
+  for (int i = 0; i < nParticles; i++) {
+    const double ax = a.vx[i] - initial.vx[i], ay = a.vy[i] - initial.vy[i], az = a.vz[i] - initial.vz[i];
+    const double ex = b.vx[i] - a.vx[i], ey = b.vy[i] - a.vy[i], ez = b.vz[i] - a.vz[i];
+    const double change = ax*ax + ay*ay + az*az;
+    if (change == 0) {
+      continue;
+    }
+    const double error = sqrt((ex*ex + ey*ey + ez*ez) / change);
+    rmsError += error * error;
+    maxError = max(maxError, error);
+    nSamples++;
+  }
+  rmsError = nSamples > 0 ? sqrt(rmsError / nSamples) : 0;
+}
+
+ParticleSet alloc_particle_set(int nParticles) {
+  ParticleSet particle;
+  const size_t bytes = (sizeof(float)*nParticles + 63) / 64 * 64;
+  particle.x  = (float*) aligned_alloc(64, bytes);
+  particle.y  = (float*) aligned_alloc(64, bytes);
+  particle.z  = (float*) aligned_alloc(64, bytes);
+  particle.vx = (float*) aligned_alloc(64, bytes);
+  particle.vy = (float*) aligned_alloc(64, bytes);
+  particle.vz = (float*) aligned_alloc(64, bytes);
+  return particle;
+}
+
+void free_particle_set(ParticleSet& particle) {
+  free( particle.x );
+  free( particle.y );
+  free( particle.z );
+  free( particle.vx );
+  free( particle.vy );
+  free( particle.vz );
+}
+
+// MoveParticles_Orig is O(N²), so the result is checked on the first
+// particles only, as a problem of their own
+const int maxCheckParticles = 16384;
+
+int main(const int argc, const char** argv) {
+
+  // Problem size and other parameters
+  const int nParticles = (argc > 1 ? atoi(argv[1]) : 16384);
+  meshSize = (argc > 2 ? atoi(argv[2]) : meshSize);
+  splitRadius = (argc > 3 ? atof(argv[3]) : splitRadius);
+  if (meshSize != 0 && (meshSize < minMeshSize || meshSize > maxMeshSize || (meshSize & (meshSize - 1)) != 0)) {
+    fprintf(stderr, "Incorrect mesh size (0 or a power of 2 from %d to %d): %s\n", minMeshSize, maxMeshSize, argv[2]);
+    return 1;
+  }
+  if (splitRadius <= 0) {
+    fprintf(stderr, "Incorrect split radius (greater than 0): %s\n", argv[3]);
+    return 1;
+  }
+  const int nSteps = 10;  // Duration of test
+  const float dt = 0.01f; // Particle propagation time step
+
+  // Particle data stored as a Structure of Arrays (SoA)
+  // this may not be good in object-oriented programming,
+  // however, makes vectorization much more efficient
+  ParticleSet particle = alloc_particle_set(nParticles);
+
+  // Initialize random number generator and particles
+  mt19937 generator(0); // 32 bit Mersenne Twister pseudo-random generator
+  uniform_real_distribution<float> distribution(0,1);
+  for(int i = 0; i < nParticles; i++) {
+    particle.x[i] = distribution(generator);
+    particle.y[i] = distribution(generator);
+    particle.z[i] = distribution(generator);
+    particle.vx[i] = distribution(generator);
+    particle.vy[i] = distribution(generator);
+    particle.vz[i] = distribution(generator);
+  }
+
+  // Para calcular el resultado orginal y comprobar que da lo mismo, con
+  // las primeras nCheck partículas
+  const int nCheck = min(nParticles, maxCheckParticles);
+  ParticleSet particle_reference = alloc_particle_set(nCheck);
+  ParticleSet particle_check = alloc_particle_set(nCheck);
+  // Setting particle_reference and particle_check to the same initial values
+  for(int i = 0; i < nCheck; i++) {
+    particle_reference.x[i] = particle_check.x[i] = particle.x[i];
+    particle_reference.y[i] = particle_check.y[i] = particle.y[i];
+    particle_reference.z[i] = particle_check.z[i] = particle.z[i];
+    particle_reference.vx[i] = particle_check.vx[i] = particle.vx[i];
+    particle_reference.vy[i] = particle_check.vy[i] = particle.vy[i];
+    particle_reference.vz[i] = particle_check.vz[i] = particle.vz[i];
+  }
+  // Calcualte reference solution
+  MoveParticles_Orig(nCheck, particle_reference, dt);
+  ParticleMesh pm;
+  MoveParticles(nCheck, particle_check, dt, pm);
+  double rmsError, maxError;
+  velocity_change_error(nCheck, particle, particle_reference, particle_check, rmsError, maxError);
+  if (!compare_particle_arrays(nCheck, particle, particle_reference, particle_check)) {
+    printf("Relative error of the changes of velocity: %.2e rms, %.2e maximum.\n", rmsError, maxError);
+    printf("-----------------------------------------------------\n");
+    printf("\033[31mDO PANIC: The final result is wrong \033[0m\n");
+    printf("-----------------------------------------------------\n");
+    return 1;
+  }
+
+  // Perform benchmark
+  printf("\n\033[1mNBODY Version 07 (particle-mesh, %d³ cells, split at %g cells)\033[0m\n", mesh_size(nParticles), splitRadius);
+  printf("\nPropagating %d particles using %d threads on %s...\n\n",
+	 nParticles, omp_get_max_threads(), "CPU");
+  double rate = 0, dRate = 0; // Benchmarking data
+  double time = 0, phaseTime[5] = {0, 0, 0, 0, 0};
+  const int skipSteps = 3; // Skip first iterations to warm-up
+  printf("\033[1m%5s %10s %10s %10s %10s %10s %10s %10s %8s\033[0m\n", "Step", "Time, s", "Sort, s", "Assign, s", "FFT, s", "Interp, s", "Short, s", "Interact/s", "GFLOP/s"); fflush(stdout);
+  for (int step = 1; step <= nSteps; step++) {
+
+    const double tStart = omp_get_wtime(); // Start timing
+    MoveParticles(nParticles, particle, dt, pm);
+    const double tEnd = omp_get_wtime(); // End timing
+
+    // Pairs of particles actually computed, and operations of the FFTs and the pairs
+    const double HztoInts   = pm.pairInteractions;
+    const double HztoGFLOPs = 1e-9*step_flops(pm);
+    const double phases[5] = {pm.sortTime, pm.assignTime, pm.fftTime, pm.interpolateTime, pm.shortRangeTime};
+
+    if (step > skipSteps) { // Collect statistics
+      rate  += HztoGFLOPs/(tEnd - tStart);
+      dRate += HztoGFLOPs*HztoGFLOPs/((tEnd - tStart)*(tEnd-tStart));
+      time += tEnd - tStart;
+      for (int p = 0; p < 5; p++) {
+        phaseTime[p] += phases[p];
+      }
+    }
+
+    printf("%5d %10.3e %10.3e %10.3e %10.3e %10.3e %10.3e %10.3e %8.1f %s\n",
+	   step, (tEnd-tStart), phases[0], phases[1], phases[2], phases[3], phases[4], HztoInts/(tEnd-tStart), HztoGFLOPs/(tEnd-tStart), (step<=skipSteps?"*":""));
+    fflush(stdout);
+  }
+  rate/=(double)(nSteps-skipSteps);
+  dRate=sqrt(dRate/(double)(nSteps-skipSteps)-rate*rate);
+  printf("-----------------------------------------------------\n");
+  printf("\033[1m%s %4s \033[32m%10.1f +- %.1f GFLOP/s\033[0m\n",
+	 "Average performance:", "", rate, dRate);
+  printf("\033[1m%s %3s %10.3e s\033[0m (sort %.3e, assign %.3e, FFT %.3e, interpolate %.3e, short range %.3e)\n",
+	 "Average time per step:", "", time/(nSteps-skipSteps), phaseTime[0]/(nSteps-skipSteps), phaseTime[1]/(nSteps-skipSteps),
+	 phaseTime[2]/(nSteps-skipSteps), phaseTime[3]/(nSteps-skipSteps), phaseTime[4]/(nSteps-skipSteps));
+  printf("-----------------------------------------------------\n");
+  printf("Mesh set up in %.3e s. In the last step: %.0f short-range interactions per particle, %d particles outside the mesh.\n",
+	 pm.setupTime, pm.pairInteractions/nParticles, nParticles - pm.nBulk);
+  printf("* - warm-up, not included in average.\n");
+  printf("The result after 1 iteration of %d particles was correct.\n", nCheck);
+  printf("Relative error of the changes of velocity: %.2e rms, %.2e maximum.\n\n", rmsError, maxError);
+
+  free_particle_set(particle);
+  free_particle_set(particle_reference);
+  free_particle_set(particle_check);
+
+  return 0;
+}